@@ -0,0 +1,87 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include "block_index.h"
+
+#define LOOKUP_COUNT 10000000
+#define FILE_COUNT 8
+
+// The (fd, block_number) key and hash NRUCache used before BlockIndex
+struct CacheKey {
+    int fd;
+    off_t block_number;
+
+    bool operator==(const CacheKey& other) const {
+        return fd == other.fd && block_number == other.block_number;
+    }
+};
+
+struct CacheKeyHash {
+    size_t operator()(const CacheKey& k) const {
+        return std::hash<int>()(k.fd) ^ (std::hash<off_t>()(k.block_number) << 1);
+    }
+};
+
+long long get_time_ns() {
+    using namespace std::chrono;
+    return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+// Consecutive block numbers across several files, as a warmed-up cache holds them
+std::vector<CacheKey> make_keys(size_t count) {
+    std::vector<CacheKey> keys;
+    keys.reserve(count);
+    for (size_t i = 0; i < count; i++)
+        keys.push_back({static_cast<int>(i % FILE_COUNT) + 1, static_cast<off_t>(i / FILE_COUNT)});
+    return keys;
+}
+
+// Random hit sequence shared by both tables
+std::vector<uint32_t> make_probes(size_t count) {
+    std::vector<uint32_t> probes(LOOKUP_COUNT);
+    for (auto& p : probes)
+        p = static_cast<uint32_t>(((static_cast<size_t>(rand()) << 16) ^ rand()) % count);
+    return probes;
+}
+
+void bench(size_t count) {
+    std::vector<CacheKey> keys = make_keys(count);
+    std::vector<uint32_t> probes = make_probes(count);
+
+    std::unordered_map<CacheKey, uint32_t, CacheKeyHash> map;
+    BlockIndex index(count);
+    for (size_t i = 0; i < count; i++) {
+        map[keys[i]] = static_cast<uint32_t>(i);
+        index.insert(keys[i].fd, keys[i].block_number, static_cast<uint32_t>(i));
+    }
+
+    uint64_t checksum = 0;
+    long long start = get_time_ns();
+    for (uint32_t p : probes)
+        checksum += map.find(keys[p])->second;
+    long long map_ns = get_time_ns() - start;
+
+    start = get_time_ns();
+    for (uint32_t p : probes)
+        checksum -= index.find(keys[p].fd, keys[p].block_number);
+    long long index_ns = get_time_ns() - start;
+
+    printf("%8zu entries: unordered_map %6.2f ns/hit, BlockIndex %6.2f ns/hit%s\n",
+           count,
+           static_cast<double>(map_ns) / LOOKUP_COUNT,
+           static_cast<double>(index_ns) / LOOKUP_COUNT,
+           checksum == 0 ? "" : " (MISMATCH)");
+}
+
+int main() {
+    printf("--------------------------------------------------\n");
+    printf("\n=== Index Hit Path Latency ===\n");
+    bench(2048);
+    bench(1 << 16);
+    bench(1 << 20);
+    printf("--------------------------------------------------\n");
+    return 0;
+}
@@ -1,21 +1,72 @@
+#include <atomic>
+#include <chrono>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
 #include <string>
-#include <windows.h>
+#include <thread>
+#include <vector>
 #include "file_operations.h"
 
+#ifndef _WIN32
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+#endif
+
 #define FILE_SIZE (1 << 26) // 64 MB
 #define BLOCK_SIZE 4096
 #define NUM_BLOCKS (FILE_SIZE / BLOCK_SIZE)
 #define HOT_AREA_SIZE 1024
 #define ITER_COUNT 3000
+#define MT_ITER_COUNT 200000
+#define ASYNC_DEPTH 16
+#define SCAN_RECORD_BLOCKS 16
+#define SMALL_FILE_COUNT 64
+#define SMALL_FILE_BLOCKS 16
+#define SCAN_READ_BLOCKS 64
+#define POLICY_ITER_COUNT 50000
+#define POLICY_HOT_BLOCKS 1792
+#define SWEEP_MAX_READ (1 << 20)
+#define EXTENT_BLOCKS 16
+#define SHARED_PROCESSES 4
+#define SHARED_AREA_BLOCKS 1536
+#define SHARED_ITER_COUNT 6000
+#define SHARED_TIER_BYTES (16 << 20)
+#define WARM_AREA_BLOCKS 1536
+#define WARM_ITER_COUNT 20000
+#define WARM_WINDOW 256
+#define WARM_STEADY_RATIO 0.95
+#define LARGE_CACHE_BLOCKS (1 << 17) // 512 MB
+#define LARGE_FILE_BLOCKS (LARGE_CACHE_BLOCKS / 4 * 3)
+#define LARGE_HIT_COUNT 2000000
+#define NUMA_NODES 2
+#define NUMA_FILE_BLOCKS 512
+#define NUMA_ITER_COUNT 100000
+#define COMPRESS_CACHE_BLOCKS 2048
+#define COMPRESS_AREA_BLOCKS 3072
+#define COMPRESS_ITER_COUNT 20000
+#define COMPRESS_ORIGIN_DELAY_US 100 // A fast network volume
+#define VICTIM_CACHE_BLOCKS 1024
+#define VICTIM_AREA_BLOCKS 4096
+#define VICTIM_ITER_COUNT 4000
+#define VICTIM_FILE_BYTES (32 << 20)
+#define ORIGIN_DELAY_US 500 // A network volume's read latency
+#define BUDGET_CACHE_BLOCKS 8192 // 32 MB ceiling
+#define BUDGET_AREA_BLOCKS 6144
+#define BUDGET_THREADS 4
+#define BUDGET_PHASE_MS 300
+#define PRESSURE_POLL_MS 20
 
 // Helper function to get current time in nanoseconds
 long long get_time_ns() {
-    LARGE_INTEGER frequency, time;
-    QueryPerformanceFrequency(&frequency);
-    QueryPerformanceCounter(&time);
-    return (long long)(time.QuadPart * 1e9 / frequency.QuadPart);
+    using namespace std::chrono;
+    return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
 }
 
 // Convert nanoseconds to milliseconds
@@ -41,278 +92,1312 @@ void print_test_result(const char *test_name, long long duration_ns) {
     printf("%s: %.2f ms\n", test_name, ns_to_ms(duration_ns));
 }
 
+// Readahead counters accumulated between two lab2_stats() snapshots
+void print_prefetch_stats(const CacheStats &before, const CacheStats &after) {
+    unsigned long long issued = after.prefetch_issued - before.prefetch_issued;
+    unsigned long long hits = after.prefetch_hits - before.prefetch_hits;
+    unsigned long long wasted = after.prefetch_wasted - before.prefetch_wasted;
+    printf("  prefetched %llu blocks, %llu used (%.1f%%), %llu evicted unused\n",
+           issued, hits, issued ? 100.0 * hits / issued : 0.0, wasted);
+}
+
+// Write-back counters accumulated between two lab2_stats() snapshots
+void print_writeback_stats(const CacheStats &before, const CacheStats &after) {
+    unsigned long long flushed = after.flushed_blocks - before.flushed_blocks;
+    unsigned long long writes = after.flush_writes - before.flush_writes;
+    printf("  flusher wrote %llu blocks in %llu requests, %llu synchronous evict write-backs\n",
+           flushed, writes, (unsigned long long) (after.evict_writebacks - before.evict_writebacks));
+    printf("  %llu write misses without a disk read, %llu deferred fills\n",
+           (unsigned long long) (after.reads_avoided - before.reads_avoided),
+           (unsigned long long) (after.fill_reads - before.fill_reads));
+}
+
+// Latency histogram of the operations between two lab2_stats() snapshots
+LatencyHistogram latency_delta(const LatencyHistogram &before, const LatencyHistogram &after) {
+    LatencyHistogram delta;
+    for (size_t i = 0; i < LatencyHistogram::buckets; i++)
+        delta.count[i] = after.count[i] - before.count[i];
+    return delta;
+}
+
+void print_latency(const char *name, const LatencyHistogram &hist) {
+    printf("  %s: %llu ops, p50 < %llu ns, p99 < %llu ns\n", name, (unsigned long long) hist.total(),
+           (unsigned long long) hist.percentile(0.5), (unsigned long long) hist.percentile(0.99));
+}
+
+// Hit ratio, backend traffic and hit/miss latency between two lab2_stats() snapshots
+void print_cache_stats(const CacheStats &before, const CacheStats &after) {
+    unsigned long long hits = after.hits - before.hits;
+    unsigned long long misses = after.misses - before.misses;
+    printf("  %llu hits, %llu misses (%.1f%% hit ratio), %llu KB read from disk\n", hits, misses,
+           hits + misses ? 100.0 * hits / (hits + misses) : 0.0,
+           (unsigned long long) (after.bytes_read - before.bytes_read) / 1024);
+    print_latency("hit latency ", latency_delta(before.hit_latency, after.hit_latency));
+    print_latency("miss latency", latency_delta(before.miss_latency, after.miss_latency));
+}
+
 // RandomRead_Cached
-void test_random_read_cached(const char *path) {
-    int fd = lab2_open(path);
+void test_random_read_cached(const char *path, int flags = 0) {
+    int fd = lab2_open(path, flags);
     if (fd < 0) {
         perror("lab2_open");
         return;
     }
 
-    char buf[BLOCK_SIZE];
+    alignas(BLOCK_SIZE) char buf[BLOCK_SIZE];
+    CacheStats before = lab2_stats();
     long long start = get_time_ns();
 
     for (int i = 0; i < ITER_COUNT; i++) {
         size_t block = random_block(0, NUM_BLOCKS);
         off_t offset = block * BLOCK_SIZE;
-        lab2_lseek(fd, offset, SEEK_SET);
-        lab2_read(fd, buf, BLOCK_SIZE);
+        lab2_pread(fd, buf, BLOCK_SIZE, offset);
+    }
+
+    long long end = get_time_ns();
+    print_test_result(flags ? "RandomRead_Mapped  " : "RandomRead_Cached  ", end - start);
+    if (!flags) print_cache_stats(before, lab2_stats());
+
+    lab2_close(fd);
+}
+
+// RandomRead_Cached with ASYNC_DEPTH reads in flight through lab2_read_async
+void test_random_read_async(const char *path) {
+    int fd = lab2_open(path);
+    if (fd < 0) {
+        perror("lab2_open");
+        return;
+    }
+
+    alignas(BLOCK_SIZE) static char bufs[ASYNC_DEPTH][BLOCK_SIZE];
+    CacheCompletion done[ASYNC_DEPTH];
+    long long start = get_time_ns();
+
+    // Each completion frees its buffer slot (the tag) for the next read
+    int issued = 0;
+    for (; issued < ASYNC_DEPTH && issued < ITER_COUNT; issued++)
+        lab2_read_async(fd, bufs[issued], BLOCK_SIZE, random_block(0, NUM_BLOCKS) * BLOCK_SIZE, issued);
+    for (int completed = 0; completed < ITER_COUNT;) {
+        int n = lab2_poll(done, ASYNC_DEPTH, 1);
+        for (int i = 0; i < n; i++, completed++) {
+            if (issued < ITER_COUNT) {
+                uint64_t slot = done[i].tag;
+                lab2_read_async(fd, bufs[slot], BLOCK_SIZE, random_block(0, NUM_BLOCKS) * BLOCK_SIZE, slot);
+                issued++;
+            }
+        }
     }
 
     long long end = get_time_ns();
-    print_test_result("RandomRead_Cached  ", end - start);
+    print_test_result("RandomRead_Async   ", end - start);
 
     lab2_close(fd);
 }
 
 // RandomRead_Uncached
 void test_random_read_uncached(const char *path) {
-    HANDLE hFile = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_NO_BUFFERING, NULL);
-    if (hFile == INVALID_HANDLE_VALUE) {
-        perror("CreateFileA");
+    auto backend = createStorageBackend();
+    NativeHandle hFile = backend->openFile(path, true);
+    if (hFile == INVALID_NATIVE_HANDLE) {
+        perror("openFile");
         return;
     }
 
-    char buf[BLOCK_SIZE];
+    alignas(BLOCK_SIZE) char buf[BLOCK_SIZE];
     long long start = get_time_ns();
 
     for (int i = 0; i < ITER_COUNT; i++) {
         size_t block = random_block(0, NUM_BLOCKS);
         off_t offset = block * BLOCK_SIZE;
-        DWORD bytesRead;
-        SetFilePointer(hFile, offset, NULL, FILE_BEGIN);
-        ReadFile(hFile, buf, BLOCK_SIZE, &bytesRead, NULL);
+        backend->readAt(hFile, buf, BLOCK_SIZE, offset);
     }
 
     long long end = get_time_ns();
     print_test_result("RandomRead_Uncached", end - start);
 
-    CloseHandle(hFile);
+    backend->closeFile(hFile);
 }
 
 // MixedWorkload_Cached
-void test_mixed_workload_cached(const char *path) {
-    int fd = lab2_open(path);
+void test_mixed_workload_cached(const char *path, int flags = 0) {
+    int fd = lab2_open(path, flags);
     if (fd < 0) {
         perror("lab2_open");
         return;
     }
 
-    char buf[BLOCK_SIZE];
+    alignas(BLOCK_SIZE) char buf[BLOCK_SIZE];
+    CacheStats before = lab2_stats();
     long long start = get_time_ns();
 
     for (int i = 0; i < ITER_COUNT; i++) {
         size_t block = random_block(0, NUM_BLOCKS);
         off_t offset = block * BLOCK_SIZE;
-        lab2_lseek(fd, offset, SEEK_SET);
-
         if (i % 10 < 7) {
-            lab2_read(fd, buf, BLOCK_SIZE);
+            lab2_pread(fd, buf, BLOCK_SIZE, offset);
         } else {
-            lab2_write(fd, buf, BLOCK_SIZE);
+            lab2_pwrite(fd, buf, BLOCK_SIZE, offset);
         }
     }
 
     long long end = get_time_ns();
-    print_test_result("MixedWorkload_Cached  ", end - start);
+    print_test_result(flags ? "MixedWorkload_Mapped  " : "MixedWorkload_Cached  ", end - start);
+    if (!flags) print_writeback_stats(before, lab2_stats());
 
     lab2_close(fd);
 }
 
 // MixedWorkload_Uncached
 void test_mixed_workload_uncached(const char *path) {
-    HANDLE hFile = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_FLAG_NO_BUFFERING, NULL);
-    if (hFile == INVALID_HANDLE_VALUE) {
-        perror("CreateFileA");
+    auto backend = createStorageBackend();
+    NativeHandle hFile = backend->openFile(path, true);
+    if (hFile == INVALID_NATIVE_HANDLE) {
+        perror("openFile");
         return;
     }
 
-    char buf[BLOCK_SIZE];
+    alignas(BLOCK_SIZE) char buf[BLOCK_SIZE];
     long long start = get_time_ns();
 
     for (int i = 0; i < ITER_COUNT; i++) {
         size_t block = random_block(0, NUM_BLOCKS);
         off_t offset = block * BLOCK_SIZE;
-        DWORD bytesRead, bytesWritten;
-
         if (i % 10 < 7) {
-            SetFilePointer(hFile, offset, NULL, FILE_BEGIN);
-            ReadFile(hFile, buf, BLOCK_SIZE, &bytesRead, NULL);
+            backend->readAt(hFile, buf, BLOCK_SIZE, offset);
         } else {
-            SetFilePointer(hFile, offset, NULL, FILE_BEGIN);
-            WriteFile(hFile, buf, BLOCK_SIZE, &bytesWritten, NULL);
-            FlushFileBuffers(hFile);
+            backend->writeAt(hFile, buf, BLOCK_SIZE, offset);
+            backend->syncFile(hFile);
         }
     }
 
     long long end = get_time_ns();
     print_test_result("MixedWorkload_Uncached", end - start);
 
-    CloseHandle(hFile);
+    backend->closeFile(hFile);
 }
 
 // TightAreaRandomRead_Cached
-void test_tight_area_random_read_cached(const char *path) {
-    int fd = lab2_open(path);
+void test_tight_area_random_read_cached(const char *path, int flags = 0) {
+    int fd = lab2_open(path, flags);
     if (fd < 0) {
         perror("lab2_open");
         return;
     }
 
-    char buf[BLOCK_SIZE];
+    alignas(BLOCK_SIZE) char buf[BLOCK_SIZE];
+    CacheStats before = lab2_stats();
     long long start = get_time_ns();
 
     for (int i = 0; i < ITER_COUNT; i++) {
         size_t block = random_block(0, HOT_AREA_SIZE);
         off_t offset = block * BLOCK_SIZE;
-        lab2_lseek(fd, offset, SEEK_SET);
-        lab2_read(fd, buf, BLOCK_SIZE);
+        lab2_pread(fd, buf, BLOCK_SIZE, offset);
+    }
+
+    long long end = get_time_ns();
+    print_test_result(flags ? "TightAreaRandomRead_Mapped  " : "TightAreaRandomRead_Cached  ", end - start);
+    if (!flags) print_cache_stats(before, lab2_stats());
+
+    lab2_close(fd);
+}
+
+// One hot-area random read; true if it was served without a miss
+bool hot_read_hit(int fd, char *buf) {
+    CacheStats before = lab2_stats();
+    lab2_pread(fd, buf, BLOCK_SIZE, random_block(0, HOT_AREA_SIZE) * BLOCK_SIZE);
+    CacheStats after = lab2_stats();
+    return after.misses == before.misses && after.fill_reads == before.fill_reads;
+}
+
+double hot_hit_rate(int fd, char *buf, int reads) {
+    int hits = 0;
+    for (int i = 0; i < reads; i++) hits += hot_read_hit(fd, buf);
+    return 100.0 * hits / reads;
+}
+
+// Hot-area random reads before, during and after a sequential scan of the
+// whole file through a second fd, one hot read per scan read of scan_blocks
+// blocks. Prints the hot-read hit rate of each phase.
+void test_hot_set_during_scan(const char *path, size_t scan_blocks, size_t bypass_bytes) {
+    int hot = lab2_open(path);
+    int scan = lab2_open(path);
+    if (hot < 0 || scan < 0) {
+        perror("lab2_open");
+        return;
+    }
+    lab2_set_scan_bypass(bypass_bytes);
+
+    alignas(BLOCK_SIZE) static char buf[SCAN_READ_BLOCKS * BLOCK_SIZE];
+    for (size_t block = 0; block < HOT_AREA_SIZE; block++)
+        lab2_pread(hot, buf, BLOCK_SIZE, block * BLOCK_SIZE);
+    double before = hot_hit_rate(hot, buf, ITER_COUNT);
+
+    int hits = 0;
+    int reads = 0;
+    long long start = get_time_ns();
+    for (size_t block = 0; block + scan_blocks <= NUM_BLOCKS; block += scan_blocks) {
+        lab2_pread(scan, buf, scan_blocks * BLOCK_SIZE, block * BLOCK_SIZE);
+        hits += hot_read_hit(hot, buf);
+        reads++;
+    }
+    long long end = get_time_ns();
+    double after = hot_hit_rate(hot, buf, ITER_COUNT);
+
+    char name[64];
+    snprintf(name, sizeof(name), "HotSetDuringScan_%zuK%s", scan_blocks * BLOCK_SIZE / 1024,
+             bypass_bytes ? "_Bypass" : "");
+    printf("%-28s: %.2f ms, hot hit rate %.1f%% before, %.1f%% during, %.1f%% after\n", name,
+           ns_to_ms(end - start), before, 100.0 * hits / reads, after);
+
+    lab2_set_scan_bypass(0);
+    lab2_close(scan);
+    lab2_close(hot);
+}
+
+// Light scan of a buffer: one byte per cache line, like a parser skimming records
+unsigned scan_bytes(const char *data, size_t len) {
+    unsigned sum = 0;
+    for (size_t i = 0; i < len; i += 64) sum += (unsigned char) data[i];
+    return sum;
+}
+
+// Records of SCAN_RECORD_BLOCKS blocks in the warm hot area, scanned through
+// lab2_pread copies and through zero-copy views
+void test_tight_area_scan(const char *path) {
+    int fd = lab2_open(path);
+    if (fd < 0) {
+        perror("lab2_open");
+        return;
     }
 
+    const size_t record = SCAN_RECORD_BLOCKS * BLOCK_SIZE;
+    alignas(BLOCK_SIZE) static char buf[SCAN_RECORD_BLOCKS * BLOCK_SIZE];
+    for (size_t block = 0; block < HOT_AREA_SIZE; block += SCAN_RECORD_BLOCKS)
+        lab2_pread(fd, buf, record, block * BLOCK_SIZE);
+
+    unsigned sum = 0;
+    long long start = get_time_ns();
+    for (int i = 0; i < ITER_COUNT * 10; i++) {
+        size_t block = random_block(0, HOT_AREA_SIZE - SCAN_RECORD_BLOCKS);
+        lab2_pread(fd, buf, record, block * BLOCK_SIZE);
+        sum += scan_bytes(buf, record);
+    }
     long long end = get_time_ns();
-    print_test_result("TightAreaRandomRead_Cached  ", end - start);
+    print_test_result("TightAreaScan_Copy", end - start);
+
+    start = get_time_ns();
+    for (int i = 0; i < ITER_COUNT * 10; i++) {
+        size_t block = random_block(0, HOT_AREA_SIZE - SCAN_RECORD_BLOCKS);
+        CacheViewPtr view = lab2_read_view(fd, block * BLOCK_SIZE, record);
+        for (int part = 0; view && part < view->iovcnt(); part++)
+            sum += scan_bytes(static_cast<const char *>(view->iov()[part].iov_base), view->iov()[part].iov_len);
+    }
+    end = get_time_ns();
+    print_test_result("TightAreaScan_View", end - start);
+    if (sum == 1) printf("\n"); // Keep the scans from being optimized out
 
     lab2_close(fd);
 }
 
 // TightAreaRandomRead_Uncached
 void test_tight_area_random_read_uncached(const char *path) {
-    HANDLE hFile = CreateFileA(path,
-        GENERIC_READ, FILE_SHARE_READ,
-        nullptr,
-        OPEN_EXISTING,
-        FILE_FLAG_NO_BUFFERING,
-        nullptr
-    );
-
-    if (hFile == INVALID_HANDLE_VALUE) {
-        perror("CreateFileA");
+    auto backend = createStorageBackend();
+    NativeHandle hFile = backend->openFile(path, true);
+    if (hFile == INVALID_NATIVE_HANDLE) {
+        perror("openFile");
         return;
     }
 
-    char buf[BLOCK_SIZE];
+    alignas(BLOCK_SIZE) char buf[BLOCK_SIZE];
     long long start = get_time_ns();
 
     for (int i = 0; i < ITER_COUNT; i++) {
         size_t block = random_block(0, HOT_AREA_SIZE);
         off_t offset = block * BLOCK_SIZE;
-        DWORD bytesRead;
-        SetFilePointer(hFile, offset, NULL, FILE_BEGIN);
-        ReadFile(hFile, buf, BLOCK_SIZE, &bytesRead, NULL);
+        backend->readAt(hFile, buf, BLOCK_SIZE, offset);
     }
 
     long long end = get_time_ns();
     print_test_result("TightAreaRandomRead_Uncached", end - start);
 
-    CloseHandle(hFile);
+    backend->closeFile(hFile);
 }
 
 // SequentialRead_Cached
-void test_sequential_read_cached(const char *path) {
-    int fd = lab2_open(path);
+void test_sequential_read_cached(const char *path, int flags = 0) {
+    int fd = lab2_open(path, flags);
     if (fd < 0) {
         perror("lab2_open");
         return;
     }
 
-    char buf[BLOCK_SIZE];
+    alignas(BLOCK_SIZE) char buf[BLOCK_SIZE];
     long long start = get_time_ns();
 
+    CacheStats before = lab2_stats();
     for (size_t block = 0; block < NUM_BLOCKS; block++) {
         off_t offset = block * BLOCK_SIZE;
-        lab2_lseek(fd, offset, SEEK_SET);
-        lab2_read(fd, buf, BLOCK_SIZE);
+        lab2_pread(fd, buf, BLOCK_SIZE, offset);
     }
 
     long long end = get_time_ns();
-    print_test_result("SequentialRead_Cached  ", end - start);
+    print_test_result(flags ? "SequentialRead_Mapped  " : "SequentialRead_Cached  ", end - start);
+    if (!flags) print_prefetch_stats(before, lab2_stats());
 
     lab2_close(fd);
 }
 
+// Sequential read of the whole file in read_size chunks, cached block by block
+// or with the extent ladder. Prints throughput, backend read requests and the
+// index entries the file occupies at the end.
+void test_read_size_sweep(const char *path, size_t read_size, bool extents) {
+    static const size_t blocks_only[] = {BLOCK_SIZE};
+    static const size_t ladder[] = {BLOCK_SIZE, EXTENT_BLOCKS * BLOCK_SIZE};
+    if (extents) lab2_set_extents(ladder, 2);
+    else lab2_set_extents(blocks_only, 1);
+
+    int fd = lab2_open(path);
+    if (fd < 0) {
+        perror("lab2_open");
+        return;
+    }
+
+    alignas(BLOCK_SIZE) static char buf[SWEEP_MAX_READ];
+    CacheStats before = lab2_stats();
+    long long start = get_time_ns();
+    for (size_t offset = 0; offset < FILE_SIZE; offset += read_size)
+        lab2_pread(fd, buf, read_size, offset);
+    long long end = get_time_ns();
+    CacheStats after = lab2_stats();
+
+    char name[64];
+    snprintf(name, sizeof(name), "ReadSize_%zuK_%s", read_size / 1024, extents ? "Extents" : "Blocks");
+    printf("%-22s: %.2f ms, %.0f MB/s, %llu read requests, %llu index entries\n", name, ns_to_ms(end - start),
+           FILE_SIZE / 1048576.0 / (ns_to_ms(end - start) / 1000),
+           (unsigned long long) (after.read_requests - before.read_requests),
+           (unsigned long long) after.index_entries);
+
+    lab2_close(fd);
+    lab2_set_extents(ladder, 2);
+}
+
 // SequentialRead_Uncached
 void test_sequential_read_uncached(const char *path) {
-    HANDLE hFile = CreateFileA(
-        path,
-        GENERIC_READ,
-        FILE_SHARE_READ,
-        nullptr,
-        OPEN_EXISTING,
-        FILE_FLAG_NO_BUFFERING,
-        nullptr
-    );
-    if (hFile == INVALID_HANDLE_VALUE) {
-        perror("CreateFileA");
+    auto backend = createStorageBackend();
+    NativeHandle hFile = backend->openFile(path, true);
+    if (hFile == INVALID_NATIVE_HANDLE) {
+        perror("openFile");
         return;
     }
 
-    char buf[BLOCK_SIZE];
+    alignas(BLOCK_SIZE) char buf[BLOCK_SIZE];
     long long start = get_time_ns();
 
     for (size_t block = 0; block < NUM_BLOCKS; block++) {
         off_t offset = block * BLOCK_SIZE;
-        DWORD bytesRead;
-        SetFilePointer(hFile, offset, nullptr, FILE_BEGIN);
-        ReadFile(hFile, buf, BLOCK_SIZE, &bytesRead, NULL);
+        backend->readAt(hFile, buf, BLOCK_SIZE, offset);
     }
 
     long long end = get_time_ns();
     print_test_result("SequentialRead_Uncached", end - start);
 
-    CloseHandle(hFile);
+    backend->closeFile(hFile);
 }
 
-int main() {
-    const char *path = "testfile.bin";
+// Many small files with a write and an fsync per iteration, while the random
+// read file keeps the rest of the cache full
+void test_many_files_fsync(const char *path) {
+    int big = lab2_open(path);
+    if (big < 0) {
+        perror("lab2_open");
+        return;
+    }
 
-    // Create a large file for testing
-    HANDLE hFile = CreateFileA(
-        path,
-        GENERIC_READ | GENERIC_WRITE,
-        FILE_SHARE_READ | FILE_SHARE_WRITE,
-        nullptr,
-        CREATE_ALWAYS,
-        FILE_FLAG_NO_BUFFERING,
-        nullptr
-    );
-    if (hFile == INVALID_HANDLE_VALUE) {
-        perror("CreateFileA");
+    alignas(BLOCK_SIZE) char buf[BLOCK_SIZE] = {};
+    for (size_t block = 0; block < HOT_AREA_SIZE; block++)
+        lab2_pread(big, buf, BLOCK_SIZE, block * BLOCK_SIZE);
+
+    std::vector<std::string> names;
+    std::vector<int> fds;
+    for (int i = 0; i < SMALL_FILE_COUNT; i++) {
+        names.push_back("small_" + std::to_string(i) + ".bin");
+        std::ofstream(names.back(), std::ios::binary | std::ios::trunc).close();
+        std::filesystem::resize_file(names.back(), SMALL_FILE_BLOCKS * BLOCK_SIZE);
+        fds.push_back(lab2_open(names.back().c_str()));
+    }
+
+    CacheStats before = lab2_stats();
+    long long start = get_time_ns();
+    for (int i = 0; i < ITER_COUNT; i++) {
+        int fd = fds[rand() % SMALL_FILE_COUNT];
+        lab2_pwrite(fd, buf, BLOCK_SIZE, random_block(0, SMALL_FILE_BLOCKS) * BLOCK_SIZE);
+        lab2_fsync(fd);
+    }
+    long long end = get_time_ns();
+    print_test_result("ManyFilesFsync_Cached", end - start);
+    print_latency("fsync latency", latency_delta(before.sync_latency, lab2_stats().sync_latency));
+
+    for (int i = 0; i < SMALL_FILE_COUNT; i++) {
+        lab2_close(fds[i]);
+        std::filesystem::remove(names[i]);
+    }
+    lab2_close(big);
+}
+
+// Hot-set random reads interleaved with a long sequential scan through the
+// rest of the file; the scan alone is many times the cache size. Prints
+// miss ratio and throughput of the given replacement policy.
+void test_replacement_policy(const char *path, ReplacementKind kind) {
+    lab2_set_replacement(kind);
+    int hot = lab2_open(path);
+    int scan = lab2_open(path);
+    if (hot < 0 || scan < 0) {
+        perror("lab2_open");
+        return;
+    }
+
+    alignas(BLOCK_SIZE) char buf[BLOCK_SIZE];
+    size_t scan_block = POLICY_HOT_BLOCKS;
+    CacheStats before = lab2_stats();
+    long long start = get_time_ns();
+
+    for (int i = 0; i < POLICY_ITER_COUNT; i++) {
+        if (i % 8 == 7) {
+            lab2_pread(scan, buf, BLOCK_SIZE, scan_block * BLOCK_SIZE);
+            if (++scan_block == NUM_BLOCKS) scan_block = POLICY_HOT_BLOCKS;
+            continue;
+        }
+        lab2_pread(hot, buf, BLOCK_SIZE, random_block(0, POLICY_HOT_BLOCKS) * BLOCK_SIZE);
+    }
+
+    long long end = get_time_ns();
+    CacheStats after = lab2_stats();
+    unsigned long long hits = after.hits - before.hits;
+    unsigned long long misses = after.misses - before.misses;
+    char name[64];
+    snprintf(name, sizeof(name), "HotSetWithScan_%s", replacementName(kind));
+    printf("%-24s: %.2f ms, %.0f reads/ms, miss ratio %.1f%%\n", name, ns_to_ms(end - start),
+           POLICY_ITER_COUNT / ns_to_ms(end - start), hits + misses ? 100.0 * misses / (hits + misses) : 0.0);
+
+    lab2_close(scan);
+    lab2_close(hot);
+}
+
+// TightAreaRandomRead_Cached from several threads. All threads share one fd
+// through positional reads; each has its own slice of the hot area, so the
+// hot set stays the same size.
+void test_tight_area_random_read_mt(const char *path, int threads) {
+    int fd = lab2_open(path);
+    if (fd < 0) {
+        perror("lab2_open");
+        return;
+    }
+
+    std::atomic<int> ready{0};
+    std::vector<long long> elapsed(threads);
+    std::vector<std::thread> workers;
+
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&, t] {
+            alignas(BLOCK_SIZE) char buf[BLOCK_SIZE];
+            size_t lo = HOT_AREA_SIZE * t / threads;
+            size_t hi = HOT_AREA_SIZE * (t + 1) / threads;
+            std::minstd_rand rng(t + 1);
+
+            // Warm up the slice, then start all threads together
+            for (size_t block = lo; block < hi; block++) {
+                lab2_pread(fd, buf, BLOCK_SIZE, block * BLOCK_SIZE);
+            }
+            ready++;
+            while (ready.load() < threads) std::this_thread::yield();
+
+            long long start = get_time_ns();
+            for (int i = 0; i < MT_ITER_COUNT; i++) {
+                size_t block = lo + rng() % (hi - lo);
+                lab2_pread(fd, buf, BLOCK_SIZE, block * BLOCK_SIZE);
+            }
+            elapsed[t] = get_time_ns() - start;
+        });
+    }
+
+    long long slowest = 0;
+    for (int t = 0; t < threads; t++) {
+        workers[t].join();
+        slowest = std::max(slowest, elapsed[t]);
+    }
+    lab2_close(fd);
+
+    char name[64];
+    snprintf(name, sizeof(name), "TightAreaRandomRead_Cached x%d", threads);
+    printf("%s: %.2f ms, %.0f reads/ms\n", name, ns_to_ms(slowest),
+           (double) threads * MT_ITER_COUNT / ns_to_ms(slowest));
+}
+
+// Random 4 KB hits over a cache far larger than the TLB reach of normal
+// pages, with the block arena on the given pages (or the best available
+// ones for ArenaPages::Huge). The file is sparse and 3/4 of the cache, so
+// after one pass every read is a hit.
+void test_large_cache_hits(const char *path, ArenaPages pages) {
+    std::ofstream(path, std::ios::binary | std::ios::trunc).close();
+    std::error_code ec;
+    std::filesystem::resize_file(path, (uintmax_t) LARGE_FILE_BLOCKS * BLOCK_SIZE, ec);
+    if (ec) {
+        fprintf(stderr, "resize_file: %s\n", ec.message().c_str());
+        return;
+    }
+
+    NRUCache cache(BLOCK_SIZE, LARGE_CACHE_BLOCKS, false, 8, ReplacementKind::NRU, 0, pages);
+    cache.setReadahead(4, 0);
+    int fd = cache.openFile(path);
+    if (fd < 0) {
+        perror("openFile");
+        return;
+    }
+    std::vector<char> chunk(256 * BLOCK_SIZE);
+    for (size_t block = 0; block < LARGE_FILE_BLOCKS; block += 256)
+        cache.preadFile(fd, chunk.data(), chunk.size(), (off_t) block * BLOCK_SIZE);
+
+    alignas(BLOCK_SIZE) char buf[BLOCK_SIZE];
+    std::minstd_rand rng(3);
+    CacheStats before = cache.stats();
+    long long start = get_time_ns();
+    for (int i = 0; i < LARGE_HIT_COUNT; i++) {
+        size_t block = rng() % LARGE_FILE_BLOCKS;
+        cache.preadFile(fd, buf, BLOCK_SIZE, (off_t) block * BLOCK_SIZE);
+    }
+    long long end = get_time_ns();
+    CacheStats after = cache.stats();
+    cache.closeFile(fd);
+
+    unsigned long long hits = after.hits - before.hits;
+    unsigned long long misses = after.misses - before.misses;
+    char name[64];
+    snprintf(name, sizeof(name), "LargeCacheRandomHit_%s", pages == ArenaPages::Normal ? "Normal" : "Huge");
+    printf("%-26s: %.2f ms, %.0f reads/ms, hit ratio %.1f%%, %llu MB arena on %s pages\n", name,
+           ns_to_ms(end - start), LARGE_HIT_COUNT / ns_to_ms(end - start),
+           hits + misses ? 100.0 * hits / (hits + misses) : 0.0,
+           (unsigned long long) (after.arena_bytes >> 20), arenaPagesName(after.arena_pages));
+}
+
+// One thread per NUMA node (simulated if the machine has fewer), each
+// reading random blocks of its own file. Without LAB2_LOCAL the blocks of
+// every file are spread over the shards of all nodes; with it they stay in
+// the shards of the node that opened the file.
+void test_numa_placement(int flags, const char *label) {
+    std::vector<std::string> paths;
+    std::vector<int> fds(NUMA_NODES, -1);
+    std::vector<char> data(NUMA_FILE_BLOCKS * BLOCK_SIZE);
+    for (int node = 0; node < NUMA_NODES; node++) {
+        paths.push_back("numa_" + std::to_string(node) + ".bin");
+        std::ofstream(paths.back(), std::ios::binary | std::ios::trunc).write(data.data(), data.size());
+    }
+
+    std::atomic<int> ready{0};
+    std::vector<long long> elapsed(NUMA_NODES);
+    std::vector<std::thread> workers;
+    for (int node = 0; node < NUMA_NODES; node++) {
+        workers.emplace_back([&, node] {
+            lab2_bind_thread(node);
+            fds[node] = lab2_open(paths[node].c_str(), flags);
+            alignas(BLOCK_SIZE) char buf[BLOCK_SIZE];
+            for (size_t block = 0; block < NUMA_FILE_BLOCKS; block++)
+                lab2_pread(fds[node], buf, BLOCK_SIZE, block * BLOCK_SIZE);
+            ready++;
+            while (ready.load() < NUMA_NODES) std::this_thread::yield();
+
+            std::minstd_rand rng(node + 1);
+            long long start = get_time_ns();
+            for (int i = 0; i < NUMA_ITER_COUNT; i++)
+                lab2_pread(fds[node], buf, BLOCK_SIZE, (rng() % NUMA_FILE_BLOCKS) * BLOCK_SIZE);
+            elapsed[node] = get_time_ns() - start;
+            lab2_bind_thread(-1);
+        });
+    }
+    CacheStats before = lab2_stats();
+    long long slowest = 0;
+    for (int node = 0; node < NUMA_NODES; node++) {
+        workers[node].join();
+        slowest = std::max(slowest, elapsed[node]);
+    }
+    CacheStats after = lab2_stats();
+    for (int node = 0; node < NUMA_NODES; node++) {
+        lab2_close(fds[node]);
+        std::remove(paths[node].c_str());
+    }
+
+    unsigned long long local = after.local_hits - before.local_hits;
+    unsigned long long remote = after.remote_hits - before.remote_hits;
+    char name[64];
+    snprintf(name, sizeof(name), "NumaPlacement_%s", label);
+    printf("%-20s: %.2f ms slowest, %.0f reads/ms, local hits %.1f%% (%u %s nodes)\n", name, ns_to_ms(slowest),
+           (double) NUMA_NODES * NUMA_ITER_COUNT / ns_to_ms(slowest),
+           local + remote ? 100.0 * local / (local + remote) : 0.0, after.numa_nodes,
+           after.numa_bound ? "bound" : "simulated");
+}
+
+// Log-like text that compresses about 3x: the kind of data the compressed
+// tier is meant for
+void write_log_file(const char *path, size_t blocks) {
+    const char *levels[] = {"INFO", "INFO", "INFO", "WARN", "DEBUG", "ERROR"};
+    const char *events[] = {"request served", "cache miss", "retrying upstream", "connection reset",
+                            "flush completed", "slow query"};
+    std::minstd_rand rng(11);
+    std::string text;
+    text.reserve(blocks * BLOCK_SIZE + 256);
+    char line[160];
+    for (unsigned long long n = 0; text.size() < blocks * BLOCK_SIZE; n++) {
+        snprintf(line, sizeof(line), "2026-10-18 %02u:%02u:%02u.%03u %-5s worker-%u %s id=%08x took %u ms\n",
+                 (unsigned) (n / 360000 % 24), (unsigned) (n / 6000 % 60), (unsigned) (n / 100 % 60),
+                 (unsigned) (rng() % 1000), levels[rng() % 6], (unsigned) (rng() % 16), events[rng() % 6],
+                 (unsigned) rng(), (unsigned) (rng() % 500));
+        text += line;
+    }
+    std::ofstream(path, std::ios::binary | std::ios::trunc).write(text.data(), blocks * BLOCK_SIZE);
+}
+
+// Storage backend of a slow origin (a network volume or an object store
+// gateway): every read, or batch of reads, first waits delay_us
+class SlowOriginBackend : public StorageBackend {
+public:
+    SlowOriginBackend(std::unique_ptr<StorageBackend> inner, unsigned delay_us)
+        : inner(std::move(inner)), delay(delay_us) {}
+
+    NativeHandle openFile(const char *path, bool direct_io) override { return inner->openFile(path, direct_io); }
+
+    NativeHandle createFile(const char *path, bool direct_io) override {
+        return inner->createFile(path, direct_io);
+    }
+
+    void closeFile(NativeHandle handle) override { inner->closeFile(handle); }
+
+    ssize_t readAt(NativeHandle handle, void *buf, size_t count, off_t offset) override {
+        std::this_thread::sleep_for(delay);
+        return inner->readAt(handle, buf, count, offset);
+    }
+
+    ssize_t writeAt(NativeHandle handle, const void *buf, size_t count, off_t offset) override {
+        return inner->writeAt(handle, buf, count, offset);
+    }
+
+    ssize_t readvAt(NativeHandle handle, const struct iovec *iov, int iovcnt, off_t offset) override {
+        std::this_thread::sleep_for(delay);
+        return inner->readvAt(handle, iov, iovcnt, offset);
+    }
+
+    ssize_t writevAt(NativeHandle handle, const struct iovec *iov, int iovcnt, off_t offset) override {
+        return inner->writevAt(handle, iov, iovcnt, offset);
+    }
+
+    // The requests of a batch are in flight together and wait once
+    void submitBatch(IoRequest *requests, size_t count) override {
+        for (size_t i = 0; i < count; i++) {
+            if (!requests[i].write) {
+                std::this_thread::sleep_for(delay);
+                break;
+            }
+        }
+        inner->submitBatch(requests, count);
+    }
+
+    int syncFile(NativeHandle handle) override { return inner->syncFile(handle); }
+
+    off_t fileSize(NativeHandle handle) override { return inner->fileSize(handle); }
+
+    int resizeFile(NativeHandle handle, off_t size) override { return inner->resizeFile(handle, size); }
+
+    int allocateFile(NativeHandle handle, off_t size) override { return inner->allocateFile(handle, size); }
+
+    bool fileId(NativeHandle handle, uint64_t *dev, uint64_t *ino) override {
+        return inner->fileId(handle, dev, ino);
+    }
+
+    int64_t modifiedTime(NativeHandle handle) override { return inner->modifiedTime(handle); }
+
+    void *mapFile(NativeHandle handle, size_t length) override { return inner->mapFile(handle, length); }
+
+    void unmapFile(void *addr, size_t length) override { inner->unmapFile(addr, length); }
+
+    int syncMapped(void *addr, size_t length) override { return inner->syncMapped(addr, length); }
+
+    void adviseMapped(void *addr, size_t length, MapAdvice advice) override {
+        inner->adviseMapped(addr, length, advice);
+    }
+
+private:
+    std::unique_ptr<StorageBackend> inner;
+    std::chrono::microseconds delay;
+};
+
+// Random reads over an area 1.5x the cache, which bypasses the page cache.
+// Without the compressed tier a third of the reads go to disk; with share
+// of the memory given to it, evicted blocks come back decompressed. With
+// origin_delay_us > 0 the reads go to a slow origin instead of the local
+// disk, where a miss costs far more than decompressing a block.
+void test_compressed_tier(const char *path, double share, unsigned origin_delay_us) {
+    NRUCache cache(BLOCK_SIZE, COMPRESS_CACHE_BLOCKS, true, 4);
+    if (origin_delay_us > 0)
+        cache.setBackend(std::make_unique<SlowOriginBackend>(createStorageBackend(), origin_delay_us));
+    if (!cache.setCompressedTier(share)) {
+        fprintf(stderr, "setCompressedTier(%.2f) failed\n", share);
+        return;
+    }
+    int fd = cache.openFile(path);
+    if (fd < 0) {
+        perror("openFile");
+        return;
+    }
+
+    alignas(BLOCK_SIZE) char buf[BLOCK_SIZE];
+    for (size_t block = 0; block < COMPRESS_AREA_BLOCKS; block++)
+        cache.preadFile(fd, buf, BLOCK_SIZE, (off_t) block * BLOCK_SIZE);
+
+    std::minstd_rand rng(5);
+    CacheStats before = cache.stats();
+    long long start = get_time_ns();
+    for (int i = 0; i < COMPRESS_ITER_COUNT; i++)
+        cache.preadFile(fd, buf, BLOCK_SIZE, (off_t) (rng() % COMPRESS_AREA_BLOCKS) * BLOCK_SIZE);
+    long long end = get_time_ns();
+    CacheStats after = cache.stats();
+    cache.closeFile(fd);
+
+    unsigned long long hits = after.hits - before.hits;
+    unsigned long long misses = after.misses - before.misses;
+    unsigned long long tier_hits = after.compressed.hits - before.compressed.hits;
+    unsigned long long disk = (after.bytes_read - before.bytes_read) / BLOCK_SIZE;
+    char name[64];
+    snprintf(name, sizeof(name), "%s_%.0f%%", origin_delay_us ? "CompressedOrigin" : "CompressedTier", share * 100);
+    printf("%-20s: %.2f ms, %.0f reads/ms, hit ratio %.1f%%, tier hits %.1f%%, %llu disk reads\n", name,
+           ns_to_ms(end - start), COMPRESS_ITER_COUNT / ns_to_ms(end - start),
+           hits + misses ? 100.0 * hits / (hits + misses) : 0.0,
+           misses ? 100.0 * tier_hits / misses : 0.0, disk);
+    if (share > 0) {
+        const CompressedTierStats &c = after.compressed;
+        printf("  %llu blocks in tier (%.2fx), %llu rejected, %llu dropped, compress %.0f ns/block, "
+               "decompress %.0f ns/block\n",
+               (unsigned long long) c.blocks, c.stored_bytes ? (double) c.blocks * BLOCK_SIZE / c.stored_bytes : 0.0,
+               (unsigned long long) c.rejected, (unsigned long long) c.dropped, c.stored + c.rejected ? (double) c.compress_ns / (c.stored + c.rejected) : 0.0,
+               c.hits ? (double) c.decompress_ns / c.hits : 0.0);
+    }
+}
+
+// Random reads over an area 4x the cache from a slow origin. Without the
+// victim file every miss pays the origin latency; with it, blocks evicted
+// while the area is read once come back from the local file. With
+// warm = false the cache starts from a victim file a previous run left,
+// skipping that first pass.
+void test_victim_file(const char *path, const char *victim_path, bool warm, const char *label) {
+    NRUCache cache(BLOCK_SIZE, VICTIM_CACHE_BLOCKS, true, 4);
+    cache.setBackend(std::make_unique<SlowOriginBackend>(createStorageBackend(), ORIGIN_DELAY_US));
+    if (victim_path && !cache.attachVictimFile(victim_path, VICTIM_FILE_BYTES)) {
+        fprintf(stderr, "attachVictimFile %s failed\n", victim_path);
+        return;
+    }
+    int fd = cache.openFile(path);
+    if (fd < 0) {
+        perror("openFile");
+        return;
+    }
+
+    alignas(BLOCK_SIZE) char buf[BLOCK_SIZE];
+    if (warm) {
+        for (size_t block = 0; block < VICTIM_AREA_BLOCKS; block++)
+            cache.preadFile(fd, buf, BLOCK_SIZE, (off_t) block * BLOCK_SIZE);
+    }
+
+    std::minstd_rand rng(9);
+    CacheStats before = cache.stats();
+    VictimFileStats victim_before{};
+    cache.victimStats(&victim_before);
+    long long start = get_time_ns();
+    for (int i = 0; i < VICTIM_ITER_COUNT; i++)
+        cache.preadFile(fd, buf, BLOCK_SIZE, (off_t) (rng() % VICTIM_AREA_BLOCKS) * BLOCK_SIZE);
+    long long end = get_time_ns();
+    CacheStats after = cache.stats();
+    VictimFileStats victim{};
+    cache.victimStats(&victim);
+    cache.closeFile(fd);
+
+    unsigned long long misses = after.misses - before.misses;
+    unsigned long long victim_hits = victim.hits - victim_before.hits;
+    printf("%-20s: %.2f ms, %.1f reads/ms, %llu misses, %llu from victim file, %llu origin reads\n", label,
+           ns_to_ms(end - start), VICTIM_ITER_COUNT / ns_to_ms(end - start), misses, victim_hits,
+           (unsigned long long) (after.bytes_read - before.bytes_read) / BLOCK_SIZE);
+    if (victim_path) {
+        printf("  %llu/%llu blocks in file, %llu restored at attach, %llu spilled, %llu dropped, "
+               "read %.0f us/block\n", (unsigned long long) victim.resident, (unsigned long long) victim.slots,
+               (unsigned long long) victim.restored, (unsigned long long) victim.spilled,
+               (unsigned long long) victim.dropped, victim.hits ? victim.read_ns / 1e3 / victim.hits : 0.0);
+    }
+}
+
+// Writes a PSI file with the given some avg10, as the kernel would report it
+void write_pressure_file(const char *path, double avg10) {
+    FILE *out = fopen(path, "w");
+    if (!out) return;
+    fprintf(out, "some avg10=%.2f avg60=%.2f avg300=%.2f total=0\n", avg10, avg10, avg10);
+    fprintf(out, "full avg10=0.00 avg60=0.00 avg300=0.00 total=0\n");
+    fclose(out);
+}
+
+// Waits until the slots in use reach the budget, or timeout_ms pass
+long long wait_for_capacity(NRUCache &cache, size_t budget, long long timeout_ms) {
+    long long start = get_time_ns();
+    while (ns_to_ms(get_time_ns() - start) < timeout_ms) {
+        if (cache.stats().capacity_blocks * BLOCK_SIZE <= budget) break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return get_time_ns() - start;
+}
+
+// Readers and writers keep a hot area busy while the budget drops to a
+// quarter and then comes back. The shrink call itself returns at once; the
+// eviction runs in the background, so the worst operation during it stays
+// close to a miss rather than the whole trim.
+void test_budget_resize(const char *path) {
+    NRUCache cache(BLOCK_SIZE, BUDGET_CACHE_BLOCKS, true, 4, ReplacementKind::NRU, 0, ArenaPages::Transparent);
+    int fd = cache.openFile(path);
+    if (fd < 0) {
+        perror("openFile");
+        return;
+    }
+    std::vector<char> chunk(64 * BLOCK_SIZE);
+    for (size_t block = 0; block < BUDGET_AREA_BLOCKS; block += 64)
+        cache.preadFile(fd, chunk.data(), chunk.size(), (off_t) block * BLOCK_SIZE);
+
+    std::atomic<int> phase{0};
+    std::atomic<long long> ops[3] = {};
+    std::atomic<long long> worst[3] = {};
+    std::vector<std::thread> workers;
+    for (int t = 0; t < BUDGET_THREADS; t++) {
+        workers.emplace_back([&, t] {
+            alignas(BLOCK_SIZE) char buf[BLOCK_SIZE];
+            std::minstd_rand rng(t + 11);
+            for (int p; (p = phase.load()) < 3;) {
+                off_t offset = (off_t) (rng() % BUDGET_AREA_BLOCKS) * BLOCK_SIZE;
+                long long start = get_time_ns();
+                if (rng() % 10 == 0)
+                    cache.pwriteFile(fd, buf, BLOCK_SIZE, offset);
+                else
+                    cache.preadFile(fd, buf, BLOCK_SIZE, offset);
+                long long took = get_time_ns() - start;
+                ops[p]++;
+                long long seen = worst[p].load();
+                while (took > seen && !worst[p].compare_exchange_weak(seen, took)) {}
+            }
+        });
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(BUDGET_PHASE_MS));
+    size_t full = cache.budget();
+    size_t quarter = full / 4;
+    phase = 1;
+    long long start = get_time_ns();
+    cache.setBudget(quarter);
+    long long call = get_time_ns() - start;
+    long long trim = call + wait_for_capacity(cache, quarter, 10000);
+    std::this_thread::sleep_for(std::chrono::milliseconds(BUDGET_PHASE_MS));
+    long long shrunk = get_time_ns() - start;
+    phase = 2;
+    start = get_time_ns();
+    cache.setBudget(full);
+    long long grow = get_time_ns() - start;
+    std::this_thread::sleep_for(std::chrono::milliseconds(BUDGET_PHASE_MS));
+    long long grown = get_time_ns() - start;
+    phase = 3;
+    for (auto &worker: workers) worker.join();
+    CacheStats after = cache.stats();
+    cache.closeFile(fd);
+
+    printf("Budget_Steady       : %.0f ops/ms, worst op %.2f ms at %llu MB\n",
+           ops[0] / (double) BUDGET_PHASE_MS, ns_to_ms(worst[0]), (unsigned long long) (full >> 20));
+    printf("Budget_Shrink       : setBudget %.3f ms, trimmed in %.2f ms, %.0f ops/ms, worst op %.2f ms at %llu MB\n",
+           ns_to_ms(call), ns_to_ms(trim), ops[1] / ns_to_ms(shrunk), ns_to_ms(worst[1]),
+           (unsigned long long) (quarter >> 20));
+    printf("Budget_Grow         : setBudget %.3f ms, %.0f ops/ms, worst op %.2f ms, %llu slots in use\n",
+           ns_to_ms(grow), ops[2] / ns_to_ms(grown), ns_to_ms(worst[2]),
+           (unsigned long long) after.capacity_blocks);
+}
+
+// The cache polls a PSI file; a fake one stands in for
+// /proc/pressure/memory, so pressure can be turned on and off at will
+void test_budget_pressure(const char *path, const char *psi_path) {
+    write_pressure_file(psi_path, 0);
+    NRUCache cache(BLOCK_SIZE, BUDGET_CACHE_BLOCKS, true, 4, ReplacementKind::NRU, 0, ArenaPages::Transparent);
+    if (!cache.setPressureWatch(psi_path, 10.0, PRESSURE_POLL_MS)) {
+        fprintf(stderr, "setPressureWatch(%s) failed\n", psi_path);
+        return;
+    }
+    int fd = cache.openFile(path);
+    if (fd < 0) {
+        perror("openFile");
+        return;
+    }
+    std::vector<char> chunk(64 * BLOCK_SIZE);
+    for (size_t block = 0; block < BUDGET_AREA_BLOCKS; block += 64)
+        cache.preadFile(fd, chunk.data(), chunk.size(), (off_t) block * BLOCK_SIZE);
+
+    size_t full = cache.budget();
+    write_pressure_file(psi_path, 40.0);
+    long long start = get_time_ns();
+    while (cache.budget() > full / 4 && ns_to_ms(get_time_ns() - start) < 5000)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    long long shrink = get_time_ns() - start;
+    long long trim = shrink + wait_for_capacity(cache, cache.budget(), 5000);
+    CacheStats pressed = cache.stats();
+
+    write_pressure_file(psi_path, 0);
+    start = get_time_ns();
+    while (cache.budget() < full && ns_to_ms(get_time_ns() - start) < 5000)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    long long relax = get_time_ns() - start;
+    cache.setPressureWatch(nullptr, 0, 0);
+    cache.closeFile(fd);
+
+    printf("Budget_Pressure     : %llu -> %llu MB in %.0f ms (%llu shrinks), slots freed in %.0f ms, "
+           "back to %llu MB in %.0f ms\n", (unsigned long long) (full >> 20),
+           (unsigned long long) (pressed.budget_bytes >> 20), ns_to_ms(shrink),
+           (unsigned long long) pressed.pressure_shrinks, ns_to_ms(trim),
+           (unsigned long long) (cache.budget() >> 20), ns_to_ms(relax));
+}
+
+#ifndef _WIN32
+// Worker process of the shared cache test: random reads over an area every
+// worker shares, through the shared tier unless tier is "-". Reports elapsed
+// ns, backend reads and shared tier hits on stdout.
+int run_shared_worker(const char *tier, const char *path, unsigned seed) {
+    if (strcmp(tier, "-") != 0 && lab2_attach_shared(tier, SHARED_TIER_BYTES) != 0) {
+        fprintf(stderr, "lab2_attach_shared %s failed\n", tier);
         return 1;
     }
+    int fd = lab2_open(path);
+    if (fd < 0) {
+        perror("lab2_open");
+        return 1;
+    }
+
+    alignas(BLOCK_SIZE) static char buf[BLOCK_SIZE];
+    std::minstd_rand rng(seed);
+    CacheStats before = lab2_stats();
+    long long start = get_time_ns();
+    for (int i = 0; i < SHARED_ITER_COUNT; i++) {
+        size_t block = rng() % SHARED_AREA_BLOCKS;
+        lab2_pread(fd, buf, BLOCK_SIZE, block * BLOCK_SIZE);
+    }
+    long long end = get_time_ns();
+    CacheStats after = lab2_stats();
+    lab2_close(fd);
+
+    printf("%lld %llu %llu\n", end - start, (unsigned long long) (after.read_requests - before.read_requests),
+           (unsigned long long) (after.shared_hits - before.shared_hits));
+    return 0;
+}
+
+// Runs SHARED_PROCESSES copies of this program as shared cache workers at
+// once and sums what they report
+void test_shared_cache(const char *self, const char *path, const char *tier, const char *label) {
+    int out[2];
+    if (pipe(out) != 0) {
+        perror("pipe");
+        return;
+    }
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, out[1], STDOUT_FILENO);
+    posix_spawn_file_actions_addclose(&actions, out[0]);
+    posix_spawn_file_actions_addclose(&actions, out[1]);
+
+    std::vector<pid_t> workers;
+    for (int p = 0; p < SHARED_PROCESSES; p++) {
+        std::string seed = std::to_string(p + 1);
+        char *args[] = {const_cast<char *>(self), const_cast<char *>("--shared-worker"),
+                        const_cast<char *>(tier), const_cast<char *>(path), seed.data(), nullptr};
+        pid_t pid;
+        if (posix_spawnp(&pid, self, &actions, nullptr, args, environ) == 0) workers.push_back(pid);
+    }
+    posix_spawn_file_actions_destroy(&actions);
+    close(out[1]);
+
+    FILE *results = fdopen(out[0], "r");
+    long long elapsed, slowest = 0;
+    unsigned long long reads, hits, total_reads = 0, total_hits = 0;
+    int reported = 0;
+    while (fscanf(results, "%lld %llu %llu", &elapsed, &reads, &hits) == 3) {
+        slowest = std::max(slowest, elapsed);
+        total_reads += reads;
+        total_hits += hits;
+        reported++;
+    }
+    fclose(results);
+    for (pid_t pid: workers) waitpid(pid, nullptr, 0);
+    if (reported != SHARED_PROCESSES) {
+        fprintf(stderr, "%d of %d shared cache workers reported\n", reported, SHARED_PROCESSES);
+        return;
+    }
+
+    char name[64];
+    snprintf(name, sizeof(name), "SharedCache_x%d_%s", SHARED_PROCESSES, label);
+    printf("%-25s: %.2f ms slowest, %llu disk reads, %llu shared tier hits\n", name, ns_to_ms(slowest),
+           total_reads, total_hits);
+}
 
-    LARGE_INTEGER fileSize;
-    fileSize.QuadPart = FILE_SIZE;
-    if (!SetFilePointerEx(hFile, fileSize, nullptr, FILE_BEGIN)) {
-        perror("SetFilePointerEx");
+// Worker process of the warm restart test. "record" reads the hot area and
+// saves its working set to the manifest; "cold" and "warm" start from an
+// empty cache (warm with the manifest) and report elapsed ns until the
+// first window of WARM_WINDOW reads reaching WARM_STEADY_RATIO hits, reads
+// until then, total ns and misses.
+int run_warm_worker(const char *manifest, const char *path, const char *phase) {
+    bool record = strcmp(phase, "record") == 0;
+    if (strcmp(phase, "cold") != 0 && lab2_set_manifest(manifest, 0) != 0) {
+        fprintf(stderr, "lab2_set_manifest %s failed\n", manifest);
         return 1;
     }
-    if (!SetEndOfFile(hFile)) {
-        perror("SetEndOfFile");
+    alignas(BLOCK_SIZE) static char buf[BLOCK_SIZE];
+    std::minstd_rand rng(7);
+    long long start = get_time_ns();
+    int fd = lab2_open(path);
+    if (fd < 0) {
+        perror("lab2_open");
+        return 1;
+    }
+
+    CacheStats first = lab2_stats();
+    CacheStats window = first;
+    long long steady_ns = -1;
+    int steady_reads = -1;
+    for (int i = 1; i <= WARM_ITER_COUNT; i++) {
+        size_t block = rng() % WARM_AREA_BLOCKS;
+        lab2_pread(fd, buf, BLOCK_SIZE, block * BLOCK_SIZE);
+        if (i % WARM_WINDOW != 0 || steady_reads >= 0) continue;
+        CacheStats now = lab2_stats();
+        unsigned long long hits = now.hits - window.hits;
+        unsigned long long misses = now.misses - window.misses;
+        if (hits >= WARM_STEADY_RATIO * (hits + misses)) {
+            steady_ns = get_time_ns() - start;
+            steady_reads = i;
+        }
+        window = now;
+    }
+    long long end = get_time_ns();
+    CacheStats last = lab2_stats();
+    lab2_close(fd);
+    if (record && lab2_save_manifest() != 0) {
+        fprintf(stderr, "lab2_save_manifest %s failed\n", manifest);
+        return 1;
+    }
+
+    printf("%lld %d %lld %llu %llu\n", steady_ns, steady_reads, end - start,
+           (unsigned long long) (last.misses - first.misses),
+           (unsigned long long) (last.warm_blocks - first.warm_blocks));
+    return 0;
+}
+
+// Runs one warm restart worker in a fresh process, so that its cache starts
+// empty the way it would after a restart, and prints what it reports
+void test_warm_restart(const char *self, const char *path, const char *manifest, const char *phase,
+                       const char *label) {
+    int out[2];
+    if (pipe(out) != 0) {
+        perror("pipe");
+        return;
+    }
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, out[1], STDOUT_FILENO);
+    posix_spawn_file_actions_addclose(&actions, out[0]);
+    posix_spawn_file_actions_addclose(&actions, out[1]);
+    char *args[] = {const_cast<char *>(self), const_cast<char *>("--warm-worker"), const_cast<char *>(manifest),
+                    const_cast<char *>(path), const_cast<char *>(phase), nullptr};
+    pid_t pid;
+    bool spawned = posix_spawnp(&pid, self, &actions, nullptr, args, environ) == 0;
+    posix_spawn_file_actions_destroy(&actions);
+    close(out[1]);
+
+    FILE *results = fdopen(out[0], "r");
+    long long steady_ns, total_ns;
+    int steady_reads;
+    unsigned long long misses, warm;
+    int fields = fscanf(results, "%lld %d %lld %llu %llu", &steady_ns, &steady_reads, &total_ns, &misses, &warm);
+    fclose(results);
+    if (spawned) waitpid(pid, nullptr, 0);
+    if (fields != 5) {
+        fprintf(stderr, "warm restart worker %s did not report\n", phase);
+        return;
+    }
+
+    char name[64];
+    snprintf(name, sizeof(name), "WarmRestart_%s", label);
+    if (steady_reads < 0) {
+        printf("%-22s: no steady state in %d reads, %.2f ms total, %llu misses, %llu blocks warmed\n", name,
+               WARM_ITER_COUNT, ns_to_ms(total_ns), misses, warm);
+        return;
+    }
+    printf("%-22s: %.0f%% hits after %.2f ms (%d reads), %.2f ms total, %llu misses, %llu blocks warmed\n",
+           name, 100 * WARM_STEADY_RATIO, ns_to_ms(steady_ns), steady_reads, ns_to_ms(total_ns), misses, warm);
+}
+#endif
+
+// Usage: nru_cache_benchmark [policy]
+// With a policy name (nru, lru, lru2, 2q, arc, clockpro) every test runs with
+// that replacement policy; without one, or with "all", the tests use NRU and
+// the policy section compares all policies. The shared cache and warm
+// restart tests start copies of this program with --shared-worker and
+// --warm-worker.
+int main(int argc, char **argv) {
+    const char *path = "testfile.bin";
+#ifndef _WIN32
+    if (argc == 5 && strcmp(argv[1], "--shared-worker") == 0)
+        return run_shared_worker(argv[2], argv[3], static_cast<unsigned>(atoi(argv[4])));
+    if (argc == 5 && strcmp(argv[1], "--warm-worker") == 0)
+        return run_warm_worker(argv[2], argv[3], argv[4]);
+#endif
+
+    std::vector<ReplacementKind> policies = {ReplacementKind::NRU, ReplacementKind::LRU, ReplacementKind::LRU2,
+                                             ReplacementKind::TwoQ, ReplacementKind::ARC, ReplacementKind::ClockPro};
+    ReplacementKind selected = ReplacementKind::NRU;
+    if (argc > 1 && strcmp(argv[1], "all") != 0) {
+        if (!parseReplacement(argv[1], selected)) {
+            fprintf(stderr, "unknown policy %s, expected nru, lru, lru2, 2q, arc, clockpro or all\n", argv[1]);
+            return 1;
+        }
+        policies = {selected};
+    }
+    lab2_set_replacement(selected);
+
+    // Create a large file for testing
+    std::ofstream(path, std::ios::binary | std::ios::trunc).close();
+    std::error_code ec;
+    std::filesystem::resize_file(path, FILE_SIZE, ec);
+    if (ec) {
+        fprintf(stderr, "resize_file: %s\n", ec.message().c_str());
         return 1;
     }
-    CloseHandle(hFile);
 
     // Run tests
     print_separator();
     print_test_header("Random Read Tests");
     test_random_read_cached(path);
+    test_random_read_cached(path, LAB2_MMAP);
+    test_random_read_async(path);
     test_random_read_uncached(path);
 
     print_separator();
     print_test_header("Mixed Workload Tests");
     test_mixed_workload_cached(path);
+    test_mixed_workload_cached(path, LAB2_MMAP);
     test_mixed_workload_uncached(path);
 
     print_separator();
     print_test_header("Tight Area Random Read Tests");
     test_tight_area_random_read_cached(path);
+    test_tight_area_random_read_cached(path, LAB2_MMAP);
     test_tight_area_random_read_uncached(path);
+    test_tight_area_scan(path);
 
     print_separator();
     print_test_header("Sequential Read Tests");
     test_sequential_read_cached(path);
+    test_sequential_read_cached(path, LAB2_MMAP);
     test_sequential_read_uncached(path);
 
+    print_separator();
+    print_test_header("Read Size Sweep Tests");
+    for (size_t read_size = BLOCK_SIZE; read_size <= SWEEP_MAX_READ; read_size *= 4) {
+        test_read_size_sweep(path, read_size, false);
+        test_read_size_sweep(path, read_size, true);
+    }
+
+    print_separator();
+    print_test_header("Scan Resistance Tests");
+    test_hot_set_during_scan(path, 1, 0);
+    test_hot_set_during_scan(path, SCAN_READ_BLOCKS, 0);
+    test_hot_set_during_scan(path, SCAN_READ_BLOCKS, SCAN_READ_BLOCKS * BLOCK_SIZE / 2);
+
+    print_separator();
+    print_test_header("Many Files Fsync Tests");
+    test_many_files_fsync(path);
+
+    print_separator();
+    print_test_header("Replacement Policy Tests");
+    for (ReplacementKind kind: policies)
+        test_replacement_policy(path, kind);
+    lab2_set_replacement(selected);
+
+    print_separator();
+    print_test_header("Multi-threaded Tight Area Random Read Tests");
+    for (int threads = 1; threads <= 8; threads *= 2)
+        test_tight_area_random_read_mt(path, threads);
+
+    print_separator();
+    print_test_header("Large Cache Random Hit Tests");
+    const char *large_path = "largefile.bin";
+    test_large_cache_hits(large_path, ArenaPages::Normal);
+    test_large_cache_hits(large_path, ArenaPages::Huge);
+    std::remove(large_path);
+
+    print_separator();
+    print_test_header("Compressed Tier Tests");
+    const char *log_path = "logfile.bin";
+    write_log_file(log_path, COMPRESS_AREA_BLOCKS);
+    test_compressed_tier(log_path, 0, 0);
+    test_compressed_tier(log_path, 0.25, 0);
+    test_compressed_tier(log_path, 0.5, 0);
+    test_compressed_tier(log_path, 0, COMPRESS_ORIGIN_DELAY_US);
+    test_compressed_tier(log_path, 0.25, COMPRESS_ORIGIN_DELAY_US);
+    test_compressed_tier(log_path, 0.5, COMPRESS_ORIGIN_DELAY_US);
+    std::remove(log_path);
+
+    // The origin is made slow on purpose; the victim file is on the local
+    // disk, which stands in for a scratch NVMe device
+    print_separator();
+    print_test_header("Local Victim File Tests");
+    const char *victim_path = "victim_cache.bin";
+    std::remove(victim_path);
+    test_victim_file(path, nullptr, true, "SlowOrigin");
+    test_victim_file(path, victim_path, true, "VictimFile");
+    test_victim_file(path, victim_path, false, "VictimFileRestart");
+    std::remove(victim_path);
+
+    print_separator();
+    print_test_header("Memory Budget Tests");
+    const char *psi_path = "memory_pressure.txt";
+    test_budget_resize(path);
+    test_budget_pressure(path, psi_path);
+    std::remove(psi_path);
+
+    print_separator();
+    print_test_header("NUMA Placement Tests");
+    if (lab2_set_numa(std::max<size_t>(NUMA_NODES, numaNodeCount())) == 0) {
+        test_numa_placement(0, "Spread");
+        test_numa_placement(LAB2_LOCAL, "Local");
+        lab2_set_numa(1);
+    } else {
+        fprintf(stderr, "lab2_set_numa failed\n");
+    }
+
+#ifndef _WIN32
+    // Private caches each pay every miss; with the tier the first process
+    // to read a block shares it, and a second wave finds the tier warm
+    print_separator();
+    print_test_header("Multi-process Shared Cache Tests");
+    std::string tier = "/lab2_bench_" + std::to_string(getpid());
+    lab2_unlink_shared(tier.c_str());
+    test_shared_cache(argv[0], path, "-", "Private");
+    test_shared_cache(argv[0], path, tier.c_str(), "Shared");
+    test_shared_cache(argv[0], path, tier.c_str(), "SharedWarm");
+    lab2_unlink_shared(tier.c_str());
+
+    // A restarted process either reloads its hot set one miss at a time or
+    // gets it back from the manifest the previous run saved
+    print_separator();
+    print_test_header("Warm Restart Tests");
+    std::string manifest = "warm_manifest_" + std::to_string(getpid()) + ".bin";
+    std::remove(manifest.c_str());
+    test_warm_restart(argv[0], path, manifest.c_str(), "record", "Record");
+    test_warm_restart(argv[0], path, manifest.c_str(), "cold", "Cold");
+    test_warm_restart(argv[0], path, manifest.c_str(), "warm", "Manifest");
+    std::remove(manifest.c_str());
+#endif
+
     print_separator();
     return 0;
 }
@@ -0,0 +1,72 @@
+#ifndef BIT_OPS_H
+#define BIT_OPS_H
+
+#include <cstdint>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Поиск крайних единичных битов: встроенные функции GCC/Clang, интринсики
+// MSVC или простой цикл. Аргумент не должен быть нулем.
+
+// Номер младшего единичного бита
+inline unsigned countTrailingZeros(uint32_t mask) {
+#if defined(__GNUC__) || defined(__clang__)
+    return static_cast<unsigned>(__builtin_ctz(mask));
+#elif defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return static_cast<unsigned>(index);
+#else
+    unsigned n = 0;
+    while (!(mask & 1u)) {
+        mask >>= 1;
+        ++n;
+    }
+    return n;
+#endif
+}
+
+inline unsigned countTrailingZeros64(uint64_t mask) {
+#if defined(__GNUC__) || defined(__clang__)
+    return static_cast<unsigned>(__builtin_ctzll(mask));
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_ARM64))
+    unsigned long index;
+    _BitScanForward64(&index, mask);
+    return static_cast<unsigned>(index);
+#else
+    uint32_t low = static_cast<uint32_t>(mask);
+    return low ? countTrailingZeros(low) : 32 + countTrailingZeros(static_cast<uint32_t>(mask >> 32));
+#endif
+}
+
+// Номер старшего единичного бита, то есть floor(log2(mask))
+inline unsigned highestBit(uint32_t mask) {
+#if defined(__GNUC__) || defined(__clang__)
+    return 31 - static_cast<unsigned>(__builtin_clz(mask));
+#elif defined(_MSC_VER)
+    unsigned long index;
+    _BitScanReverse(&index, mask);
+    return static_cast<unsigned>(index);
+#else
+    unsigned n = 0;
+    while (mask >>= 1) ++n;
+    return n;
+#endif
+}
+
+inline unsigned highestBit64(uint64_t mask) {
+#if defined(__GNUC__) || defined(__clang__)
+    return 63 - static_cast<unsigned>(__builtin_clzll(mask));
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_ARM64))
+    unsigned long index;
+    _BitScanReverse64(&index, mask);
+    return static_cast<unsigned>(index);
+#else
+    uint32_t high = static_cast<uint32_t>(mask >> 32);
+    return high ? 32 + highestBit(high) : highestBit(static_cast<uint32_t>(mask));
+#endif
+}
+
+#endif //BIT_OPS_H
@@ -0,0 +1,55 @@
+#ifndef BLOCK_ARENA_H
+#define BLOCK_ARENA_H
+
+#include <cstddef>
+
+// Какими страницами отображен регион арены, от лучшего к худшему
+enum class ArenaPages {
+    Normal,      // Обычные страницы
+    Transparent, // Прозрачные большие страницы ядра (THP), по возможности
+    Huge         // Явные большие страницы (MAP_HUGETLB, MEM_LARGE_PAGES)
+};
+
+const char* arenaPagesName(ArenaPages pages);
+
+// Единый непрерывный регион под данные всех блоков кэша. Выделяется один
+// раз с выравниванием по странице, поэтому каждый блок пригоден для
+// небуферизованного ввода-вывода, если block_size кратен размеру сектора.
+// Регион не меньше большой страницы берется большими страницами: сначала
+// явными, если их хватает в пуле, затем прозрачными, затем обычными, но
+// не лучше preferred. Так случайные попадания по большому кэшу не упираются
+// в промахи TLB.
+class BlockArena {
+public:
+    BlockArena(size_t block_size, size_t blocks, ArenaPages preferred = ArenaPages::Huge);
+
+    ~BlockArena();
+
+    BlockArena(const BlockArena&) = delete;
+
+    BlockArena& operator=(const BlockArena&) = delete;
+
+    char* block(size_t index) const { return base + index * block_size; }
+
+    size_t blockCount() const { return blocks; }
+
+    // Страницы, которые удалось получить
+    ArenaPages pages() const { return page_mode; }
+
+    // Размер отображения с округлением до страницы
+    size_t mappedBytes() const { return bytes; }
+
+    // Отдает системе память блоков [index, index + count); содержимое не
+    // сохраняется, память снова выделяется при обращении. Блоки не на
+    // границе страниц и явные большие страницы не отдаются.
+    void discard(size_t index, size_t count);
+
+private:
+    char* base;        // Начало региона
+    size_t block_size; // Размер одного блока
+    size_t blocks;     // Количество блоков
+    size_t bytes;      // Размер отображения
+    ArenaPages page_mode;
+};
+
+#endif //BLOCK_ARENA_H
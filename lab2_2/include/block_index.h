@@ -0,0 +1,106 @@
+#ifndef BLOCK_INDEX_H
+#define BLOCK_INDEX_H
+
+#include "bit_ops.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <sys/types.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Плоская хеш-таблица с открытой адресацией (в духе SwissTable):
+// (fd, block_number) -> номер слота в массиве блоков. Управляющие байты
+// хранятся группами по 16 и сравниваются одной SSE2-инструкцией, поэтому
+// попадание обычно стоит одной строки кэша управляющих байтов и одной
+// строки записей.
+class BlockIndex {
+public:
+    static constexpr uint32_t npos = UINT32_MAX;
+
+    // max_entries - наибольшее число одновременно хранимых ключей
+    explicit BlockIndex(size_t max_entries);
+
+    uint32_t find(int fd, off_t block_number) const {
+        uint64_t h = hash(fd, block_number);
+        uint8_t h2 = static_cast<uint8_t>(h & 0x7F);
+        size_t group = (h >> 7) & group_mask;
+
+        for (size_t probe = 0; probe <= group_mask; ++probe) {
+            const uint8_t *ctrl = ctrl_bytes.get() + group * group_width;
+            unsigned match = matchByte(ctrl, h2);
+            while (match) {
+                size_t i = group * group_width + countTrailingZeros(match);
+                const Entry &e = entries[i];
+                if (e.block_number == block_number && e.fd == fd) return e.slot;
+                match &= match - 1;
+            }
+            if (matchByte(ctrl, ctrl_empty)) return npos;
+            group = (group + probe + 1) & group_mask; // Треугольные пробы по группам
+        }
+        return npos;
+    }
+
+    // Ключ не должен уже присутствовать в таблице
+    void insert(int fd, off_t block_number, uint32_t slot);
+
+    void erase(int fd, off_t block_number);
+
+    void clear();
+
+    size_t size() const { return used; }
+
+    // Перемешивание ключа (финализатор MurmurHash3): последовательные
+    // номера блоков разных файлов не должны попадать в соседние группы
+    static uint64_t hash(int fd, off_t block_number) {
+        uint64_t h = static_cast<uint64_t>(block_number) * 0x9E3779B97F4A7C15ull
+                     ^ static_cast<uint64_t>(static_cast<uint32_t>(fd)) * 0xC2B2AE3D27D4EB4Full;
+        h ^= h >> 33;
+        h *= 0xFF51AFD7ED558CCDull;
+        h ^= h >> 33;
+        h *= 0xC4CEB9FE1A85EC53ull;
+        h ^= h >> 33;
+        return h;
+    }
+
+private:
+    static constexpr size_t group_width = 16;
+    static constexpr uint8_t ctrl_empty = 0x80;
+    static constexpr uint8_t ctrl_deleted = 0xFE;
+
+    struct Entry {
+        int64_t block_number; // Номер блока
+        int32_t fd;           // Идентификатор файла
+        uint32_t slot;        // Слот в массиве блоков
+    };
+
+    size_t capacity;     // Число ячеек, кратно group_width
+    size_t group_mask;   // Число групп - 1
+    size_t used;         // Живые ключи
+    size_t growth_left;  // Вставок до перестройки (учитывает надгробия)
+    std::unique_ptr<uint8_t[]> ctrl_bytes;
+    std::unique_ptr<Entry[]> entries;
+    // Запасная копия для перестройки без выделения памяти
+    std::unique_ptr<uint8_t[]> spare_ctrl;
+    std::unique_ptr<Entry[]> spare_entries;
+
+    static unsigned matchByte(const uint8_t *ctrl, uint8_t value) {
+#ifdef __SSE2__
+        __m128i group = _mm_loadu_si128(reinterpret_cast<const __m128i *>(ctrl));
+        return static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(static_cast<char>(value)))));
+#else
+        unsigned mask = 0;
+        for (size_t i = 0; i < group_width; ++i)
+            if (ctrl[i] == value) mask |= 1u << i;
+        return mask;
+#endif
+    }
+
+    size_t findFreeCell(uint64_t h) const;
+
+    void rehash();
+};
+
+#endif //BLOCK_INDEX_H
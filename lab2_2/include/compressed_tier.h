@@ -0,0 +1,133 @@
+#ifndef COMPRESSED_TIER_H
+#define COMPRESSED_TIER_H
+
+#include "block_index.h"
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <sys/types.h>
+
+// Счетчики сжатого яруса, суммируются по шардам
+struct CompressedTierStats {
+    uint64_t budget_bytes;  // Память под сжатые данные
+    uint64_t blocks;        // Блоков в ярусе сейчас
+    uint64_t stored_bytes;  // Их сжатый размер
+    uint64_t hits;          // Блоков отдано вместо чтения с диска
+    uint64_t misses;        // Промахов основного кэша, не найденных и здесь
+    uint64_t stored;        // Блоков сжато и помещено
+    uint64_t rejected;      // Не сжались достаточно и пропущены
+    uint64_t dropped;       // Не сжаты: очередь сжатия была полна
+    uint64_t evicted;       // Вытеснено ради новых
+    uint64_t compress_ns;   // Время сжатия, нс
+    uint64_t decompress_ns; // Время распаковки отданных блоков, нс
+};
+
+// Второй ярус шарда в памяти: чистые блоки, вытесненные из основного кэша,
+// хранятся сжатыми (lz_codec) в пуле кусков по chunk_size байт. Ярус
+// исключающий: блок отдается при промахе основного кэша и при этом
+// покидает ярус, так что блок лежит либо в основном кэше, либо здесь.
+// Вытесняются самые давно помещенные. Блоки, сжавшиеся хуже, чем до 3/4,
+// не хранятся: память яруса дала бы за них меньше, чем основной кэш.
+// Сжимает свой фоновый поток: put под блокировкой шарда только копирует
+// блок в очередь, при полной очереди блок пропускается. Блок из очереди
+// отдается и убирается так же, как сжатый. Своя блокировка.
+class CompressedTier {
+public:
+    static constexpr size_t chunk_size = 128;
+
+    static constexpr size_t queue_limit = 32; // Копий в очереди сжатия
+
+    explicit CompressedTier(size_t block_size);
+
+    ~CompressedTier();
+
+    CompressedTier(const CompressedTier&) = delete;
+
+    CompressedTier& operator=(const CompressedTier&) = delete;
+
+    // Память под сжатые данные, 0 - ярус выключен. Содержимое сбрасывается.
+    // Описателей хватает на блоки, сжатые в 4 раза; служебные данные
+    // (индекс, описатели) - сверх бюджета, около 1/8 его.
+    void setBudget(size_t bytes);
+
+    size_t budget() const { return budget_bytes.load(std::memory_order_relaxed); }
+
+    // Ставит копию блока в очередь сжатия, заменяя лежащую; не сжавшийся
+    // блок только убирает ее
+    void put(int fd, off_t block_number, const char* data);
+
+    // Распаковывает count подряд идущих блоков с first в out[i]: true, если
+    // все они есть. Иначе не отдается ни один, и найденные тоже убираются.
+    bool take(int fd, off_t first, size_t count, char* const* out);
+
+    void erase(int fd, off_t block_number);
+
+    // Убирает все блоки файла, обходя только их список
+    void dropFile(int fd);
+
+    void addStats(CompressedTierStats& out);
+
+private:
+    // Описатель сжатого блока; в очереди помещения - от новых к старым
+    struct Entry {
+        int fd;
+        off_t block_number;
+        uint32_t first_chunk; // Куски данных связаны через chunk_next
+        uint32_t length;      // Сжатый размер
+        uint32_t prev;
+        uint32_t next;
+        uint32_t file_prev;   // Соседи в списке блоков того же fd
+        uint32_t file_next;
+    };
+
+    // Копия блока в очереди сжатия
+    struct Pending {
+        int fd;
+        off_t block_number;
+        uint32_t buffer;     // Блок staging с данными
+        bool cancelled;
+    };
+
+    void removeEntry(uint32_t e);
+
+    void evictOldest();
+
+    void insert(int fd, off_t block_number, const char* packed, size_t length);
+
+    Pending* findPending(int fd, off_t block_number);
+
+    void cancelPending(Pending* item);
+
+    void compressLoop();
+
+    size_t block_size;
+    std::atomic<size_t> budget_bytes{0};
+    std::mutex mutex;
+    std::vector<char> pool;              // Куски данных
+    std::vector<uint32_t> chunk_next;    // Следующий кусок блока или свободного списка
+    uint32_t free_chunk{BlockIndex::npos};
+    size_t free_chunks{0};
+    std::vector<Entry> entries;
+    std::vector<uint32_t> free_entries;
+    uint32_t newest{BlockIndex::npos};   // Концы очереди помещения
+    uint32_t oldest{BlockIndex::npos};
+    std::unique_ptr<BlockIndex> index;   // (fd, номер блока) -> описатель
+    std::unordered_map<int, uint32_t> file_head; // fd -> первый описатель его списка
+    std::vector<char> staging;           // Копии в очереди, queue_limit блоков
+    std::vector<uint32_t> free_buffers;
+    std::vector<Pending> queue;          // По порядку постановки, не длиннее queue_limit
+    Pending current{};                   // Копия, которая сейчас сжимается
+    bool compressing{false};
+    std::condition_variable work_cv;     // Появилась работа
+    bool stopping{false};
+    std::thread compressor;              // Запускается при первом ненулевом бюджете
+    CompressedTierStats counters{};
+};
+
+#endif //COMPRESSED_TIER_H
@@ -3,7 +3,34 @@
 
 #include "nru_cache.h"
 
-int lab2_open(const char *path);
+// Флаг lab2_open: файл читается и пишется через mmap, минуя блоки кэша
+constexpr int LAB2_MMAP = NRUCache::open_mmap;
+
+// Флаг lab2_open в режиме NUMA: блоки файла в шардах узла открывающего потока
+constexpr int LAB2_LOCAL = NRUCache::open_local;
+
+// Размер кэша: бюджет памяти budget байт блоками по block_size (кратно
+// 512). Арена резервируется под max_budget байт (0 - равен budget), до
+// которых lab2_set_budget растит кэш на ходу. Кэш создается первым
+// вызовом lab2_* и больше не пересоздается, так что размер блока и потолок
+// задаются, только если lab2_configure вызван раньше всех остальных; без
+// него - 8 МБ блоками по 4 КБ. Позже меняется лишь бюджет. -1, если
+// размеры недопустимы или не совпадают с уже созданным кэшем
+int lab2_configure(size_t budget, size_t block_size, size_t max_budget = 0);
+
+// Меняет бюджет памяти на ходу в пределах потолка: лишние блоки
+// вытесняются в фоне порциями. 0 или -1, если бюджет вне пределов
+int lab2_set_budget(size_t bytes);
+
+size_t lab2_budget();
+
+// Опрос давления на память по файлу PSI path (например,
+// "/proc/pressure/memory" или memory.pressure группы cgroup) раз в
+// interval_ms: при some avg10 от limit процентов бюджет ужимается до
+// четверти, без давления возвращается. NULL выключает; -1 - файл не прочесть
+int lab2_set_pressure_watch(const char *path, double limit, unsigned interval_ms);
+
+int lab2_open(const char *path, int flags = 0);
 
 int lab2_close(int fd);
 
@@ -11,8 +38,94 @@ ssize_t lab2_read(int fd, void *buf, size_t count);
 
 ssize_t lab2_write(int fd, const void *buf, size_t count);
 
+// Позиционные и векторные вызовы: файл ищется один раз, текущая позиция
+// не используется и не сдвигается
+ssize_t lab2_pread(int fd, void *buf, size_t count, off_t offset);
+
+ssize_t lab2_pwrite(int fd, const void *buf, size_t count, off_t offset);
+
+ssize_t lab2_preadv(int fd, const struct iovec *iov, int iovcnt, off_t offset);
+
+ssize_t lab2_pwritev(int fd, const struct iovec *iov, int iovcnt, off_t offset);
+
+// Асинхронное чтение: 0, если запрос принят; результат с меткой tag
+// возвращает lab2_poll
+int lab2_read_async(int fd, void *buf, size_t count, off_t offset, uint64_t tag);
+
+// Забирает до max завершений; wait != 0 - ждать хотя бы одно
+int lab2_poll(CacheCompletion *out, int max, int wait);
+
+// Доступ к блокам кэша без копирования. Вид держит блоки закрепленными,
+// пока на него есть ссылки; отпустить его нужно до lab2_close
+CacheViewPtr lab2_read_view(int fd, off_t offset, size_t len);
+
+CacheViewPtr lab2_write_begin(int fd, off_t offset, size_t len);
+
+int lab2_write_commit(const CacheViewPtr &view);
+
 off_t lab2_lseek(int fd, off_t offset, int whence);
 
 int lab2_fsync(int fd);
 
+CacheStats lab2_stats();
+
+// Политика вытеснения кэша; блоки, уже находящиеся в кэше, сохраняются
+void lab2_set_replacement(ReplacementKind kind);
+
+// Лестница размеров экстентов в байтах (степени двойки блоков, не больше
+// наибольшего экстента кэша); крупные чтения и потоки кэшируются экстентами,
+// мелкие - блоками. 0 или -1, если размер недопустим
+int lab2_set_extents(const size_t *sizes, int count);
+
+// Чтения от min_bytes байт идут с диска прямо в буфер, не вытесняя кэш;
+// 0 - выключить
+void lab2_set_scan_bypass(size_t min_bytes);
+
+// Подключает кэш к ярусу в разделяемой памяти name ("/имя") на bytes байт:
+// процессы с одним именем делят прочитанные блоки. 0 или -1 при ошибке
+int lab2_attach_shared(const char *name, size_t bytes);
+
+void lab2_detach_shared();
+
+// Счетчики общего сегмента; -1, если ярус не подключен
+int lab2_shared_stats(SharedTierStats *out);
+
+// Удаляет имя сегмента; подключенные процессы продолжают работать с ним
+int lab2_unlink_shared(const char *name);
+
+// Отдает долю share памяти кэша (0 - выключить, до 0.5) сжатому ярусу
+// вытесненных чистых блоков; промахи сначала ищутся в нем. -1, если доля
+// недопустима или основной кэш не удалось ужать (блоки закреплены)
+int lab2_set_compressed_tier(double share);
+
+// Подключает локальный файл-ярус path на bytes байт на быстром устройстве:
+// вытесненные чистые блоки пишутся туда, промахи сначала читаются оттуда,
+// содержимое переживает перезапуск. 0 или -1, если файл не создать
+int lab2_attach_victim(const char *path, size_t bytes);
+
+void lab2_detach_victim();
+
+// Счетчики файла-яруса; -1, если он не подключен
+int lab2_victim_stats(VictimFileStats *out);
+
+// Манифест прогрева path: рабочий набор кэша сохраняется туда при выходе и
+// раз в interval_ms (0 - только при выходе), а после перезапуска блоки
+// открываемых файлов дочитываются по нему в фоне. NULL выключает.
+// -1, если существующий манифест не прочесть
+int lab2_set_manifest(const char *path, unsigned interval_ms);
+
+// Сохраняет манифест сейчас; -1, если он выключен или не записался
+int lab2_save_manifest();
+
+// Делит шарды кэша между nodes узлами NUMA (0 - как на машине, больше, чем
+// на машине, - имитация) и привязывает их память к узлам. Только до
+// открытия файлов; -1, если файлы открыты или шардов меньше, чем узлов
+int lab2_set_numa(size_t nodes);
+
+// Закрепляет вызывающий поток за узлом node, -1 - снимает закрепление
+void lab2_bind_thread(int node);
+
+// Печатает сводку lab2_stats() в stderr раз в interval_ms, 0 - выключить
+void lab2_stats_dump(unsigned interval_ms);
+
 #endif //FILE_OPERATIONS_H
@@ -0,0 +1,19 @@
+#ifndef LZ_CODEC_H
+#define LZ_CODEC_H
+
+#include <cstddef>
+
+// Быстрое сжатие семейства LZ77 без внешних библиотек, в духе LZ4:
+// последовательности "литералы + совпадение", совпадения ищутся по хешу
+// четырех байт в окне 64 КБ. Формат свой, данные живут только в памяти
+// процесса.
+
+// Сжимает n байт src в dst; размер сжатого или 0, если он не уложился
+// в cap байт (тогда сжатие бросается на середине)
+size_t lzCompress(const char* src, size_t n, char* dst, size_t cap);
+
+// Распаковывает n байт src ровно в size байт dst; false - данные
+// повреждены или дают другую длину
+bool lzDecompress(const char* src, size_t n, char* dst, size_t size);
+
+#endif //LZ_CODEC_H
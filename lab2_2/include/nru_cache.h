@@ -1,76 +1,818 @@
 #ifndef NRU_CACHE_H
 #define NRU_CACHE_H
 
-#include <windows.h>
+#include "storage_backend.h"
+#include "block_arena.h"
+#include "block_index.h"
+#include "replacement_policy.h"
+#include "shared_tier.h"
+#include "compressed_tier.h"
+#include "victim_file.h"
+#include "warm_manifest.h"
+#include "numa_topology.h"
 #include <unordered_map>
+#include <map>
+#include <memory>
 #include <vector>
 #include <string>
 #include <algorithm>
 #include <cstring>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <deque>
+#include <thread>
+#include <chrono>
+#include <cstdio>
 
+// Состояние распознавания потокового доступа к файлу (в блоках)
+struct StreamState {
+    off_t last_start{-1};  // Первый блок предыдущего чтения
+    off_t last_end{-1};    // Последний блок предыдущего чтения
+    off_t stride{0};       // Шаг между чтениями, 1 - последовательный поток
+    int confirmed{0};      // Сколько раз подряд шаг повторился
+    size_t window{0};      // Окно упреждения в шагах потока
+    off_t next{0};         // Первый еще не запрошенный блок потока
+    uint32_t wasted_seen{0}; // Значение wasted при последней проверке
+};
+
+// Гистограмма задержек по степеням двойки: в count[i] операции
+// длительностью [2^i, 2^(i+1)) нс, в последней корзине - все более долгие
+struct LatencyHistogram {
+    static constexpr size_t buckets = 32;
+    uint64_t count[buckets];
+
+    uint64_t total() const;
+
+    // Верхняя граница корзины, в которую попадает доля q операций, нс
+    uint64_t percentile(double q) const;
+};
+
+// Счетчики кэша, суммируются по шардам по запросу
+struct CacheStats {
+    uint64_t hits;            // Блок найден в кэше
+    uint64_t misses;          // Блок прочитан с диска по запросу
+    uint64_t prefetch_issued; // Блоков прочитано упреждающе
+    uint64_t prefetch_hits;   // Из них затребовано до вытеснения
+    uint64_t prefetch_wasted; // Вытеснено невостребованными
+    uint64_t dirty_blocks;    // Грязных блоков сейчас
+    uint64_t flushed_blocks;  // Записано фоновым сбросом
+    uint64_t flush_writes;    // Запросов записи фонового сброса
+    uint64_t evict_writebacks; // Синхронных записей при вытеснении
+    uint64_t reads_avoided;   // Блоков заведено под запись без чтения с диска
+    uint64_t fill_reads;      // Отложенных дочитываний частично записанных блоков
+    uint64_t scan_inserts;    // Блоков потоков и упреждения, вставленных с низким приоритетом
+    uint64_t bypassed_blocks; // Блоков больших чтений, прочитанных в обход кэша
+    uint64_t extent_loads;    // Экстентов длиннее блока, прочитанных с диска
+    uint64_t read_requests;   // Запросов чтения к бэкенду
+    uint64_t index_entries;   // Экстентов (записей индекса) в кэше сейчас
+    uint64_t shared_hits;     // Блоков взято из разделяемого яруса вместо диска
+    uint64_t warm_blocks;     // Блоков прочитано прогревом по манифесту
+    uint64_t arena_bytes;     // Память под данные блоков всех шардов
+    ArenaPages arena_pages;   // Худшие страницы среди арен шардов
+    uint32_t numa_nodes;      // Узлов NUMA, между которыми поделены шарды; 1 - режим выключен
+    bool numa_bound;          // Арены привязаны к настоящим узлам, а не к имитируемым
+    uint64_t local_hits;      // Попадания в шард узла вызывающего потока
+    uint64_t remote_hits;     // Попадания в шард чужого узла
+    uint64_t capacity_blocks; // Слотов основного кэша в работе; остальная арена отдана сжатому ярусу
+    uint64_t budget_bytes;    // Бюджет памяти кэша сейчас, с учетом ужатия под давлением
+    uint64_t pressure_shrinks; // Сколько раз бюджет ужимался из-за давления на память
+    CompressedTierStats compressed; // Сжатый ярус вытесненных блоков
+    uint64_t evictions[4];    // Вытеснено по классам NRU: 2 * accessed + dirty
+    uint64_t bytes_read;      // Прочитано с диска, байт
+    uint64_t bytes_written;   // Записано на диск, байт
+    LatencyHistogram hit_latency;  // Чтения и записи без обращения к диску
+    LatencyHistogram miss_latency; // Чтения и записи, ждавшие диска
+    LatencyHistogram sync_latency; // syncFile
+};
+
+// Завершение асинхронного чтения
+struct CacheCompletion {
+    uint64_t tag;   // Метка, переданная в readAsync
+    ssize_t result; // Результат, как у preadFile
+};
+
+// Блоки файла в одном шарде: головы интрузивных списков по слотам шарда.
+// Изменяются под блокировкой этого шарда.
+struct FileShardBlocks {
+    uint32_t resident{UINT32_MAX}; // Все блоки файла
+    uint32_t dirty{UINT32_MAX};    // Грязные блоки файла
+    uint32_t writeback{0};         // Сколько блоков файла сейчас пишется на диск
+};
+
+// Файл в кэше: один на устройство и узел, сколько бы раз его ни открыли,
+// так что все открытия видят одни и те же блоки
 struct FileHandleInternal {
-    HANDLE hFile{};      // Дескриптор файла
+    NativeHandle handle{INVALID_NATIVE_HANDLE}; // Дескриптор файла
     std::string path;    // Путь к файлу
+    int id{0};           // Номер файла в кэше - поле fd блоков и ключей индекса
+    uint32_t opens{0};   // Сколько дескрипторов lab2 открыто на файл, под files_mutex
+    std::atomic<bool> closed{false}; // Файл закрывается, новые блоки не грузятся
+    std::atomic<uint32_t> wasted{0}; // Упрежденные блоки, вытесненные без чтения
+    std::atomic<off_t> size{0}; // Логический размер с учетом записей в кэше
+    std::vector<FileShardBlocks> shard_blocks; // Блоки файла по шардам
+    bool mapped{false};          // Обслуживается через отображение, а не блоки кэша
+    std::shared_mutex map_mutex; // Доступ к map - shared, переотображение - unique
+    char* map{nullptr};          // Отображение файла
+    size_t map_length{0};        // Длина отображения, может превышать размер файла
+    bool shareable{false};       // Идентичность известна, блоки идут через разделяемый ярус
+    uint64_t dev{0};             // Устройство и узел файла - ключ разделяемого яруса
+    uint64_t ino{0};
+    int node{-1};                // Узел NUMA, в шардах которого лежат блоки; -1 - во всех шардах
+};
+
+// Открытие файла - дескриптор lab2: своя позиция и свое распознавание
+// потока, чтобы читатели одного файла не сбивали друг другу упреждение
+struct OpenFileInternal {
+    std::shared_ptr<FileHandleInternal> file;
     off_t current_pos{}; // Текущая позиция в файле
+    std::mutex pos_mutex; // Защищает current_pos
+    std::mutex stream_mutex; // Защищает stream
+    StreamState stream;   // Распознавание последовательного доступа
 };
 
+class NRUCache;
+
+// Закрепленный участок кэша, доступный без копирования: по участку iovec на
+// каждый задетый блок. Блоки не вытесняются, пока жива хотя бы одна ссылка
+// на вид; последняя ссылка освобождает их. Вид нужно отпустить до закрытия файла.
+class CacheView {
+public:
+    ~CacheView();
+
+    const struct iovec* iov() const { return parts.data(); }
+
+    int iovcnt() const { return static_cast<int>(parts.size()); }
+
+    size_t size() const { return length; }
+
+private:
+    friend class NRUCache;
+
+    // Закрепленный видом блок
+    struct PinnedBlock {
+        size_t shard;
+        uint32_t slot;
+        uint32_t part;    // Номер блока в виде, индекс в parts
+        uint64_t claimed; // Части маски valid, объявленные достоверными видом для записи
+    };
+
+    std::vector<struct iovec> parts;  // Данные по блокам
+    std::vector<PinnedBlock> pinned;  // По шардам, чтобы каждый блокировался один раз
+    NRUCache* cache{nullptr}; // Кэш, которому возвращаются блоки
+    std::shared_ptr<FileHandleInternal> file;
+    off_t offset{0};
+    size_t length{0};
+    bool writable{false};  // Вид для записи, открыт writeBegin
+    bool committed{false}; // Запись зафиксирована или отменена
+};
+
+using CacheViewPtr = std::shared_ptr<CacheView>;
+
 class NRUCache {
 private:
-    struct CacheKey {
-        int fd;            // Идентификатор файла
-        off_t block_number; // Номер блока
+    friend class CacheView;
 
-        bool operator==(const CacheKey& other) const {
-            return fd == other.fd && block_number == other.block_number;
-        }
+    // Дескриптор слота; данные лежат в арене, сам массив дескрипторов
+    // выделяется один раз. Единица кэша - экстент из span подряд идущих
+    // блоков файла, выровненный по span: в индексе, политике вытеснения и
+    // списке блоков файла только его голова, а достоверность, грязность и
+    // закрепление ведутся по каждому блоку. Обращение и упреждение - у головы.
+    struct CacheBlock {
+        FileHandleInternal* file{nullptr}; // Файл-владелец, жив пока блок в кэше
+        int fd{0};                // Номер файла в кэше (FileHandleInternal::id)
+        off_t block_number{0};    // Номер блока
+        uint32_t pins{0};        // Операции ввода-вывода, удерживающие блок
+        bool in_use{false};      // Занят ли слот
+        bool loading{false};     // Данные еще читаются с диска
+        bool writeback{false};   // Данные пишутся на диск, запись в блок ждет
+        bool accessed{false};    // Обращались ли к блоку с прошлой проверки вытеснением
+        bool dirty{false};       // Был ли блок изменен
+        bool prefetched{false};  // Прочитан упреждающе и еще не затребован
+        uint32_t cleared_scan{0}; // Поиск жертвы, сбросивший бит обращения (Shard::victim_scans)
+        char* data{nullptr};      // Данные блока в арене
+        int64_t dirty_since{0};   // Когда блок стал грязным, нс steady_clock
+        uint64_t valid{0};        // Маска достоверных частей блока по valid_unit байт
+        uint32_t file_prev{BlockIndex::npos}; // Соседи в списке блоков файла (слоты шарда)
+        uint32_t file_next{BlockIndex::npos};
+        uint32_t dirty_prev{BlockIndex::npos}; // Соседи в списке грязных блоков файла
+        uint32_t dirty_next{BlockIndex::npos};
+        uint32_t age_prev{BlockIndex::npos};   // Соседи в очереди грязных блоков шарда
+        uint32_t age_next{BlockIndex::npos};
+        uint32_t head{BlockIndex::npos}; // Слот головы экстента, у самой головы - свой
+        uint32_t span{1};         // У головы: блоков в экстенте
+        std::vector<uint32_t> members; // У головы экстента длиннее блока: слоты его блоков по порядку
     };
 
-    struct CacheKeyHash {
-        size_t operator()(const CacheKey& k) const {
-            return std::hash<int>()(k.fd) ^ (std::hash<off_t>()(k.block_number) << 1);
-        }
+    // Как заводится блок при промахе
+    enum class LoadMode {
+        Read,      // Чтение с диска по запросу
+        Scan,      // Чтение по запросу распознанного потока, низкий приоритет
+        Prefetch,  // Упреждающее чтение
+        Warm,      // Прогрев по манифесту: обычный приоритет, не промах
+        Zero,      // Блок целиком за концом файла - нули без чтения
+        Overwrite  // Под запись без чтения, достоверно только записанное
     };
 
-    struct CacheBlock {
-        int fd;                   // Идентификатор файла
-        off_t block_number;       // Номер блока
-        bool accessed;           // Был ли блок недавно использован
-        bool dirty;              // Был ли блок изменен
-        std::vector<char> data;   // Данные блока
-
-        CacheBlock(int fd, off_t bn, size_t size)
-            : fd(fd), block_number(bn), accessed(true), dirty(false), data(size) {}
+    // Счетчики шарда, изменяются под его блокировкой
+    struct ShardStats {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t prefetch_issued;
+        uint64_t prefetch_hits;
+        uint64_t prefetch_wasted;
+        uint64_t evict_writebacks;
+        uint64_t reads_avoided;
+        uint64_t fill_reads;
+        uint64_t scan_inserts;
+        uint64_t extent_loads;
+        uint64_t warm_blocks;
+        uint64_t local_hits;
+        uint64_t remote_hits;
+        uint64_t evictions[4];
+        uint64_t bytes_read;
+        uint64_t bytes_written;
+    };
+
+    // Гистограмма задержек, пополняемая без блокировок
+    struct LatencyCounters {
+        std::atomic<uint64_t> count[LatencyHistogram::buckets]{};
+
+        void record(int64_t ns);
+
+        void addTo(LatencyHistogram& out) const;
     };
 
+    using ShardLock = std::unique_lock<std::mutex>;
+    using FilePtr = std::shared_ptr<FileHandleInternal>;
+    using OpenPtr = std::shared_ptr<OpenFileInternal>;
+
+    // Задание фоновому потоку: блоки start + k * stride + j, k < count, j < span
+    struct ReadaheadRequest {
+        std::shared_ptr<FileHandleInternal> file;
+        int fd;
+        off_t start;
+        off_t stride;
+        off_t span;
+        size_t count;
+    };
+
+    // Прогрев открытого файла по манифесту; next - первый еще не
+    // прочитанный экстент
+    struct WarmRequest {
+        FilePtr file;
+        std::vector<ManifestExtent> extents;
+        size_t next;
+    };
+
+    // Самый длинный экстент - 2^max_extent_shift блоков
+    static constexpr size_t max_extent_shift = 8;
+
+    // Независимая часть кэша: своя блокировка, арена, индекс и политика
+    // вытеснения. Блок попадает в шард по хешу (fd, номер участка), где
+    // участок - выровненные блоки наибольшего экстента: все экстенты,
+    // которые могут его задеть, лежат в одном шарде.
+    struct Shard {
+        std::mutex mutex;
+        std::condition_variable unpinned; // Блок загружен или откреплен
+        BlockArena arena;             // Данные блоков шарда
+        std::vector<CacheBlock> blocks; // Дескрипторы по слотам
+        std::vector<size_t> free_slots; // Свободные слоты
+        BlockIndex index;             // (fd, номер блока) -> слот
+        std::unique_ptr<ReplacementPolicy> policy; // Выбор вытесняемого слота
+        ShardStats stats{};           // Счетчики шарда
+        LatencyCounters hit_latency;  // Задержки операций, начатых в этом шарде
+        LatencyCounters miss_latency;
+        size_t id;                    // Номер шарда, индекс в FileHandleInternal::shard_blocks
+        int node{-1};                 // Узел NUMA арены, -1 - режим NUMA выключен
+        uint32_t extent_count[max_extent_shift + 1]{}; // Экстентов по log2 span
+        uint32_t extent_shifts{0};    // Биты log2 span, экстенты которых есть в шарде
+        std::atomic<size_t> capacity; // Слотов в работе: свободные и занятые
+        std::vector<uint32_t> spare_slots; // Слоты, память которых отдана системе
+        size_t budget;                // Слотов арены, отданных кэшу вместе со сжатым ярусом
+        size_t target;                // Слотов в работе, к которым шард подгоняется по шагам
+        CompressedTier compressed;    // Сжатые копии вытесненных чистых блоков
+        uint32_t dirty_oldest{BlockIndex::npos}; // Грязные блоки по dirty_since, от старых к новым
+        uint32_t dirty_newest{BlockIndex::npos};
+        uint32_t victim_scans{0};     // Номер последнего поиска жертвы
+
+        Shard(size_t id, size_t block_size, size_t max_blocks, ReplacementKind replacement, ArenaPages pages);
+    };
+
+    // Отвечает политике о кандидатах в жертвы: закрепленные пропускаются,
+    // грязные откладываются, пока не набралось dirty_scan_limit. Класс NRU
+    // учитывает и бит обращения, сброшенный часами в этом же поиске.
+    struct VictimScan : VictimFilter {
+        Shard& shard;
+        uint32_t scan;                     // Номер этого поиска
+        CacheBlock* dirty_victim{nullptr}; // Первый отложенный грязный
+        size_t dirty_seen{0};
+        size_t victim_class{0};            // Класс NRU выбранной жертвы
+        size_t dirty_class{1};             // Класс NRU отложенного грязного
+
+        explicit VictimScan(Shard& shard) : shard(shard), scan(++shard.victim_scans) {}
+
+        bool referenced(uint32_t slot) override;
+
+        bool pinned(uint32_t slot) override;
+
+        bool loading(uint32_t slot) override;
+
+        VictimCheck check(uint32_t slot) override;
+    };
+
+    // Обход вектора буферов пользователя по смещению внутри запроса
+    struct IovCursor {
+        const struct iovec* iov;
+        int iovcnt;
+        int index;     // Текущий буфер
+        size_t offset; // Смещение в текущем буфере
+
+        void seek(size_t pos);
+
+        void copyIn(char* dest, size_t bytes);
+
+        void copyOut(const char* src, size_t bytes);
+
+        // Дописывает в out буферы, покрывающие следующие bytes байт
+        void slice(size_t bytes, std::vector<struct iovec>& out);
+    };
+
+    // Сколько промахов одного запроса отдается бэкенду одним пакетом
+    static constexpr size_t read_batch_limit = 64;
+
+    // Сколько буферов бэкенд получает в одном векторном запросе
+    static constexpr size_t read_iov_limit = 256;
+
+    // Зарезервированные экстенты, читаемые одним пакетом; подряд идущие
+    // объединяются в один векторный запрос
+    struct ReadBatch {
+        size_t count;
+        Shard* shards[read_batch_limit];
+        CacheBlock* blocks[read_batch_limit];
+    };
+
+    // Асинхронное чтение в очереди исполнителей
+    struct AsyncRead {
+        OpenPtr open;
+        void* buf;
+        size_t count;
+        off_t offset;
+        uint64_t tag;
+    };
+
+    // Блок, закрепленный фоновым сбросом на время записи
+    struct FlushItem {
+        FileHandleInternal* file;
+        int fd;
+        off_t block_number;
+        Shard* shard;
+        CacheBlock* block;
+    };
+
+    // Сколько невостребованных грязных блоков стрелка пропускает в поисках
+    // чистого, прежде чем вытеснить первый из них
+    static constexpr size_t dirty_scan_limit = 64;
+
+    // Сколько заданий упреждения может ждать в очереди; лишние отбрасываются
+    static constexpr size_t readahead_queue_limit = 64;
+
+    // Сколько экстентов прогрева читается за один подход, прежде чем поток
+    // упреждения снова проверит очередь потоков
+    static constexpr size_t warm_batch_limit = read_batch_limit;
+
+    // Сколько потоков исполняют асинхронные чтения
+    static constexpr size_t async_threads = 4;
+
+    // Сколько блоков фоновый сброс закрепляет за один проход
+    static constexpr size_t flush_batch_limit = 1024;
+
+    // Сколько слотов шард отдает за одну блокировку при ужатии кэша
+    static constexpr size_t trim_step = 32;
+
     size_t block_size;            // Размер блока данных
-    size_t max_blocks;            // Максимальное количество блоков в кэше
-    std::unordered_map<CacheKey, CacheBlock*, CacheKeyHash> cache_map; // Кэш блоков
-    std::unordered_map<int, FileHandleInternal> open_files; // Открытые файлы
-    int next_fd;                  // Следующий идентификатор файла
+    size_t max_blocks;            // Максимальное количество блоков в кэше, потолок бюджета
+    std::atomic<size_t> budget_blocks; // Слотов в бюджете сейчас, включая сжатый ярус
+    std::mutex budget_mutex;      // Защищает budget_limit, compressed_share и бюджеты шардов
+    size_t budget_limit;          // Заданный бюджет в слотах; давление ужимает budget_blocks ниже
+    double compressed_share;      // Доля бюджета сжатого яруса
+    size_t extent_shift;          // log2 наибольшего экстента в блоках, задает участки шардов
+    std::atomic<uint32_t> extent_ladder; // Биты log2 span, которыми заводятся новые экстенты
+    size_t valid_unit;            // Байт на бит маски valid
+    std::atomic<ReplacementKind> replacement; // Политика вытеснения шардов
+    uint64_t valid_full;          // Маска полностью достоверного блока
+    std::vector<std::unique_ptr<Shard>> shards; // Шарды кэша
+    size_t numa_nodes;            // Узлов NUMA, между которыми поделены шарды; 1 - режим выключен
+    bool numa_bound;              // Арены привязаны к настоящим узлам
+    std::vector<std::vector<size_t>> node_shards; // Номера шардов каждого узла
+    std::shared_mutex files_mutex; // Защищает open_files, files_by_id и счетчики
+    std::unordered_map<int, OpenPtr> open_files; // Открытые дескрипторы
+    std::map<std::pair<uint64_t, uint64_t>, FilePtr> files_by_id; // Файлы по устройству и узлу
+    std::condition_variable_any file_closed; // Последнее закрытие файла завершилось
+    int next_fd;                  // Следующий дескриптор
+    int next_file_id;             // Следующий номер файла в кэше
+    bool direct_io;               // Открывать файлы в обход системного кэша
+    std::unique_ptr<StorageBackend> backend; // Платформенный ввод-вывод
+    size_t readahead_min;         // Начальное окно упреждения, блоков
+    size_t readahead_max;         // Предельное окно упреждения, 0 - выключено
+    std::mutex readahead_mutex;   // Защищает очередь и поток упреждения
+    std::condition_variable readahead_cv;
+    std::deque<ReadaheadRequest> readahead_queue;
+    std::deque<WarmRequest> warm_queue; // Прогрев, уступает заданиям потоков
+    std::thread readahead_thread; // Фоновое упреждающее чтение
+    bool readahead_stop;
+    std::atomic<size_t> dirty_blocks; // Грязных блоков во всех шардах
+    double dirty_high_ratio;      // Доля грязных, с которой сброс идет без ожидания
+    double dirty_low_ratio;       // Доля грязных, до которой он сбрасывает
+    std::chrono::milliseconds dirty_max_age; // Предельный возраст грязного блока
+    std::mutex flusher_mutex;     // Защищает поток сброса
+    std::condition_variable flusher_cv;
+    std::thread flusher_thread;   // Фоновая запись грязных блоков
+    bool flusher_stop;
+    std::atomic<uint64_t> flushed_blocks;
+    std::atomic<uint64_t> flush_writes;
+    std::atomic<size_t> scan_bypass; // Чтения от стольких байт идут в обход кэша, 0 - никогда
+    std::atomic<uint64_t> bypassed_blocks;
+    std::atomic<uint64_t> read_requests;
+    std::atomic<SharedTier*> shared_tier; // Подключенный разделяемый ярус или nullptr
+    std::mutex shared_mutex;      // Защищает shared_tiers
+    std::vector<std::unique_ptr<SharedTier>> shared_tiers; // Все подключавшиеся: отключенный
+                                  // ярус может еще читаться без блокировок
+    std::atomic<uint64_t> shared_hits;
+    std::atomic<VictimFile*> victim_file; // Подключенный локальный файл-ярус или nullptr
+    std::mutex victim_mutex;      // Защищает victim_files
+    std::vector<std::unique_ptr<VictimFile>> victim_files; // Все подключавшиеся, как shared_tiers
+    std::mutex async_mutex;       // Защищает очереди асинхронных чтений
+    std::condition_variable async_cv;      // Появилось задание
+    std::condition_variable completion_cv; // Появилось завершение
+    std::deque<AsyncRead> async_queue;
+    std::deque<CacheCompletion> completions;
+    std::vector<std::thread> async_workers; // Запускаются при первом запросе
+    size_t async_pending;         // Отправлено и еще не завершено
+    bool async_stop;
+    LatencyCounters sync_latency;
+    std::chrono::milliseconds stats_dump_interval; // Период вывода статистики, 0 - выключен
+    FILE* stats_dump_out;         // Куда выводится статистика
+    std::chrono::steady_clock::time_point stats_dumped; // Время последнего вывода
+    std::mutex manifest_mutex;    // Защищает manifest_path и manifest_files
+    std::string manifest_path;    // Файл манифеста прогрева, пустой - выключен
+    std::map<std::pair<uint64_t, uint64_t>, ManifestFile> manifest_files; // Наборы неоткрытых файлов
+    std::chrono::milliseconds manifest_interval; // Период сохранения манифеста, 0 - только при завершении
+    std::chrono::steady_clock::time_point manifest_saved; // Время последнего сохранения
+    bool trim_pending;            // Бюджет уменьшен, шарды ждут ужатия, под flusher_mutex
+    std::string pressure_path;    // Файл PSI давления на память, под flusher_mutex
+    double pressure_limit;        // Порог avg10 в процентах
+    std::chrono::milliseconds pressure_interval; // Период опроса, 0 - выключен
+    std::chrono::steady_clock::time_point pressure_checked; // Время последнего опроса
+    std::atomic<uint64_t> pressure_shrinks;
+
+    Shard& shardFor(const FileHandleInternal& file, off_t block_number);
+
+    int callerNode() const;
+
+    void countHits(Shard& shard, uint64_t blocks);
+
+    OpenPtr lookupOpen(int fd);
+
+    FilePtr lookupFile(int fd);
+
+    static CacheBlock* memberOf(Shard& shard, CacheBlock* head, size_t i);
+
+    static bool unitPinned(Shard& shard, CacheBlock* head);
+
+    static CacheBlock* dirtyMember(Shard& shard, CacheBlock* head);
+
+    uint32_t findUnit(const Shard& shard, int fd, off_t block_number) const;
+
+    CacheBlock* lookupBlock(Shard& shard, int fd, off_t block_number);
+
+    CacheBlock* findBlock(Shard& shard, int fd, off_t block_number);
+
+    bool rangeFree(const Shard& shard, int fd, off_t base, size_t span) const;
+
+    size_t chooseSpan(const Shard& shard, int fd, off_t block_number, off_t lo, off_t hi) const;
+
+    bool writeBackBlock(Shard& shard, ShardLock& lock, CacheBlock* block);
+
+    ssize_t sharedGet(const FileHandleInternal& file, off_t block_number, char* out);
+
+    void sharedPut(const FileHandleInternal& file, off_t block_number, const char* data, ssize_t length,
+                   bool replace);
 
-    CacheBlock* findBlock(int fd, off_t block_number);
+    bool victimTake(const FileHandleInternal& file, off_t first, size_t count, char* const* out);
 
-    void writeBackBlock(CacheBlock* block);
+    void victimErase(const FileHandleInternal& file, off_t first, size_t count);
 
-    void evictBlock();
+    static void linkBlock(Shard& shard, uint32_t& head, CacheBlock* block,
+                          uint32_t CacheBlock::*prev, uint32_t CacheBlock::*next);
 
-    CacheBlock* loadBlock(int fd, off_t block_number);
+    static void unlinkBlock(Shard& shard, uint32_t& head, CacheBlock* block,
+                            uint32_t CacheBlock::*prev, uint32_t CacheBlock::*next);
+
+    void markDirty(Shard& shard, CacheBlock* block);
+
+    void markClean(Shard& shard, CacheBlock* block);
+
+    void beginWriteback(Shard& shard, CacheBlock* block);
+
+    void endWriteback(Shard& shard, CacheBlock* block, bool ok);
+
+    void removeBlock(Shard& shard, CacheBlock* block, bool evicted = false);
+
+    bool resizeShard(Shard& shard, ShardLock& lock, size_t capacity);
+
+    void applyBudget(size_t slots);
+
+    bool trimShards();
+
+    void checkPressure(const std::string& path, double limit);
+
+    bool evictBlock(Shard& shard, ShardLock& lock, bool* write_failed = nullptr);
+
+    CacheBlock* claimBlock(Shard& shard, FileHandleInternal& file, int fd, off_t block_number, LoadMode mode,
+                           size_t span = 1);
+
+    CacheBlock* loadBlock(Shard& shard, ShardLock& lock, FileHandleInternal& file, int fd, off_t block_number,
+                          LoadMode mode);
+
+    CacheBlock* reserveBlock(Shard& shard, ShardLock& lock, FileHandleInternal& file, int fd, off_t block_number,
+                             LoadMode mode, off_t lo, off_t hi);
+
+    bool readBatch(FileHandleInternal& file, ReadBatch& batch, IovCursor* out, off_t start, off_t end);
+
+    CacheBlock* acquireBlock(Shard& shard, ShardLock& lock, FileHandleInternal& file, int fd,
+                             off_t block_number, LoadMode miss_mode);
+
+    uint64_t validMask(size_t offset, size_t bytes) const;
+
+    bool fillBlock(Shard& shard, ShardLock& lock, CacheBlock* block);
+
+    bool prepareWrite(Shard& shard, ShardLock& lock, CacheBlock* block, size_t offset, size_t bytes);
+
+    // Массивы отпущенного вида, которые поток отдает следующему
+    struct ViewSpare {
+        std::vector<struct iovec> parts;
+        std::vector<CacheView::PinnedBlock> pinned;
+    };
+
+    static ViewSpare& viewSpare();
+
+    CacheViewPtr makeView(int fd, off_t offset, size_t len, bool writable);
+
+    void abandonView(CacheView& view);
+
+    void commitView(CacheView& view);
+
+    void releaseView(CacheView* view);
+
+    ssize_t readvAt(OpenFileInternal& open, const struct iovec* iov, int iovcnt, off_t offset);
+
+    ssize_t writevAt(const FilePtr& file, const struct iovec* iov, int iovcnt, off_t offset);
+
+    void recordLatency(Shard& shard, int64_t started, uint64_t waits);
+
+    off_t trackStream(OpenFileInternal& open, off_t first, off_t last);
+
+    bool canBypass(const struct iovec* iov, int iovcnt, off_t offset, size_t count) const;
+
+    ssize_t bypassRead(const FilePtr& file, int fd, const struct iovec* iov, int iovcnt, off_t offset, size_t count);
+
+    void prefetch(const ReadaheadRequest& req);
+
+    void queueWarmUp(const FilePtr& file);
+
+    void warmUp(WarmRequest& req);
+
+    void captureManifest(FileHandleInternal& file, ManifestFile& out);
+
+    bool writeManifestNow(bool flush);
+
+    void readaheadLoop();
+
+    size_t writeItems(std::vector<FlushItem>& items);
+
+    size_t flushDirtyBlocks(bool force);
+
+    void flusherLoop();
+
+    bool flushFileBlocks(FileHandleInternal& file, bool drop);
+
+    void asyncLoop();
+
+    bool growMapped(FileHandleInternal& file, off_t end);
+
+    ssize_t mappedRead(FileHandleInternal& file, const struct iovec* iov, int iovcnt, off_t offset);
+
+    ssize_t mappedWrite(FileHandleInternal& file, const struct iovec* iov, int iovcnt, off_t offset);
+
+    int syncMapped(FileHandleInternal& file);
 
 public:
-    NRUCache(size_t block_size, size_t max_blocks);
+    // shard_count - число независимо блокируемых частей кэша, max_blocks
+    // делится между ними поровну. Арена резервируется под max_blocks, и
+    // бюджет setBudget ужимает кэш в этих пределах. max_extent - наибольший экстент в байтах,
+    // 0 - кэш только поблочный; он округляется вниз до степени двойки блоков
+    // и не превышает 1/16 шарда и 2^max_extent_shift блоков. pages - лучшие
+    // страницы для данных блоков, которые стоит пробовать (см. BlockArena).
+    NRUCache(size_t block_size, size_t max_blocks, bool direct_io = false, size_t shard_count = 1,
+             ReplacementKind replacement = ReplacementKind::NRU, size_t max_extent = 0,
+             ArenaPages pages = ArenaPages::Huge);
 
     ~NRUCache();
 
-    int openFile(const char* path);
+    // Окно упреждающего чтения в блоках: растет от min_blocks вдвое при
+    // каждом продвижении потока, max_blocks = 0 выключает упреждение
+    void setReadahead(size_t min_blocks, size_t max_blocks);
+
+    // Фоновый сброс: при доле грязных блоков выше high_ratio пишет их, пока
+    // доля не опустится до low_ratio, и в любом случае пишет блоки старше
+    // max_age_ms (0 - без ограничения возраста)
+    void setWriteback(double high_ratio, double low_ratio, unsigned max_age_ms);
+
+    // Чтения от min_bytes байт копируются с диска прямо в буферы вызывающего,
+    // не вытесняя блоки кэша; блоки, уже лежащие в кэше, берутся из него.
+    // 0 выключает обход. При небуферизованном вводе-выводе обходятся только
+    // чтения, выровненные по блоку вместе с буферами.
+    void setScanBypass(size_t min_bytes);
+
+    // Лестница размеров экстентов в байтах: каждый - степень двойки блоков не
+    // больше наибольшего экстента, блок в лестнице есть всегда. Крупные чтения
+    // и потоки заводят наибольший экстент, целиком лежащий в запросе (для
+    // потока - в файле) и не задевающий уже кэшированные; остальное идет
+    // блоками. По умолчанию - блок, каждый 16-кратный и наибольший экстент.
+    // false - недопустимый размер, лестница не меняется.
+    bool setExtentSizes(const size_t* sizes, size_t count);
+
+    // Подключает разделяемый между процессами ярус name (shm_open) на bytes
+    // байт; уже созданный другим процессом сегмент берется с его размером.
+    // Промахи сначала ищутся в нем, прочитанные с диска и записанные на диск
+    // блоки кладутся туда, так что процессы с одним именем делят один
+    // прогретый кэш. Несброшенные записи других процессов не видны, как и
+    // без яруса. false - сегмент не создать или у него другой размер блока.
+    bool attachShared(const char* name, size_t bytes);
+
+    void detachShared();
+
+    // Счетчики подключенного яруса; false, если его нет
+    bool sharedStats(SharedTierStats* out) const;
+
+    // Сжатый второй ярус: доля share бюджета кэша (0 - выключен, не больше
+    // max_compressed_share) отдается от основного кэша пулу сжатых блоков.
+    // Чистые блоки, вытесненные из основного кэша, сжимаются туда, если
+    // сжимаются хотя бы до 3/4, и промах основного кэша сначала ищется в нем.
+    // Лишние блоки основного кэша вытесняются сразу, память их слотов
+    // отдается системе; содержимое яруса при изменении доли сбрасывается.
+    // false - недопустимая доля или не все блоки удалось вытеснить
+    // (закреплены), тогда основной кэш остается больше заданного.
+    // Обмен блока через ярус стоит около 8 мкс процессора (сжатие 4 КБ при
+    // вытеснении и распаковка): ярус выгоден, когда промах заметно дороже,
+    // как у сетевого тома. С локальным SSD доля выше 1/4 уже не окупается.
+    bool setCompressedTier(double share);
+
+    static constexpr double max_compressed_share = 0.5;
+
+    // Бюджет памяти кэша в байтах, не больше арены (maxBudget); сжатый ярус
+    // получает свою долю из него. Рост применяется сразу, при уменьшении
+    // лишние блоки вытесняет фоновый поток по trim_step слотов шарда за
+    // блокировку, так что обращения к кэшу не ждут всего ужатия; память
+    // отданных слотов возвращается системе (кроме явных больших страниц).
+    // Снимает ужатие под давлением. false - меньше min_shard_blocks блоков на
+    // шард или больше потолка.
+    bool setBudget(size_t bytes);
+
+    size_t budget() const { return budget_blocks * block_size; }
+
+    size_t maxBudget() const { return shards.size() * shards[0]->blocks.size() * block_size; }
+
+    size_t blockSize() const { return block_size; }
+
+    static constexpr size_t min_shard_blocks = 16;
+
+    // Опрос давления на память по файлу PSI path (/proc/pressure/memory или
+    // memory.pressure cgroup v2) раз в interval_ms: пока доля времени
+    // простоя some avg10 не ниже limit процентов, бюджет ужимается на 1/8
+    // заданного за опрос, но не ниже его четверти; когда давление спадает
+    // ниже limit / 2, бюджет так же возвращается. nullptr или interval_ms = 0
+    // выключают опрос и возвращают бюджет. false - файл не прочесть.
+    bool setPressureWatch(const char* path, double limit, unsigned interval_ms);
+
+    // Локальный файл-ярус path на bytes байт (см. VictimFile) на быстром
+    // устройстве под кэшем медленного источника: чистые блоки файлов,
+    // вытесненные из памяти, пишутся туда в фоне, а промах, не найденный в
+    // ярусах в памяти, сначала читается оттуда. Существующий файл той же
+    // разметки подхватывается с содержимым; копии файлов, открытых сейчас,
+    // при этом отбрасываются. Подключенный раньше ярус отключается.
+    // false - файл не создать или bytes мало.
+    bool attachVictimFile(const char* path, size_t bytes);
+
+    // Дописывает очередь яруса и закрывает его файл
+    void detachVictimFile();
+
+    // Счетчики подключенного файла-яруса; false, если его нет
+    bool victimStats(VictimFileStats* out) const;
+
+    // Заменяет ввод-вывод кэша, например оберткой, которая имитирует
+    // медленный источник. Только до открытия файлов; false - файлы открыты.
+    bool setBackend(std::unique_ptr<StorageBackend> io);
 
+    // Манифест прогрева path: рабочий набор кэша (какие блоки файлов лежат в
+    // нем и обращались ли к ним) сохраняется туда при уничтожении кэша и, при
+    // interval_ms > 0, периодически. Уже лежащий там манифест читается сразу:
+    // при открытии файла, чей размер и время изменения совпадают с
+    // записанными, его блоки дочитываются фоновым потоком крупными пакетами в
+    // свободные слоты, горячие первыми. Набор закрытого файла запоминается
+    // при закрытии. Периодическое сохранение не сбрасывает грязные блоки, и
+    // набор файла, измененного после него, при загрузке отбрасывается.
+    // Пустой path или nullptr выключает манифест. false - существующий
+    // манифест не прочесть; сохранение все равно включается.
+    bool setManifest(const char* path, unsigned interval_ms = 0);
+
+    // Сбрасывает грязные блоки открытых файлов и сохраняет манифест сейчас;
+    // false, если он выключен или не записался
+    bool saveManifest();
+
+    // Режим NUMA: шарды делятся между nodes узлами по кругу, и арена каждого
+    // привязывается к своему узлу (mbind), если такой узел есть на машине.
+    // nodes = 0 - узлов столько, сколько на машине, 1 - режим выключен.
+    // Узлов больше, чем на машине, имитируются: шарды и счетчики
+    // попаданий делятся так же, но память не привязывается. Вызывается до
+    // открытия файлов; false - файлы открыты или шардов меньше, чем узлов.
+    bool setNuma(size_t nodes);
+
+    // Закрепляет вызывающий поток за узлом node: он считается потоком этого
+    // узла, а если узел есть на машине - идет только на его процессорах.
+    // -1 - снова определять узел по процессору.
+    static void bindThread(int node);
+
+    // Меняет политику вытеснения на ходу: новая политика получает блоки,
+    // уже находящиеся в шарде, без истории старой
+    void setReplacement(ReplacementKind kind);
+
+    ReplacementKind replacementKind() const { return replacement; }
+
+    CacheStats stats();
+
+    // Печатает сводку stats() в out
+    void dumpStats(FILE* out);
+
+    // Фоновый поток сброса печатает сводку в out раз в interval_ms,
+    // 0 выключает вывод
+    void setStatsDump(unsigned interval_ms, FILE* out = stderr);
+
+    // Флаг openFile: файл обслуживается через mmap и системный кэш страниц,
+    // минуя блоки NRUCache. Для файлов, которые в основном читаются и
+    // помещаются в память; виды readView/writeBegin для них недоступны.
+    static constexpr int open_mmap = 1;
+
+    // Флаг openFile в режиме NUMA: блоки файла лежат только в шардах узла
+    // открывающего потока. Для файлов, которые читают потоки одного узла;
+    // без флага блоки делятся между шардами всех узлов.
+    static constexpr int open_local = 2;
+
+    // Повторное открытие того же файла (то же устройство и узел) дает новый
+    // дескриптор со своей позицией над теми же блоками кэша; блоки уходят из
+    // кэша при закрытии последнего дескриптора. Открытия open_mmap не делятся.
+    int openFile(const char* path, int flags = 0);
+
+    // -1 и errno = EIO, если грязные блоки не записались: они остаются в
+    // кэше, а дескриптор - открытым
     int closeFile(int fd);
 
     ssize_t readFile(int fd, void* buf, size_t count);
 
     ssize_t writeFile(int fd, const void* buf, size_t count);
 
+    // Позиционные вызовы не используют и не сдвигают текущую позицию файла
+    ssize_t preadFile(int fd, void* buf, size_t count, off_t offset);
+
+    ssize_t pwriteFile(int fd, const void* buf, size_t count, off_t offset);
+
+    ssize_t preadvFile(int fd, const struct iovec* iov, int iovcnt, off_t offset);
+
+    ssize_t pwritevFile(int fd, const struct iovec* iov, int iovcnt, off_t offset);
+
+    // Ставит чтение в очередь фоновых исполнителей и сразу возвращается;
+    // результат с меткой tag забирается через pollCompletions
+    int readAsync(int fd, void* buf, size_t count, off_t offset, uint64_t tag);
+
+    // Забирает до max завершений; wait - ждать хотя бы одно, если есть
+    // незавершенные запросы
+    size_t pollCompletions(CacheCompletion* out, size_t max, bool wait);
+
+    // Вид на len байт с offset без копирования; nullptr при ошибке или если
+    // участок шире половины шарда
+    CacheViewPtr readView(int fd, off_t offset, size_t len);
+
+    // Вид для записи прямо в блоки кэша; данные становятся грязными при
+    // writeCommit или, если он не вызван, при освобождении вида
+    CacheViewPtr writeBegin(int fd, off_t offset, size_t len);
+
+    int writeCommit(const CacheViewPtr& view);
+
     off_t seekFile(int fd, off_t offset, int whence);
 
+    // -1 и errno = EIO, если какой-то грязный блок не записался
     int syncFile(int fd);
 };
 
@@ -0,0 +1,24 @@
+#ifndef NUMA_TOPOLOGY_H
+#define NUMA_TOPOLOGY_H
+
+#include <cstddef>
+
+// Узлы NUMA машины без libnuma: топология читается из sysfs (Linux) или
+// спрашивается у системы (Windows). На машине без NUMA - один узел 0, и
+// привязки ничего не делают.
+
+// Число узлов: наибольший номер включенного узла плюс один
+size_t numaNodeCount();
+
+// Узел процессора, на котором сейчас идет поток
+int currentNumaNode();
+
+// Разрешает потоку идти только на процессорах узла node; false - узла нет
+// или система отказала
+bool bindThreadToNode(int node);
+
+// Размещает страницы участка памяти на узле node, перенося уже занятые;
+// false - узла нет или система отказала, участок остается как был
+bool bindMemoryToNode(void* addr, size_t length, int node);
+
+#endif //NUMA_TOPOLOGY_H
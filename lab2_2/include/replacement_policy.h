@@ -0,0 +1,89 @@
+#ifndef REPLACEMENT_POLICY_H
+#define REPLACEMENT_POLICY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+// Алгоритм выбора вытесняемого блока
+enum class ReplacementKind {
+    NRU,     // Второй шанс по биту обращения (часы)
+    LRU,     // Давнее всех использованный
+    LRU2,    // LRU-K при K = 2: давнее всех предпоследнее обращение
+    TwoQ,    // 2Q: однократные блоки в FIFO, повторно затребованные - в LRU
+    ARC,     // Adaptive Replacement Cache
+    ClockPro // CLOCK-Pro: горячие и холодные блоки с тестовым периодом
+};
+
+const char *replacementName(ReplacementKind kind);
+
+// Имя в нижнем регистре, как его выводит replacementName; false - неизвестное
+bool parseReplacement(const char *name, ReplacementKind &kind);
+
+// Ответ кэша на предложенного политикой кандидата
+enum class VictimCheck {
+    Take, // Вытеснить его
+    Skip, // Закреплен или грязный, искать дальше
+    Stop  // Искать больше не нужно
+};
+
+// Состояние блоков, которое политика узнает у кэша во время выбора жертвы
+class VictimFilter {
+public:
+    // Обращались ли к блоку с прошлой проверки; бит при этом сбрасывается.
+    // Закрепленный блок считается используемым.
+    virtual bool referenced(uint32_t slot) = 0;
+
+    // Блок сейчас загружается или используется
+    virtual bool pinned(uint32_t slot) = 0;
+
+    // Блок читается с диска и скоро освободится сам
+    virtual bool loading(uint32_t slot) = 0;
+
+    virtual VictimCheck check(uint32_t slot) = 0;
+
+protected:
+    ~VictimFilter() = default;
+};
+
+// Политика вытеснения одного шарда. Работает с номерами слотов шарда и
+// хеш-ключами блоков (для истории уже вытесненных), сами данные и индекс
+// остаются у кэша. Вызывается под блокировкой шарда.
+class ReplacementPolicy {
+public:
+    virtual ~ReplacementPolicy() = default;
+
+    // Политика ведет списки по обращениям: кэш сообщает о каждом попадании
+    bool tracksAccess() const { return tracks_access; }
+
+    // Новый блок получает бит обращения, то есть лишний оборот часов
+    bool marksInserted() const { return marks_inserted; }
+
+    // low_priority - блок из распознанного потока или упреждения: до первого
+    // обращения вытесняется раньше обычных блоков (между собой - по очереди)
+    // и не вытесняет горячие блоки
+    virtual void inserted(uint32_t slot, uint64_t key, bool low_priority) = 0;
+
+    virtual void accessed(uint32_t slot) = 0;
+
+    // evicted - блок вытеснен и может попасть в историю; иначе файл закрыт
+    // или чтение не удалось, и блок забывается
+    virtual void removed(uint32_t slot, bool evicted) = 0;
+
+    // Перебирает кандидатов в порядке вытеснения, пока filter не ответит
+    // Take или Stop; UINT32_MAX - жертва не выбрана
+    virtual uint32_t victim(VictimFilter &filter) = 0;
+
+protected:
+    ReplacementPolicy(bool tracks_access, bool marks_inserted)
+        : tracks_access(tracks_access), marks_inserted(marks_inserted) {}
+
+private:
+    bool tracks_access;
+    bool marks_inserted;
+};
+
+// capacity - число слотов шарда
+std::unique_ptr<ReplacementPolicy> createReplacementPolicy(ReplacementKind kind, size_t capacity);
+
+#endif //REPLACEMENT_POLICY_H
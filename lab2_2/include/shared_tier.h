@@ -0,0 +1,97 @@
+#ifndef SHARED_TIER_H
+#define SHARED_TIER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <sys/types.h>
+
+// Ключ блока в разделяемом ярусе: файл определяется устройством и номером
+// узла, а не дескриптором, поэтому одинаков во всех процессах
+struct SharedBlockKey {
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t block_number;
+};
+
+// Счетчики разделяемого сегмента, общие для всех подключенных процессов
+struct SharedTierStats {
+    uint64_t blocks;    // Емкость сегмента в блоках
+    uint64_t resident;  // Блоков в сегменте сейчас
+    uint64_t hits;      // Блоков отдано из сегмента
+    uint64_t misses;    // Запрошено и не найдено
+    uint64_t inserts;   // Блоков помещено в сегмент
+    uint64_t evictions; // Блоков вытеснено часами
+    uint32_t attached;  // Процессов подключено сейчас
+};
+
+// Второй уровень кэша в именованной разделяемой памяти (shm_open + mmap):
+// чистые копии блоков, общие для всех процессов, подключенных по одному
+// имени. Сегмент делится на полосы со своей межпроцессной блокировкой,
+// хеш-таблицей с цепочками и стрелкой часов. Блокировки устойчивы к гибели
+// владельца: полоса, брошенная посреди изменения, очищается. Данные в
+// сегменте - копии с диска, поэтому их потеря безопасна. Сегмент живет,
+// пока его не удалят unlink, даже если все процессы отключились.
+class SharedTier {
+public:
+    // Подключается к сегменту name (вида "/name"), создавая его на blocks
+    // блоков, если его нет (при blocks = 0 только подключается). Существующий
+    // сегмент берется с его емкостью. nullptr, если сегмент не создать или
+    // у него другой размер блока.
+    static std::unique_ptr<SharedTier> attach(const char* name, size_t block_size, size_t blocks);
+
+    // Удаляет имя сегмента; подключенные процессы продолжают им пользоваться
+    static bool unlink(const char* name);
+
+    ~SharedTier();
+
+    SharedTier(const SharedTier&) = delete;
+
+    SharedTier& operator=(const SharedTier&) = delete;
+
+    // Копирует блок в out (block_size байт): длина сохраненных данных или -1
+    // при промахе. Хвост за длиной заполняется нулями.
+    ssize_t get(const SharedBlockKey& key, char* out);
+
+    // Кладет length байт блока. replace - заменить уже лежащую копию (запись
+    // на диск); иначе лежащая копия новее прочитанной с диска и остается.
+    void put(const SharedBlockKey& key, const char* data, size_t length, bool replace);
+
+    SharedTierStats stats() const;
+
+    size_t blockSize() const { return block_size; }
+
+private:
+    struct Header;
+    struct Stripe;
+    struct Slot;
+
+    SharedTier(void* base, size_t bytes, size_t block_size);
+
+    Stripe& stripeFor(uint64_t h) const;
+
+    uint32_t* bucketFor(Stripe& stripe, uint64_t h) const;
+
+    uint32_t find(Stripe& stripe, const SharedBlockKey& key, uint64_t h) const;
+
+    uint32_t evict(Stripe& stripe);
+
+    void lock(Stripe& stripe) const;
+
+    void unlock(Stripe& stripe) const;
+
+    void reset(Stripe& stripe) const;
+
+    char* data(uint32_t slot) const { return data_base + static_cast<size_t>(slot) * block_size; }
+
+    void* base;          // Отображение сегмента
+    size_t bytes;        // Длина отображения
+    size_t block_size;   // Размер блока
+    Header* header;
+    Stripe* stripes;
+    uint32_t* buckets;   // Головы цепочек всех полос подряд
+    Slot* slots;
+    char* data_base;     // Данные блоков, выровнены по странице
+};
+
+#endif //SHARED_TIER_H
@@ -0,0 +1,120 @@
+#ifndef STORAGE_BACKEND_H
+#define STORAGE_BACKEND_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <sys/types.h>
+
+#ifdef _WIN32
+#include <windows.h>
+using NativeHandle = HANDLE;
+#define INVALID_NATIVE_HANDLE INVALID_HANDLE_VALUE
+
+// Элемент вектора ввода-вывода, совместимый по полям с POSIX
+struct iovec {
+    void *iov_base;
+    size_t iov_len;
+};
+#else
+#include <sys/uio.h>
+using NativeHandle = int;
+#define INVALID_NATIVE_HANDLE (-1)
+#endif
+
+// Подсказка ядру о доступе к отображению файла
+enum class MapAdvice {
+    Normal,
+    Random,
+    Sequential,
+    WillNeed // Подгрузить заранее
+};
+
+// Элемент пакета submitBatch: векторное чтение или запись участка файла
+struct IoRequest {
+    NativeHandle handle;
+    const struct iovec *iov;
+    int iovcnt;
+    off_t offset;
+    bool write;
+    ssize_t result; // Передано байт или -1, заполняет бэкенд
+};
+
+// Платформенный слой ввода-вывода под NRUCache: позиционные чтение/запись,
+// сброс данных на диск и размер файла. Все смещения абсолютные.
+class StorageBackend {
+public:
+    virtual ~StorageBackend() = default;
+
+    // direct_io - обход системного кэша (O_DIRECT / FILE_FLAG_NO_BUFFERING),
+    // требует выровненных по сектору буферов, смещений и размеров
+    virtual NativeHandle openFile(const char *path, bool direct_io) = 0;
+
+    // Как openFile, но создает файл, если его нет
+    virtual NativeHandle createFile(const char *path, bool direct_io) = 0;
+
+    virtual void closeFile(NativeHandle handle) = 0;
+
+    virtual ssize_t readAt(NativeHandle handle, void *buf, size_t count, off_t offset) = 0;
+
+    virtual ssize_t writeAt(NativeHandle handle, const void *buf, size_t count, off_t offset) = 0;
+
+    // Чтение непрерывного участка файла в несколько буферов одним запросом;
+    // на конце файла возвращает меньше запрошенного
+    virtual ssize_t readvAt(NativeHandle handle, const struct iovec *iov, int iovcnt, off_t offset) = 0;
+
+    // Запись нескольких буферов в непрерывный участок файла одним запросом
+    virtual ssize_t writevAt(NativeHandle handle, const struct iovec *iov, int iovcnt, off_t offset) = 0;
+
+    // Выполняет независимые запросы пакетом и возвращается, когда завершены
+    // все. По умолчанию по очереди; асинхронный бэкенд отдает их устройству
+    // разом, чтобы занять его очередь.
+    virtual void submitBatch(IoRequest *requests, size_t count) {
+        for (size_t i = 0; i < count; ++i) {
+            IoRequest &req = requests[i];
+            req.result = req.write ? writevAt(req.handle, req.iov, req.iovcnt, req.offset)
+                                   : readvAt(req.handle, req.iov, req.iovcnt, req.offset);
+        }
+    }
+
+    virtual int syncFile(NativeHandle handle) = 0;
+
+    virtual off_t fileSize(NativeHandle handle) = 0;
+
+    virtual int resizeFile(NativeHandle handle, off_t size) = 0;
+
+    // Продлевает файл до size байт с выделением места на устройстве, чтобы
+    // запись внутри него не выделяла место и не кончилась ENOSPC
+    virtual int allocateFile(NativeHandle handle, off_t size) = 0;
+
+    // Идентичность файла, одинаковая во всех процессах: устройство (том) и
+    // номер узла. false, если ее не узнать.
+    virtual bool fileId(NativeHandle handle, uint64_t *dev, uint64_t *ino) = 0;
+
+    // Время последнего изменения данных файла в наносекундах, -1 при ошибке.
+    // Годится только для сравнения с ним же, но переживает перезапуск.
+    virtual int64_t modifiedTime(NativeHandle handle) = 0;
+
+    // Разделяемое отображение length байт файла на чтение и запись; nullptr
+    // при ошибке. Обращаться можно только к байтам в пределах размера файла.
+    virtual void *mapFile(NativeHandle handle, size_t length) = 0;
+
+    virtual void unmapFile(void *addr, size_t length) = 0;
+
+    // Синхронная запись измененных страниц отображения на диск
+    virtual int syncMapped(void *addr, size_t length) = 0;
+
+    virtual void adviseMapped(void *addr, size_t length, MapAdvice advice) = 0;
+};
+
+// Бэкенд по умолчанию для текущей платформы; в Linux при сборке с
+// NRU_CACHE_IO_URING - io_uring, если ядро его поддерживает
+std::unique_ptr<StorageBackend> createStorageBackend();
+
+#ifdef NRU_CACHE_IO_URING
+// Пакеты через io_uring, одиночные операции - через fallback.
+// nullptr, если io_uring недоступен (старое ядро, запрет seccomp).
+std::unique_ptr<StorageBackend> createUringBackend(std::unique_ptr<StorageBackend> fallback);
+#endif
+
+#endif //STORAGE_BACKEND_H
@@ -0,0 +1,178 @@
+#ifndef VICTIM_FILE_H
+#define VICTIM_FILE_H
+
+#include "block_arena.h"
+#include "block_index.h"
+#include "storage_backend.h"
+#include <cstddef>
+#include <cstdint>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <sys/types.h>
+
+// Счетчики локального файла-яруса
+struct VictimFileStats {
+    uint64_t slots;    // Емкость файла в блоках
+    uint64_t resident; // Блоков в файле сейчас
+    uint64_t restored; // Найдено в файле при подключении
+    uint64_t hits;     // Блоков отдано вместо чтения из источника
+    uint64_t misses;   // Промахов основного кэша, не найденных и здесь
+    uint64_t spilled;  // Блоков записано в файл
+    uint64_t dropped;  // Не записано: очередь записи была полна
+    uint64_t corrupt;  // Прочитано, но не сошлась контрольная сумма
+    uint64_t read_ns;  // Время чтения отданных блоков, нс
+};
+
+// Ярус под кэшем на быстром локальном устройстве: чистые блоки, вытесненные
+// из памяти, пишутся в заранее выделенный файл и при промахе читаются оттуда
+// в обход системного кэша, а не из медленного источника (сетевой том,
+// удаленное хранилище). Файл - кольцо слотов по блоку: новый блок занимает
+// слот, освобожденный взятым из яруса, а если таких нет - следующий слот
+// кольца, затирая самую давнюю копию. Описатели слотов (ключ блока, время
+// изменения исходного файла, контрольная сумма) лежат в начале файла, так
+// что содержимое переживает перезапуск: индекс восстанавливается при
+// открытии, а копии файла, измененного с тех пор, отбрасываются при его
+// открытии кэшем. Ярус исключающий, как и сжатый: блок, взятый в кэш,
+// покидает ярус. Грязные блоки сюда не попадают, так что файл можно
+// потерять в любой момент. Запись идет фоновым потоком из очереди копий,
+// при полной очереди блок пропускается; копия с несошедшейся контрольной
+// суммой (сбой посреди записи) считается промахом. Файл - одного кэша.
+class VictimFile {
+public:
+    static constexpr size_t queue_limit = 64; // Копий в очереди записи
+
+    // Открывает или создает файл path на bytes байт. Файл с тем же размером
+    // блока и числом слотов берется с содержимым, иначе размечается заново.
+    // nullptr, если файл не создать или в bytes не помещается ни один слот.
+    static std::unique_ptr<VictimFile> open(const char* path, size_t block_size, size_t bytes);
+
+    ~VictimFile();
+
+    VictimFile(const VictimFile&) = delete;
+
+    VictimFile& operator=(const VictimFile&) = delete;
+
+    // Файл (dev, ino) открыт кэшем, время его изменения mtime: копии,
+    // записанные при другом времени, устарели и убираются
+    void validate(uint64_t dev, uint64_t ino, int64_t mtime);
+
+    // Файл закрыт кэшем, все его изменения на диске, и время изменения
+    // теперь mtime: оставшиеся копии верны ему
+    void refresh(uint64_t dev, uint64_t ino, int64_t mtime);
+
+    // Убирает все копии файла
+    void dropFile(uint64_t dev, uint64_t ino);
+
+    // Ставит копию чистого блока в очередь записи, заменяя лежащую
+    void put(uint64_t dev, uint64_t ino, off_t block_number, const char* data);
+
+    // Читает count подряд идущих блоков с first в out[i], выровненные под
+    // небуферизованный ввод-вывод: true, если все они есть и целы. Иначе не
+    // отдается ни один, и найденные тоже убираются.
+    bool take(uint64_t dev, uint64_t ino, off_t first, size_t count, char* const* out);
+
+    void erase(uint64_t dev, uint64_t ino, off_t first, size_t count);
+
+    // Дописывает очередь и описатели и закрывает файл; дальше ярус пуст
+    void close();
+
+    VictimFileStats stats();
+
+private:
+    // Заголовок файла в первом блоке
+    struct Header {
+        char magic[8];
+        uint64_t version;
+        uint64_t block_size;
+        uint64_t slots;
+    };
+
+    // Описатель слота; описатели лежат подряд в блоках за заголовком
+    struct Record {
+        uint64_t dev;
+        uint64_t ino;
+        int64_t block_number;
+        int64_t mtime;       // Время изменения исходного файла, которому верна копия
+        uint64_t checksum;   // Контрольная сумма данных слота
+        uint64_t sequence;   // Номер записи по порядку, 0 - слот пуст
+        uint64_t reserved[2];
+    };
+    static_assert(sizeof(Record) == 64, "описатели должны делить блок без остатка");
+
+    // Копия блока в очереди записи
+    struct Pending {
+        uint64_t dev;
+        uint64_t ino;
+        off_t block_number;
+        uint32_t buffer;     // Блок staging с данными
+        bool cancelled;
+    };
+
+    struct FileState {
+        int tag;             // Номер файла - поле fd ключей индекса
+        int64_t mtime;       // Время изменения, которому верны новые копии
+    };
+
+    VictimFile(std::unique_ptr<StorageBackend> io, NativeHandle handle, size_t block_size, size_t slots);
+
+    bool load();
+
+    int tagOf(uint64_t dev, uint64_t ino);
+
+    void linkSlot(uint32_t slot, int tag);
+
+    void dropSlot(uint32_t slot);
+
+    void removeRange(uint64_t dev, uint64_t ino, off_t first, size_t count);
+
+    void cancelPending(uint64_t dev, uint64_t ino, off_t first, size_t count);
+
+    uint32_t nextSlot(std::unique_lock<std::mutex>& lock);
+
+    void writeRecords(std::unique_lock<std::mutex>& lock);
+
+    void writerLoop();
+
+    off_t slotOffset(uint32_t slot) const {
+        return static_cast<off_t>(1 + record_blocks + slot) * static_cast<off_t>(block_size);
+    }
+
+    std::unique_ptr<StorageBackend> io; // Свой ввод-вывод, мимо медленного источника
+    NativeHandle handle;
+    size_t block_size;
+    size_t slots;
+    size_t record_blocks;        // Блоков под описатели
+    BlockArena meta;             // Заголовок и описатели, выровнены под ввод-вывод
+    Record* records;
+    BlockArena staging;          // Копии в очереди и буфер записи описателей
+    std::mutex mutex;
+    std::condition_variable writer_cv;   // Появилась работа
+    std::condition_variable unpinned;    // Слот отпущен читателем
+    std::unique_ptr<BlockIndex> index;   // (номер файла, номер блока) -> слот
+    std::vector<int> slot_tag;           // Номер файла копии в слоте, -1 - нет в индексе
+    std::vector<uint32_t> slot_prev;     // Соседи в списке слотов того же файла
+    std::vector<uint32_t> slot_next;
+    std::vector<uint32_t> tag_head;      // Голова списка слотов по номеру файла
+    std::vector<uint16_t> pins;          // Читателей слота
+    std::vector<uint8_t> record_dirty;   // Блок описателей изменен в памяти
+    std::vector<uint32_t> free_slots;    // Слоты без копии, занимаются раньше кольца
+    std::map<std::pair<uint64_t, uint64_t>, FileState> files;
+    int next_tag{0};
+    std::deque<Pending> queue;
+    std::vector<uint32_t> free_buffers;
+    Pending current{};           // Копия, которая сейчас пишется
+    bool writing{false};
+    size_t cursor{0};            // Следующий слот кольца
+    uint64_t next_sequence{1};
+    bool stopping{false};
+    bool closed{false};
+    std::thread writer;
+    VictimFileStats counters{};
+};
+
+#endif //VICTIM_FILE_H
@@ -0,0 +1,35 @@
+#ifndef WARM_MANIFEST_H
+#define WARM_MANIFEST_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Экстент рабочего набора: span блоков с block_number
+struct ManifestExtent {
+    uint64_t block_number;
+    uint32_t span;
+    uint32_t referenced; // К экстенту обращались с прошлой проверки вытеснением
+};
+
+// Рабочий набор одного файла. Файл узнается по устройству и узлу, а размер
+// и время изменения показывают, не менялся ли он с записи манифеста.
+struct ManifestFile {
+    uint64_t dev;
+    uint64_t ino;
+    int64_t size;
+    int64_t mtime;
+    std::vector<ManifestExtent> extents; // По возрастанию block_number
+};
+
+// Манифест прогрева - двоичный файл в порядке байт машины: заголовок с
+// размером блока, затем записи файлов с их экстентами (16 байт на экстент).
+// Читается целиком; нет файла - пустой манифест. false - файл поврежден или
+// у него другой размер блока.
+bool readManifest(const char* path, size_t block_size, std::vector<ManifestFile>& files);
+
+// Пишет во временный файл рядом и переименовывает его, так что прерванная
+// запись не портит прежний манифест
+bool writeManifest(const char* path, size_t block_size, const std::vector<ManifestFile>& files);
+
+#endif //WARM_MANIFEST_H
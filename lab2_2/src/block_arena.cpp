@@ -0,0 +1,139 @@
+#include "block_arena.h"
+
+#include <cstdint>
+#include <new>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <cstdio>
+#include <cstring>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+size_t alignUp(size_t value, size_t align) {
+    return (value + align - 1) / align * align;
+}
+
+#ifndef _WIN32
+// Размер большой страницы по умолчанию из /proc/meminfo; 0 - не узнать
+size_t hugePageSize() {
+    static const size_t size = [] {
+        FILE *in = fopen("/proc/meminfo", "r");
+        if (!in) return size_t(0);
+        size_t kb = 0;
+        char line[128];
+        while (fgets(line, sizeof(line), in)) {
+            if (sscanf(line, "Hugepagesize: %zu kB", &kb) == 1) break;
+        }
+        fclose(in);
+        return kb * 1024;
+    }();
+    return size;
+}
+
+// Прозрачные большие страницы не выключены целиком ("[never]")
+bool transparentEnabled() {
+    FILE *in = fopen("/sys/kernel/mm/transparent_hugepage/enabled", "r");
+    if (!in) return false;
+    char line[128] = {};
+    bool enabled = fgets(line, sizeof(line), in) && !strstr(line, "[never]");
+    fclose(in);
+    return enabled;
+}
+#endif
+
+} // namespace
+
+const char *arenaPagesName(ArenaPages pages) {
+    switch (pages) {
+        case ArenaPages::Normal: return "normal";
+        case ArenaPages::Transparent: return "transparent";
+        case ArenaPages::Huge: return "huge";
+    }
+    return "unknown";
+}
+
+BlockArena::BlockArena(size_t block_size, size_t blocks, ArenaPages preferred)
+    : base(nullptr), block_size(block_size), blocks(blocks), bytes(block_size * blocks),
+      page_mode(ArenaPages::Normal) {
+    if (bytes == 0) return;
+#ifdef _WIN32
+    // Большие страницы Windows требуют привилегии SeLockMemoryPrivilege;
+    // без нее VirtualAlloc откажет, и регион берется обычными страницами
+    size_t large = GetLargePageMinimum();
+    if (preferred == ArenaPages::Huge && large && bytes >= large) {
+        size_t length = alignUp(bytes, large);
+        base = static_cast<char *>(VirtualAlloc(nullptr, length, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES,
+                                                PAGE_READWRITE));
+        if (base) {
+            bytes = length;
+            page_mode = ArenaPages::Huge;
+            return;
+        }
+    }
+    base = static_cast<char *>(VirtualAlloc(nullptr, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE));
+    if (!base) throw std::bad_alloc();
+#else
+    size_t huge = hugePageSize();
+    bool large = huge && bytes >= huge; // Меньший регион потерял бы на округлении
+#ifdef MAP_HUGETLB
+    // Страницы пула резервируются сразу: если их не хватает, mmap откажет
+    if (preferred == ArenaPages::Huge && large) {
+        size_t length = alignUp(bytes, huge);
+        void *p = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED) {
+            base = static_cast<char *>(p);
+            bytes = length;
+            page_mode = ArenaPages::Huge;
+            return;
+        }
+    }
+#endif
+#ifdef MADV_HUGEPAGE
+    // Регион выравнивается по большой странице с запасом, который затем
+    // отрезается: иначе крайние блоки остались бы на обычных страницах
+    if (preferred != ArenaPages::Normal && large && transparentEnabled()) {
+        size_t length = alignUp(bytes, huge);
+        void *p = mmap(nullptr, length + huge, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p != MAP_FAILED) {
+            char *raw = static_cast<char *>(p);
+            char *aligned = reinterpret_cast<char *>(alignUp(reinterpret_cast<uintptr_t>(raw), huge));
+            if (aligned > raw) munmap(raw, aligned - raw);
+            munmap(aligned + length, huge - (aligned - raw));
+            base = aligned;
+            bytes = length;
+            if (madvise(base, bytes, MADV_HUGEPAGE) == 0) page_mode = ArenaPages::Transparent;
+            return;
+        }
+    }
+#endif
+    void *p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) throw std::bad_alloc();
+    base = static_cast<char *>(p);
+#endif
+}
+
+void BlockArena::discard(size_t index, size_t count) {
+    if (page_mode == ArenaPages::Huge || count == 0) return;
+#ifdef _WIN32
+    if (block_size % 4096 != 0) return;
+    VirtualAlloc(block(index), block_size * count, MEM_RESET, PAGE_READWRITE);
+#else
+    static const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    if (block_size % page != 0) return;
+    madvise(block(index), block_size * count, MADV_DONTNEED);
+#endif
+}
+
+BlockArena::~BlockArena() {
+    if (!base) return;
+#ifdef _WIN32
+    VirtualFree(base, 0, MEM_RELEASE);
+#else
+    munmap(base, bytes);
+#endif
+}
@@ -0,0 +1,92 @@
+#include "block_index.h"
+
+#include <cstring>
+#include <utility>
+
+BlockIndex::BlockIndex(size_t max_entries) : used(0) {
+    // Заполнение не выше половины: короткие цепочки проб и редкие перестройки
+    size_t groups = 1;
+    while (groups * group_width < 2 * max_entries) groups <<= 1;
+    capacity = groups * group_width;
+    group_mask = groups - 1;
+
+    ctrl_bytes.reset(new uint8_t[capacity]);
+    entries.reset(new Entry[capacity]);
+    spare_ctrl.reset(new uint8_t[capacity]);
+    spare_entries.reset(new Entry[capacity]);
+    clear();
+}
+
+void BlockIndex::clear() {
+    memset(ctrl_bytes.get(), ctrl_empty, capacity);
+    used = 0;
+    growth_left = capacity * 7 / 8;
+}
+
+size_t BlockIndex::findFreeCell(uint64_t h) const {
+    size_t group = (h >> 7) & group_mask;
+    for (size_t probe = 0;; ++probe) {
+        const uint8_t *ctrl = ctrl_bytes.get() + group * group_width;
+        unsigned vacant = matchByte(ctrl, ctrl_empty) | matchByte(ctrl, ctrl_deleted);
+        if (vacant) return group * group_width + countTrailingZeros(vacant);
+        group = (group + probe + 1) & group_mask;
+    }
+}
+
+void BlockIndex::insert(int fd, off_t block_number, uint32_t slot) {
+    if (growth_left == 0) rehash();
+
+    uint64_t h = hash(fd, block_number);
+    size_t i = findFreeCell(h);
+    if (ctrl_bytes[i] == ctrl_empty) --growth_left;
+    ctrl_bytes[i] = static_cast<uint8_t>(h & 0x7F);
+    entries[i] = {static_cast<int64_t>(block_number), fd, slot};
+    ++used;
+}
+
+void BlockIndex::erase(int fd, off_t block_number) {
+    uint64_t h = hash(fd, block_number);
+    uint8_t h2 = static_cast<uint8_t>(h & 0x7F);
+    size_t group = (h >> 7) & group_mask;
+
+    for (size_t probe = 0; probe <= group_mask; ++probe) {
+        uint8_t *ctrl = ctrl_bytes.get() + group * group_width;
+        unsigned match = matchByte(ctrl, h2);
+        while (match) {
+            size_t offset = countTrailingZeros(match);
+            const Entry &e = entries[group * group_width + offset];
+            if (e.block_number == block_number && e.fd == fd) {
+                // Если в группе есть пустая ячейка, ни одна цепочка проб не
+                // проходила через нее дальше, и надгробие не нужно
+                if (matchByte(ctrl, ctrl_empty)) {
+                    ctrl[offset] = ctrl_empty;
+                    ++growth_left;
+                } else {
+                    ctrl[offset] = ctrl_deleted;
+                }
+                --used;
+                return;
+            }
+            match &= match - 1;
+        }
+        if (matchByte(ctrl, ctrl_empty)) return;
+        group = (group + probe + 1) & group_mask;
+    }
+}
+
+// Перекладывает живые ключи в запасной буфер, избавляясь от надгробий
+void BlockIndex::rehash() {
+    std::swap(ctrl_bytes, spare_ctrl);
+    std::swap(entries, spare_entries);
+    clear();
+
+    for (size_t i = 0; i < capacity; ++i) {
+        if (spare_ctrl[i] & 0x80) continue; // Пустая или удаленная
+        const Entry &e = spare_entries[i];
+        size_t j = findFreeCell(hash(e.fd, e.block_number));
+        ctrl_bytes[j] = spare_ctrl[i];
+        entries[j] = e;
+        --growth_left;
+        ++used;
+    }
+}
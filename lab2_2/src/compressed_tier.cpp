@@ -0,0 +1,267 @@
+#include "compressed_tier.h"
+#include "lz_codec.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+namespace {
+
+int64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+} // namespace
+
+CompressedTier::CompressedTier(size_t block_size) : block_size(block_size) {}
+
+CompressedTier::~CompressedTier() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    work_cv.notify_all();
+    if (compressor.joinable()) compressor.join();
+}
+
+void CompressedTier::setBudget(size_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex);
+    while (!queue.empty()) cancelPending(&queue.front());
+    if (compressing) current.cancelled = true;
+    if (bytes > 0 && !compressor.joinable()) {
+        staging.resize(queue_limit * block_size);
+        for (size_t i = queue_limit; i > 0; --i) free_buffers.push_back(static_cast<uint32_t>(i - 1));
+        compressor = std::thread(&CompressedTier::compressLoop, this);
+    }
+    size_t chunks = bytes / chunk_size;
+    size_t max_entries = chunks ? std::max<size_t>(1, bytes / std::max<size_t>(1, block_size / 4)) : 0;
+    pool.assign(chunks * chunk_size, 0);
+    pool.shrink_to_fit();
+    chunk_next.resize(chunks);
+    chunk_next.shrink_to_fit();
+    for (size_t i = 0; i < chunks; ++i)
+        chunk_next[i] = i + 1 < chunks ? static_cast<uint32_t>(i + 1) : BlockIndex::npos;
+    free_chunk = chunks ? 0 : BlockIndex::npos;
+    free_chunks = chunks;
+    entries.resize(max_entries);
+    entries.shrink_to_fit();
+    free_entries.clear();
+    for (size_t i = max_entries; i > 0; --i) free_entries.push_back(static_cast<uint32_t>(i - 1));
+    free_entries.shrink_to_fit();
+    newest = oldest = BlockIndex::npos;
+    file_head.clear();
+    index = max_entries ? std::make_unique<BlockIndex>(max_entries) : nullptr;
+    counters.blocks = 0;
+    counters.stored_bytes = 0;
+    budget_bytes = chunks * chunk_size;
+}
+
+// Снимает описатель с очереди и из индекса, куски - в свободный список
+void CompressedTier::removeEntry(uint32_t e) {
+    Entry &entry = entries[e];
+    if (entry.prev != BlockIndex::npos) entries[entry.prev].next = entry.next;
+    else newest = entry.next;
+    if (entry.next != BlockIndex::npos) entries[entry.next].prev = entry.prev;
+    else oldest = entry.prev;
+    index->erase(entry.fd, entry.block_number);
+    if (entry.file_prev != BlockIndex::npos) entries[entry.file_prev].file_next = entry.file_next;
+    else if (entry.file_next != BlockIndex::npos) file_head[entry.fd] = entry.file_next;
+    else file_head.erase(entry.fd);
+    if (entry.file_next != BlockIndex::npos) entries[entry.file_next].file_prev = entry.file_prev;
+
+    size_t chunks = (entry.length + chunk_size - 1) / chunk_size;
+    uint32_t last = entry.first_chunk;
+    for (size_t i = 1; i < chunks; ++i) last = chunk_next[last];
+    chunk_next[last] = free_chunk;
+    free_chunk = entry.first_chunk;
+    free_chunks += chunks;
+    free_entries.push_back(e);
+    --counters.blocks;
+    counters.stored_bytes -= entry.length;
+}
+
+void CompressedTier::evictOldest() {
+    removeEntry(oldest);
+    ++counters.evicted;
+}
+
+void CompressedTier::put(int fd, off_t block_number, const char *data) {
+    if (budget() == 0) return;
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!index) return;
+    uint32_t old = index->find(fd, block_number);
+    if (old != BlockIndex::npos) removeEntry(old);
+    if (Pending *staged = findPending(fd, block_number)) cancelPending(staged);
+    if (free_buffers.empty()) {
+        ++counters.dropped;
+        return;
+    }
+    uint32_t buffer = free_buffers.back();
+    free_buffers.pop_back();
+    memcpy(staging.data() + static_cast<size_t>(buffer) * block_size, data, block_size);
+    queue.push_back({fd, block_number, buffer, false});
+    work_cv.notify_one();
+}
+
+// Кладет сжатый блок, вытесняя самые давние
+void CompressedTier::insert(int fd, off_t block_number, const char *packed, size_t length) {
+    uint32_t old = index->find(fd, block_number);
+    if (old != BlockIndex::npos) removeEntry(old);
+    size_t chunks = (length + chunk_size - 1) / chunk_size;
+    if (length == 0 || chunks > chunk_next.size()) {
+        ++counters.rejected;
+        return;
+    }
+    while (free_chunks < chunks || free_entries.empty()) evictOldest();
+
+    uint32_t e = free_entries.back();
+    free_entries.pop_back();
+    Entry &entry = entries[e];
+    auto head = file_head.emplace(fd, BlockIndex::npos).first;
+    entry = {fd, block_number, free_chunk, static_cast<uint32_t>(length), BlockIndex::npos, newest,
+             BlockIndex::npos, head->second};
+    if (head->second != BlockIndex::npos) entries[head->second].file_prev = e;
+    head->second = e;
+    uint32_t chunk = free_chunk;
+    for (size_t i = 0, copied = 0; i < chunks; ++i, copied += chunk_size) {
+        memcpy(pool.data() + static_cast<size_t>(chunk) * chunk_size, packed + copied,
+               std::min(chunk_size, length - copied));
+        chunk = free_chunk = chunk_next[chunk];
+    }
+    free_chunks -= chunks;
+    if (newest != BlockIndex::npos) entries[newest].prev = e;
+    else oldest = e;
+    newest = e;
+    index->insert(fd, block_number, e);
+    ++counters.blocks;
+    counters.stored_bytes += length;
+    ++counters.stored;
+}
+
+// Копия блока в очереди или сжимаемая сейчас, если ее не отменили
+CompressedTier::Pending *CompressedTier::findPending(int fd, off_t block_number) {
+    for (Pending &item: queue) {
+        if (item.fd == fd && item.block_number == block_number) return &item;
+    }
+    if (compressing && !current.cancelled && current.fd == fd && current.block_number == block_number)
+        return &current;
+    return nullptr;
+}
+
+// Сжимаемую копию отпускает сам поток сжатия, копию из очереди - сразу
+void CompressedTier::cancelPending(Pending *item) {
+    if (item == &current) {
+        current.cancelled = true;
+        return;
+    }
+    free_buffers.push_back(item->buffer);
+    queue.erase(queue.begin() + (item - queue.data()));
+}
+
+void CompressedTier::compressLoop() {
+    std::vector<char> packed(block_size * 3 / 4);
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+        work_cv.wait(lock, [this] { return stopping || !queue.empty(); });
+        if (stopping) return;
+        current = queue.front();
+        queue.erase(queue.begin());
+        compressing = true;
+
+        // Буфер не отдается, пока он сжимается: take лишь читает его
+        lock.unlock();
+        int64_t started = nowNs();
+        size_t length = lzCompress(staging.data() + static_cast<size_t>(current.buffer) * block_size, block_size,
+                                   packed.data(), packed.size());
+        int64_t elapsed = nowNs() - started;
+        lock.lock();
+
+        compressing = false;
+        counters.compress_ns += elapsed;
+        free_buffers.push_back(current.buffer);
+        if (!current.cancelled && index) insert(current.fd, current.block_number, packed.data(), length);
+    }
+}
+
+bool CompressedTier::take(int fd, off_t first, size_t count, char *const *out) {
+    if (budget() == 0) return false;
+    thread_local std::vector<char> packed;
+    packed.resize(block_size);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!index) return false;
+    bool all = true;
+    for (size_t i = 0; i < count && all; ++i)
+        all = index->find(fd, first + i) != BlockIndex::npos || findPending(fd, first + i);
+    if (!all) {
+        for (size_t i = 0; i < count; ++i) {
+            uint32_t e = index->find(fd, first + i);
+            if (e != BlockIndex::npos) removeEntry(e);
+            if (Pending *staged = findPending(fd, first + i)) cancelPending(staged);
+        }
+        counters.misses += count;
+        return false;
+    }
+
+    // Куски собираются подряд и распаковываются прямо в блоки кэша; еще не
+    // сжатые копии просто копируются
+    bool ok = true;
+    for (size_t i = 0; i < count; ++i) {
+        uint32_t e = index->find(fd, first + i);
+        if (e == BlockIndex::npos) {
+            Pending *staged = findPending(fd, first + i);
+            memcpy(out[i], staging.data() + static_cast<size_t>(staged->buffer) * block_size, block_size);
+            cancelPending(staged);
+            continue;
+        }
+        const Entry &entry = entries[e];
+        uint32_t chunk = entry.first_chunk;
+        for (size_t copied = 0; copied < entry.length; copied += chunk_size) {
+            memcpy(packed.data() + copied, pool.data() + static_cast<size_t>(chunk) * chunk_size,
+                   std::min<size_t>(chunk_size, entry.length - copied));
+            chunk = chunk_next[chunk];
+        }
+        int64_t started = nowNs();
+        ok = lzDecompress(packed.data(), entry.length, out[i], block_size) && ok;
+        counters.decompress_ns += nowNs() - started;
+        removeEntry(e);
+    }
+    if (ok) counters.hits += count;
+    else counters.misses += count;
+    return ok;
+}
+
+void CompressedTier::erase(int fd, off_t block_number) {
+    if (budget() == 0) return;
+    std::lock_guard<std::mutex> lock(mutex);
+    uint32_t e = index ? index->find(fd, block_number) : BlockIndex::npos;
+    if (e != BlockIndex::npos) removeEntry(e);
+    if (Pending *staged = findPending(fd, block_number)) cancelPending(staged);
+}
+
+void CompressedTier::dropFile(int fd) {
+    if (budget() == 0) return;
+    std::lock_guard<std::mutex> lock(mutex);
+    // Только блоки этого fd: removeEntry снимает голову его списка
+    for (auto it = file_head.find(fd); it != file_head.end(); it = file_head.find(fd)) removeEntry(it->second);
+    for (size_t i = queue.size(); i > 0; --i) {
+        if (queue[i - 1].fd == fd) cancelPending(&queue[i - 1]);
+    }
+    if (compressing && current.fd == fd) current.cancelled = true;
+}
+
+void CompressedTier::addStats(CompressedTierStats &out) {
+    std::lock_guard<std::mutex> lock(mutex);
+    out.budget_bytes += budget_bytes;
+    out.blocks += counters.blocks;
+    out.stored_bytes += counters.stored_bytes;
+    out.hits += counters.hits;
+    out.misses += counters.misses;
+    out.stored += counters.stored;
+    out.rejected += counters.rejected;
+    out.dropped += counters.dropped;
+    out.evicted += counters.evicted;
+    out.compress_ns += counters.compress_ns;
+    out.decompress_ns += counters.decompress_ns;
+}
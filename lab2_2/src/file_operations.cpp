@@ -1,27 +1,188 @@
 #include "file_operations.h"
 
-static NRUCache cache(4096, 2048); // Пример: блоки по 4 КБ, 100 блоков в кэше
+#include <atomic>
+#include <memory>
+#include <mutex>
 
-int lab2_open(const char *path) {
-    return cache.openFile(path);
+static constexpr size_t default_block_size = 4096;
+static constexpr size_t default_budget = 8 << 20; // 2048 блоков по 4 КБ
+static constexpr size_t cache_shards = 8;
+
+static std::mutex config_mutex;                 // Защищает instance при создании
+static std::unique_ptr<NRUCache> instance;      // Созданный кэш живет до выхода и не заменяется
+static std::atomic<NRUCache *> current{nullptr}; // instance для вызовов без блокировки
+
+// Кэш с ареной под max_budget байт; большие страницы только прозрачные,
+// чтобы память, отданная при ужатии бюджета, возвращалась системе
+static std::unique_ptr<NRUCache> makeCache(size_t block_size, size_t max_budget) {
+    return std::make_unique<NRUCache>(block_size, max_budget / block_size, true, cache_shards, ReplacementKind::NRU,
+                                      1 << 20, ArenaPages::Transparent);
+}
+
+// Кэш создается при первом обращении, если lab2_configure не вызывался
+static NRUCache &cacheInstance() {
+    NRUCache *cache = current.load(std::memory_order_acquire);
+    if (cache) return *cache;
+    std::lock_guard<std::mutex> lock(config_mutex);
+    if (!instance) {
+        instance = makeCache(default_block_size, default_budget);
+        current.store(instance.get(), std::memory_order_release);
+    }
+    return *instance;
+}
+
+int lab2_configure(size_t budget, size_t block_size, size_t max_budget) {
+    if (max_budget == 0) max_budget = budget;
+    if (block_size == 0 || block_size % 512 != 0 || max_budget < budget ||
+        budget / block_size < cache_shards * NRUCache::min_shard_blocks)
+        return -1;
+    std::lock_guard<std::mutex> lock(config_mutex);
+    // Другие потоки могут уже держать созданный кэш: он не пересоздается
+    if (!instance) {
+        instance = makeCache(block_size, max_budget);
+        current.store(instance.get(), std::memory_order_release);
+    } else if (instance->blockSize() != block_size || instance->maxBudget() < max_budget) {
+        return -1;
+    }
+    return instance->setBudget(budget) ? 0 : -1;
+}
+
+int lab2_set_budget(size_t bytes) {
+    return cacheInstance().setBudget(bytes) ? 0 : -1;
+}
+
+size_t lab2_budget() {
+    return cacheInstance().budget();
+}
+
+int lab2_set_pressure_watch(const char *path, double limit, unsigned interval_ms) {
+    return cacheInstance().setPressureWatch(path, limit, interval_ms) ? 0 : -1;
+}
+
+int lab2_open(const char *path, int flags) {
+    return cacheInstance().openFile(path, flags);
 }
 
 int lab2_close(int fd) {
-    return cache.closeFile(fd);
+    return cacheInstance().closeFile(fd);
 }
 
 ssize_t lab2_read(int fd, void *buf, size_t count) {
-    return cache.readFile(fd, buf, count);
+    return cacheInstance().readFile(fd, buf, count);
 }
 
 ssize_t lab2_write(int fd, const void *buf, size_t count) {
-    return cache.writeFile(fd, buf, count);
+    return cacheInstance().writeFile(fd, buf, count);
+}
+
+ssize_t lab2_pread(int fd, void *buf, size_t count, off_t offset) {
+    return cacheInstance().preadFile(fd, buf, count, offset);
+}
+
+ssize_t lab2_pwrite(int fd, const void *buf, size_t count, off_t offset) {
+    return cacheInstance().pwriteFile(fd, buf, count, offset);
+}
+
+ssize_t lab2_preadv(int fd, const struct iovec *iov, int iovcnt, off_t offset) {
+    return cacheInstance().preadvFile(fd, iov, iovcnt, offset);
+}
+
+ssize_t lab2_pwritev(int fd, const struct iovec *iov, int iovcnt, off_t offset) {
+    return cacheInstance().pwritevFile(fd, iov, iovcnt, offset);
+}
+
+int lab2_read_async(int fd, void *buf, size_t count, off_t offset, uint64_t tag) {
+    return cacheInstance().readAsync(fd, buf, count, offset, tag);
+}
+
+int lab2_poll(CacheCompletion *out, int max, int wait) {
+    return static_cast<int>(cacheInstance().pollCompletions(out, max > 0 ? max : 0, wait != 0));
+}
+
+CacheViewPtr lab2_read_view(int fd, off_t offset, size_t len) {
+    return cacheInstance().readView(fd, offset, len);
+}
+
+CacheViewPtr lab2_write_begin(int fd, off_t offset, size_t len) {
+    return cacheInstance().writeBegin(fd, offset, len);
+}
+
+int lab2_write_commit(const CacheViewPtr &view) {
+    return cacheInstance().writeCommit(view);
 }
 
 off_t lab2_lseek(int fd, off_t offset, int whence) {
-    return cache.seekFile(fd, offset, whence);
+    return cacheInstance().seekFile(fd, offset, whence);
 }
 
 int lab2_fsync(int fd) {
-    return cache.syncFile(fd);
+    return cacheInstance().syncFile(fd);
+}
+
+CacheStats lab2_stats() {
+    return cacheInstance().stats();
+}
+
+void lab2_set_replacement(ReplacementKind kind) {
+    cacheInstance().setReplacement(kind);
+}
+
+int lab2_set_extents(const size_t *sizes, int count) {
+    return count >= 0 && cacheInstance().setExtentSizes(sizes, count) ? 0 : -1;
+}
+
+void lab2_set_scan_bypass(size_t min_bytes) {
+    cacheInstance().setScanBypass(min_bytes);
+}
+
+int lab2_attach_shared(const char *name, size_t bytes) {
+    return cacheInstance().attachShared(name, bytes) ? 0 : -1;
+}
+
+void lab2_detach_shared() {
+    cacheInstance().detachShared();
+}
+
+int lab2_shared_stats(SharedTierStats *out) {
+    return cacheInstance().sharedStats(out) ? 0 : -1;
+}
+
+int lab2_unlink_shared(const char *name) {
+    return SharedTier::unlink(name) ? 0 : -1;
+}
+
+int lab2_set_compressed_tier(double share) {
+    return cacheInstance().setCompressedTier(share) ? 0 : -1;
+}
+
+int lab2_attach_victim(const char *path, size_t bytes) {
+    return cacheInstance().attachVictimFile(path, bytes) ? 0 : -1;
+}
+
+void lab2_detach_victim() {
+    cacheInstance().detachVictimFile();
+}
+
+int lab2_victim_stats(VictimFileStats *out) {
+    return cacheInstance().victimStats(out) ? 0 : -1;
+}
+
+int lab2_set_manifest(const char *path, unsigned interval_ms) {
+    return cacheInstance().setManifest(path, interval_ms) ? 0 : -1;
+}
+
+int lab2_save_manifest() {
+    return cacheInstance().saveManifest() ? 0 : -1;
+}
+
+int lab2_set_numa(size_t nodes) {
+    return cacheInstance().setNuma(nodes) ? 0 : -1;
+}
+
+void lab2_bind_thread(int node) {
+    NRUCache::bindThread(node);
+}
+
+void lab2_stats_dump(unsigned interval_ms) {
+    cacheInstance().setStatsDump(interval_ms);
 }
\ No newline at end of file
@@ -0,0 +1,204 @@
+#include "lz_codec.h"
+#include "bit_ops.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+namespace {
+
+constexpr size_t min_match = 4;       // Короче совпадение не окупает смещение
+constexpr size_t max_offset = 65535;  // Смещение хранится двумя байтами
+constexpr unsigned hash_bits = 12;    // Таблица последних позиций четверок байт
+constexpr size_t wild_copy = 16;      // Копирование с запасом при распаковке
+
+uint32_t read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+uint64_t read64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+uint32_t hashOf(uint32_t sequence) {
+    return (sequence * 2654435761u) >> (32 - hash_bits);
+}
+
+// Сколько первых байт двух восьмерок совпало, diff - их XOR, не ноль
+unsigned sameBytes(uint64_t diff) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return (63 - highestBit64(diff)) >> 3;
+#else
+    return countTrailingZeros64(diff) >> 3;
+#endif
+}
+
+// Продолжение длины, не влезшей в полубайт: байты по 255 и остаток
+bool putLength(uint8_t *&out, const uint8_t *end, size_t length) {
+    for (; length >= 255; length -= 255) {
+        if (out == end) return false;
+        *out++ = 255;
+    }
+    if (out == end) return false;
+    *out++ = static_cast<uint8_t>(length);
+    return true;
+}
+
+bool getLength(const uint8_t *&in, const uint8_t *end, size_t &length) {
+    uint8_t byte;
+    do {
+        if (in == end) return false;
+        byte = *in++;
+        length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+// Последовательность: токен (длины литералов и совпадения по полубайту),
+// литералы, смещение совпадения. match_length = 0 - последняя
+// последовательность, только литералы
+bool putSequence(uint8_t *&out, const uint8_t *end, const uint8_t *literals, size_t literal_length,
+                 size_t offset, size_t match_length) {
+    if (out == end) return false;
+    uint8_t *token = out++;
+    *token = static_cast<uint8_t>(std::min<size_t>(literal_length, 15) << 4);
+    if (literal_length >= 15 && !putLength(out, end, literal_length - 15)) return false;
+    if (static_cast<size_t>(end - out) < literal_length) return false;
+    if (literal_length > 0) memcpy(out, literals, literal_length);
+    out += literal_length;
+    if (match_length == 0) return true;
+
+    if (end - out < 2) return false;
+    *out++ = static_cast<uint8_t>(offset);
+    *out++ = static_cast<uint8_t>(offset >> 8);
+    size_t extra = match_length - min_match;
+    *token |= static_cast<uint8_t>(std::min<size_t>(extra, 15));
+    return extra < 15 || putLength(out, end, extra - 15);
+}
+
+// Позиции в таблице хранятся типом Position: для блоков до 64 КБ - двумя
+// байтами, так что таблица вдвое меньше и быстрее очищается. Пустая ячейка
+// - позиция 0: ложного совпадения она не дает, байты сверяются.
+template <typename Position>
+size_t compress(const uint8_t *src, size_t n, uint8_t *out, const uint8_t *end) {
+    const uint8_t *begin = out;
+    Position table[1u << hash_bits];
+    memset(table, 0, sizeof(table));
+
+    size_t anchor = 0; // Начало еще не записанных литералов
+    size_t pos = 1;
+    size_t misses = 0;
+    while (pos + min_match <= n) {
+        uint32_t sequence = read32(src + pos);
+        Position &slot = table[hashOf(sequence)];
+        size_t candidate = slot;
+        slot = static_cast<Position>(pos);
+        if (pos - candidate > max_offset || read32(src + candidate) != sequence) {
+            pos += 1 + (misses++ >> 5); // Несжимаемые участки пробегаются все быстрее
+            continue;
+        }
+        misses = 0;
+
+        // Совпадение продлевается по 8 байт, конец ищется по XOR
+        size_t length = min_match;
+        for (;;) {
+            if (pos + length + 8 > n) {
+                while (pos + length < n && src[candidate + length] == src[pos + length]) ++length;
+                break;
+            }
+            uint64_t diff = read64(src + candidate + length) ^ read64(src + pos + length);
+            if (diff) {
+                length += sameBytes(diff);
+                break;
+            }
+            length += 8;
+        }
+        // Совпадение продлевается назад за счет еще не записанных литералов
+        while (pos > anchor && candidate > 0 && src[pos - 1] == src[candidate - 1]) {
+            --pos;
+            --candidate;
+            ++length;
+        }
+
+        if (!putSequence(out, end, src + anchor, pos - anchor, pos - candidate, length)) return 0;
+        pos += length;
+        anchor = pos;
+        if (pos + min_match <= n) table[hashOf(read32(src + pos - 2))] = static_cast<Position>(pos - 2);
+    }
+    if (!putSequence(out, end, src + anchor, n - anchor, 0, 0)) return 0;
+    return out - begin;
+}
+
+} // namespace
+
+size_t lzCompress(const char *src_bytes, size_t n, char *dst_bytes, size_t cap) {
+    const uint8_t *src = reinterpret_cast<const uint8_t *>(src_bytes);
+    uint8_t *out = reinterpret_cast<uint8_t *>(dst_bytes);
+    if (n <= UINT16_MAX + size_t(1)) return compress<uint16_t>(src, n, out, out + cap);
+    return compress<uint32_t>(src, n, out, out + cap);
+}
+
+bool lzDecompress(const char *src_bytes, size_t n, char *dst_bytes, size_t size) {
+    const uint8_t *in = reinterpret_cast<const uint8_t *>(src_bytes);
+    const uint8_t *in_end = in + n;
+    uint8_t *base = reinterpret_cast<uint8_t *>(dst_bytes);
+    uint8_t *out = base;
+    uint8_t *out_end = base + size;
+
+    while (in < in_end) {
+        uint8_t token = *in++;
+        size_t literal_length = token >> 4;
+        if (literal_length == 15 && !getLength(in, in_end, literal_length)) return false;
+        if (static_cast<size_t>(in_end - in) < literal_length ||
+            static_cast<size_t>(out_end - out) < literal_length)
+            return false;
+        // Короткие литералы копируются с запасом одним куском постоянной
+        // длины, если обе стороны это позволяют: лишнее перезапишется дальше
+        if (literal_length <= wild_copy && in_end - in >= static_cast<ptrdiff_t>(wild_copy) &&
+            out_end - out >= static_cast<ptrdiff_t>(wild_copy))
+            memcpy(out, in, wild_copy);
+        else if (literal_length > 0)
+            memcpy(out, in, literal_length);
+        in += literal_length;
+        out += literal_length;
+        if (in == in_end) break;
+
+        if (in_end - in < 2) return false;
+        size_t offset = in[0] | static_cast<size_t>(in[1]) << 8;
+        in += 2;
+        size_t match_length = token & 15;
+        if (match_length == 15 && !getLength(in, in_end, match_length)) return false;
+        match_length += min_match;
+        if (offset == 0 || offset > static_cast<size_t>(out - base) ||
+            static_cast<size_t>(out_end - out) < match_length)
+            return false;
+
+        const uint8_t *match = out - offset;
+        uint8_t *stop = out + match_length;
+        if (offset >= wild_copy && match_length <= wild_copy && out_end - out >= static_cast<ptrdiff_t>(wild_copy)) {
+            // Короткое далекое совпадение - одним куском, как литералы
+            memcpy(out, match, wild_copy);
+            out = stop;
+            continue;
+        }
+        if (offset >= 8 && static_cast<size_t>(out_end - out) >= match_length + 8) {
+            // Далекое совпадение - по 8 байт: каждый кусок читает уже записанное
+            for (; out < stop; out += 8, match += 8) memcpy(out, match, 8);
+            out = stop;
+            continue;
+        }
+        // Совпадение может перекрывать само себя (повтор с периодом offset):
+        // копируется кусками, каждый вдвое длиннее уже повторенного
+        while (out < stop) {
+            size_t chunk = std::min<size_t>(stop - out, out - match);
+            memcpy(out, match, chunk);
+            out += chunk;
+        }
+    }
+    return out == out_end;
+}
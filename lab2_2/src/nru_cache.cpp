@@ -1,214 +1,2467 @@
 #include "nru_cache.h"
 
-NRUCache::CacheBlock *NRUCache::findBlock(int fd, off_t block_number) {
-    CacheKey key{fd, block_number};
-    auto it = cache_map.find(key);
-    if (it != cache_map.end()) {
-        it->second->accessed = true;
-        return it->second;
+#include <cerrno>
+#include <utility>
+
+// Выровненный буфер потока для дочитывания блоков под небуферизованный ввод-вывод
+static char *scratchBuffer(size_t block_size) {
+    thread_local std::unique_ptr<BlockArena> scratch;
+    thread_local size_t scratch_size = 0;
+    if (scratch_size != block_size) {
+        scratch = std::make_unique<BlockArena>(block_size, 1);
+        scratch_size = block_size;
+    }
+    return scratch->block(0);
+}
+
+static int64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Сколько раз поток ждал диска по ходу своих операций: по разнице до и
+// после операции она относится к промахам или попаданиям
+static thread_local uint64_t disk_waits = 0;
+
+uint64_t LatencyHistogram::total() const {
+    uint64_t sum = 0;
+    for (uint64_t c: count) sum += c;
+    return sum;
+}
+
+uint64_t LatencyHistogram::percentile(double q) const {
+    uint64_t all = total();
+    if (all == 0) return 0;
+    uint64_t rank = static_cast<uint64_t>(q * (all - 1));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < buckets; ++i) {
+        seen += count[i];
+        if (seen > rank) return (2ull << i) - 1;
+    }
+    return UINT64_MAX;
+}
+
+void NRUCache::LatencyCounters::record(int64_t ns) {
+    size_t bucket = ns > 1 ? highestBit64(static_cast<uint64_t>(ns)) : 0;
+    count[std::min(bucket, LatencyHistogram::buckets - 1)].fetch_add(1, std::memory_order_relaxed);
+}
+
+void NRUCache::LatencyCounters::addTo(LatencyHistogram &out) const {
+    for (size_t i = 0; i < LatencyHistogram::buckets; ++i)
+        out.count[i] += count[i].load(std::memory_order_relaxed);
+}
+
+NRUCache::Shard::Shard(size_t id, size_t block_size, size_t max_blocks, ReplacementKind replacement,
+                       ArenaPages pages)
+    : arena(block_size, max_blocks, pages), blocks(max_blocks), index(max_blocks),
+      policy(createReplacementPolicy(replacement, max_blocks)), id(id), capacity(max_blocks),
+      budget(max_blocks), target(max_blocks), compressed(block_size) {
+    free_slots.reserve(max_blocks);
+    for (size_t i = max_blocks; i > 0; --i) {
+        // Остальные поля - по умолчанию, как у свободного слота
+        blocks[i - 1].data = arena.block(i - 1);
+        blocks[i - 1].head = static_cast<uint32_t>(i - 1);
+        free_slots.push_back(i - 1);
+    }
+}
+
+// Файл узла берет шарды только этого узла, остальные - все шарды
+NRUCache::Shard &NRUCache::shardFor(const FileHandleInternal &file, off_t block_number) {
+    if (shards.size() == 1) return *shards[0];
+    // Старшие биты хеша: младшие уже заняты группой и меткой внутри индекса
+    uint64_t h = BlockIndex::hash(file.id, block_number >> extent_shift) >> 40;
+    if (file.node >= 0) {
+        const std::vector<size_t> &local = node_shards[file.node];
+        return *shards[local[h % local.size()]];
+    }
+    return *shards[h % shards.size()];
+}
+
+// Узел, назначенный потоку bindThread, -1 - по текущему процессору
+static thread_local int bound_node = -1;
+
+int NRUCache::callerNode() const {
+    int node = bound_node >= 0 ? bound_node : currentNumaNode();
+    return node % static_cast<int>(numa_nodes);
+}
+
+void NRUCache::countHits(Shard &shard, uint64_t blocks) {
+    shard.stats.hits += blocks;
+    if (shard.node < 0) return;
+    if (shard.node == callerNode()) shard.stats.local_hits += blocks;
+    else shard.stats.remote_hits += blocks;
+}
+
+NRUCache::OpenPtr NRUCache::lookupOpen(int fd) {
+    std::shared_lock<std::shared_mutex> lock(files_mutex);
+    auto it = open_files.find(fd);
+    return it != open_files.end() ? it->second : nullptr;
+}
+
+NRUCache::FilePtr NRUCache::lookupFile(int fd) {
+    OpenPtr open = lookupOpen(fd);
+    return open ? open->file : nullptr;
+}
+
+// i-й блок экстента с головой head
+NRUCache::CacheBlock *NRUCache::memberOf(Shard &shard, CacheBlock *head, size_t i) {
+    return head->span == 1 ? head : &shard.blocks[head->members[i]];
+}
+
+// Экстент нельзя вытеснить, пока закреплен хотя бы один его блок
+bool NRUCache::unitPinned(Shard &shard, CacheBlock *head) {
+    for (size_t i = 0; i < head->span; ++i) {
+        if (memberOf(shard, head, i)->pins) return true;
+    }
+    return false;
+}
+
+NRUCache::CacheBlock *NRUCache::dirtyMember(Shard &shard, CacheBlock *head) {
+    for (size_t i = 0; i < head->span; ++i) {
+        CacheBlock *block = memberOf(shard, head, i);
+        if (block->dirty) return block;
     }
     return nullptr;
 }
 
-void NRUCache::writeBackBlock(CacheBlock *block)  {
-    if (!block->dirty) return;
+// Слот головы экстента, покрывающего блок. Пробуются только длины, экстенты
+// которых есть в шарде, от больших к меньшим, поэтому поблочный кэш
+// обходится одной пробой индекса.
+uint32_t NRUCache::findUnit(const Shard &shard, int fd, off_t block_number) const {
+    off_t probed = -1;
+    for (uint32_t shifts = shard.extent_shifts; shifts;) {
+        unsigned shift = highestBit(shifts);
+        shifts &= ~(1u << shift);
+        off_t base = block_number & ~((static_cast<off_t>(1) << shift) - 1);
+        if (base == probed) continue;
+        probed = base;
+        uint32_t slot = shard.index.find(fd, base);
+        if (slot != BlockIndex::npos && shard.blocks[slot].span > static_cast<uint64_t>(block_number - base))
+            return slot;
+    }
+    return BlockIndex::npos;
+}
+
+// Блок из кэша без учета обращения; nullptr - его нет
+NRUCache::CacheBlock *NRUCache::lookupBlock(Shard &shard, int fd, off_t block_number) {
+    uint32_t slot = findUnit(shard, fd, block_number);
+    if (slot == BlockIndex::npos) return nullptr;
+    CacheBlock *head = &shard.blocks[slot];
+    return memberOf(shard, head, block_number - head->block_number);
+}
 
-    FileHandleInternal& file = open_files[block->fd];
-    LARGE_INTEGER file_size, new_pos;
-    new_pos.QuadPart = block->block_number * block_size;
+NRUCache::CacheBlock *NRUCache::findBlock(Shard &shard, int fd, off_t block_number) {
+    uint32_t slot = findUnit(shard, fd, block_number);
+    if (slot == BlockIndex::npos) return nullptr;
 
-    if (!SetFilePointerEx(file.hFile, new_pos, nullptr, FILE_BEGIN)) return;
+    CacheBlock *head = &shard.blocks[slot];
+    CacheBlock *block = memberOf(shard, head, block_number - head->block_number);
+    if (head->prefetched) {
+        // Первое чтение упрежденного экстента - то же обращение, что и его
+        // вставка: экстент потока остается первым кандидатом на вытеснение
+        head->prefetched = false;
+        shard.stats.prefetch_hits += head->span;
+        return block;
+    }
+    head->accessed = true;
+    if (shard.policy->tracksAccess()) shard.policy->accessed(slot);
+    return block;
+}
+
+// Нет ли в [base, base + span) головы экстента шарда. Экстенты выровнены по
+// своей длине, поэтому меньший, задевающий участок, в нем и начинается, а
+// больший покрывал бы его целиком и нашелся бы findUnit.
+bool NRUCache::rangeFree(const Shard &shard, int fd, off_t base, size_t span) const {
+    if (!shard.extent_shifts) return true;
+    off_t step = static_cast<off_t>(1) << countTrailingZeros(shard.extent_shifts);
+    for (off_t bn = base; bn < base + static_cast<off_t>(span); bn += step) {
+        if (shard.index.find(fd, bn) != BlockIndex::npos) return false;
+    }
+    return true;
+}
+
+// Длина экстента под промах блока: наибольшая из лестницы, при которой
+// экстент целиком лежит в [lo, hi] и не задевает уже кэшированных; иначе 1
+size_t NRUCache::chooseSpan(const Shard &shard, int fd, off_t block_number, off_t lo, off_t hi) const {
+    for (uint32_t shifts = extent_ladder.load(std::memory_order_relaxed) & ~1u; shifts;) {
+        unsigned shift = highestBit(shifts);
+        shifts &= ~(1u << shift);
+        off_t span = static_cast<off_t>(1) << shift;
+        off_t base = block_number & ~(span - 1);
+        if (base >= lo && base + span - 1 <= hi && rangeFree(shard, fd, base, span)) return span;
+    }
+    return 1;
+}
+
+// Копия блока из разделяемого яруса: длина данных или -1, если яруса нет
+// или блока в нем нет
+ssize_t NRUCache::sharedGet(const FileHandleInternal &file, off_t block_number, char *out) {
+    SharedTier *tier = shared_tier.load(std::memory_order_acquire);
+    if (!tier || !file.shareable) return -1;
+    ssize_t got = tier->get({file.dev, file.ino, static_cast<uint64_t>(block_number)}, out);
+    if (got >= 0) ++shared_hits;
+    return got;
+}
+
+// Кладет в разделяемый ярус прочитанный (replace = false) или записанный на
+// диск (replace = true) блок
+void NRUCache::sharedPut(const FileHandleInternal &file, off_t block_number, const char *data, ssize_t length,
+                         bool replace) {
+    SharedTier *tier = shared_tier.load(std::memory_order_acquire);
+    if (!tier || !file.shareable || length <= 0) return;
+    tier->put({file.dev, file.ino, static_cast<uint64_t>(block_number)}, data, length, replace);
+}
+
+// Читает блоки [first, first + count) из локального файла-яруса: true, если
+// все нашлись. Найденные копии уходят из яруса в любом случае.
+bool NRUCache::victimTake(const FileHandleInternal &file, off_t first, size_t count, char *const *out) {
+    VictimFile *victim = victim_file.load(std::memory_order_acquire);
+    return victim && file.shareable && victim->take(file.dev, file.ino, first, count, out);
+}
+
+// Блоки пришли в кэш другим путем - их копии в файле-ярусе больше не нужны
+void NRUCache::victimErase(const FileHandleInternal &file, off_t first, size_t count) {
+    VictimFile *victim = victim_file.load(std::memory_order_acquire);
+    if (victim && file.shareable) victim->erase(file.dev, file.ino, first, count);
+}
 
-    DWORD written;
-    WriteFile(file.hFile, block->data.data(), block_size, &written, nullptr);
+// Пишет блок на диск без блокировки шарда. На время записи блок закреплен и
+// помечен writeback; изменение во время записи снова делает его грязным.
+bool NRUCache::writeBackBlock(Shard &shard, ShardLock &lock, CacheBlock *block)  {
+    if (!block->dirty) return true;
+    // Недописанные части сначала дочитываются, чтобы не затереть диск мусором
+    if (block->valid != valid_full && !fillBlock(shard, lock, block)) return false;
+    if (!block->dirty) return true;
+
+    beginWriteback(shard, block);
+    NativeHandle handle = block->file->handle;
+    off_t pos = block->block_number * block_size;
+
+    lock.unlock();
+    bool ok = backend->writeAt(handle, block->data, block_size, pos) == static_cast<ssize_t>(block_size);
+    if (ok) sharedPut(*block->file, block->block_number, block->data, block->file->size - pos, true);
+    lock.lock();
+
+    if (ok) shard.stats.bytes_written += block_size;
+    endWriteback(shard, block, ok);
+    return ok;
+}
+
+// Вставка блока в голову интрузивного списка, связанного полями prev/next
+void NRUCache::linkBlock(Shard &shard, uint32_t &head, CacheBlock *block,
+                         uint32_t CacheBlock::*prev, uint32_t CacheBlock::*next) {
+    uint32_t slot = static_cast<uint32_t>(block - shard.blocks.data());
+    block->*prev = BlockIndex::npos;
+    block->*next = head;
+    if (head != BlockIndex::npos) shard.blocks[head].*prev = slot;
+    head = slot;
+}
+
+void NRUCache::unlinkBlock(Shard &shard, uint32_t &head, CacheBlock *block,
+                           uint32_t CacheBlock::*prev, uint32_t CacheBlock::*next) {
+    if (block->*prev != BlockIndex::npos) shard.blocks[block->*prev].*next = block->*next;
+    else head = block->*next;
+    if (block->*next != BlockIndex::npos) shard.blocks[block->*next].*prev = block->*prev;
+    block->*prev = block->*next = BlockIndex::npos;
+}
+
+void NRUCache::markDirty(Shard &shard, CacheBlock *block) {
+    if (block->dirty) return;
+    block->dirty = true;
+    block->dirty_since = nowNs();
+    linkBlock(shard, block->file->shard_blocks[shard.id].dirty, block,
+              &CacheBlock::dirty_prev, &CacheBlock::dirty_next);
+    // В очередь шарда - в хвост, так что она упорядочена по dirty_since
+    uint32_t slot = static_cast<uint32_t>(block - shard.blocks.data());
+    block->age_prev = shard.dirty_newest;
+    block->age_next = BlockIndex::npos;
+    if (shard.dirty_newest != BlockIndex::npos) shard.blocks[shard.dirty_newest].age_next = slot;
+    else shard.dirty_oldest = slot;
+    shard.dirty_newest = slot;
+    if (++dirty_blocks > dirty_high_ratio * budget_blocks) flusher_cv.notify_one();
+}
+
+void NRUCache::markClean(Shard &shard, CacheBlock *block) {
+    if (!block->dirty) return;
     block->dirty = false;
+    unlinkBlock(shard, block->file->shard_blocks[shard.id].dirty, block,
+                &CacheBlock::dirty_prev, &CacheBlock::dirty_next);
+    if (block->age_prev != BlockIndex::npos) shard.blocks[block->age_prev].age_next = block->age_next;
+    else shard.dirty_oldest = block->age_next;
+    if (block->age_next != BlockIndex::npos) shard.blocks[block->age_next].age_prev = block->age_prev;
+    else shard.dirty_newest = block->age_prev;
+    --dirty_blocks;
 }
 
-void NRUCache::evictBlock() {
-    std::vector<CacheBlock*> classes[4];
+// Блок уходит на запись: он чист, закреплен и помечен writeback, так что
+// изменение во время записи снова делает его грязным
+void NRUCache::beginWriteback(Shard &shard, CacheBlock *block) {
+    markClean(shard, block);
+    block->writeback = true;
+    ++block->pins;
+    ++block->file->shard_blocks[shard.id].writeback;
+}
+
+void NRUCache::endWriteback(Shard &shard, CacheBlock *block, bool ok) {
+    block->writeback = false;
+    --block->pins;
+    --block->file->shard_blocks[shard.id].writeback;
+    if (!ok) markDirty(shard, block);
+    shard.unpinned.notify_all();
+}
 
-    for (auto& pair : cache_map) {
-        CacheBlock* block = pair.second;
-        int cls = 0;
-        if (!block->accessed && !block->dirty) cls = 0;
-        else if (!block->accessed && block->dirty) cls = 1;
-        else if (block->accessed && !block->dirty) cls = 2;
-        else cls = 3;
-        classes[cls].push_back(block);
+// Убирает экстент с головой block целиком; слоты освобождаются в обратном
+// порядке, чтобы следующий экстент снова занял их по возрастанию. Чистые
+// достоверные блоки вытесненного экстента копируются в очереди сжатого
+// яруса и файла-яруса, кроме так и не затребованных упреждением и блоков
+// закрываемого файла; сжимают и пишут их фоновые потоки, не под блокировкой.
+void NRUCache::removeBlock(Shard &shard, CacheBlock *block, bool evicted) {
+    bool keep = evicted && !block->prefetched && !block->file->closed;
+    bool stash = keep && shard.compressed.budget() > 0;
+    VictimFile *victim = keep && block->file->shareable ? victim_file.load(std::memory_order_acquire) : nullptr;
+    shard.policy->removed(static_cast<uint32_t>(block - shard.blocks.data()), evicted);
+    unlinkBlock(shard, block->file->shard_blocks[shard.id].resident, block,
+                &CacheBlock::file_prev, &CacheBlock::file_next);
+    shard.index.erase(block->fd, block->block_number);
+    unsigned shift = countTrailingZeros(block->span);
+    if (--shard.extent_count[shift] == 0) shard.extent_shifts &= ~(1u << shift);
+    for (size_t i = block->span; i > 0; --i) {
+        CacheBlock *member = memberOf(shard, block, i - 1);
+        if (!member->dirty && member->valid == valid_full) {
+            if (stash) shard.compressed.put(member->fd, member->block_number, member->data);
+            if (victim) victim->put(member->file->dev, member->file->ino, member->block_number, member->data);
+        }
+        markClean(shard, member);
+        member->in_use = false;
+        member->file = nullptr;
+        shard.free_slots.push_back(member - shard.blocks.data());
+    }
+}
+
+bool NRUCache::VictimScan::referenced(uint32_t slot) {
+    CacheBlock &block = shard.blocks[slot];
+    if (unitPinned(shard, &block)) return true;
+    bool was = block.accessed;
+    if (was) block.cleared_scan = scan;
+    block.accessed = false;
+    return was;
+}
+
+bool NRUCache::VictimScan::pinned(uint32_t slot) {
+    return unitPinned(shard, &shard.blocks[slot]);
+}
+
+bool NRUCache::VictimScan::loading(uint32_t slot) {
+    return shard.blocks[slot].loading;
+}
+
+VictimCheck NRUCache::VictimScan::check(uint32_t slot) {
+    CacheBlock &block = shard.blocks[slot];
+    if (unitPinned(shard, &block)) return VictimCheck::Skip;
+    bool dirty = dirtyMember(shard, &block) != nullptr;
+    bool accessed = block.accessed || block.cleared_scan == scan;
+    size_t cls = 2 * accessed + dirty;
+    block.accessed = false;
+    if (!dirty) {
+        victim_class = cls;
+        return VictimCheck::Take;
+    }
+    if (!dirty_victim) {
+        dirty_victim = &block;
+        dirty_class = cls;
     }
+    return ++dirty_seen >= dirty_scan_limit ? VictimCheck::Stop : VictimCheck::Skip;
+}
+
+// Жертву выбирает политика шарда, а кэш отвечает ей о кандидатах с учетом
+// грязности: вытесняется первый чистый незакрепленный, а грязный - только
+// если за dirty_scan_limit грязных кандидатов чистого не нашлось.
+// false - вытеснять нечего; *write_failed - потому, что не удалось записать
+// грязные экстенты.
+bool NRUCache::evictBlock(Shard &shard, ShardLock &lock, bool *write_failed) {
+    // Экстенты, которые не удалось записать, остаются грязными в кэше и
+    // закреплены до конца вытеснения, чтобы поиск выбрал другую жертву
+    std::vector<CacheBlock *> failed;
+    bool progress = false;
+    while (!progress && failed.size() < dirty_scan_limit) {
+        VictimScan scan(shard);
+        uint32_t slot = shard.policy->victim(scan);
+        if (slot != BlockIndex::npos) {
+            CacheBlock *block = &shard.blocks[slot];
+            if (block->prefetched) {
+                shard.stats.prefetch_wasted += block->span;
+                ++block->file->wasted;
+            }
+            ++shard.stats.evictions[scan.victim_class];
+            removeBlock(shard, block, true);
+            progress = true;
+            continue;
+        }
 
-    for (int i = 0; i < 4; ++i) {
-        if (!classes[i].empty()) {
-            CacheBlock* block = classes[i].front();
-            writeBackBlock(block);
-            cache_map.erase({block->fd, block->block_number});
-            delete block;
-            return;
+        CacheBlock *dirty_victim = scan.dirty_victim;
+        if (!dirty_victim) break;
+
+        // Фоновый сброс не успел: пишем грязные блоки экстента синхронно и
+        // подгоняем его. Пока шард разблокирован, экстент закреплен и не может
+        // быть вытеснен другим потоком.
+        ++shard.stats.evict_writebacks;
+        ++disk_waits;
+        flusher_cv.notify_one();
+        bool written = true;
+        ++dirty_victim->pins;
+        for (size_t i = 0; i < dirty_victim->span && written; ++i)
+            written = writeBackBlock(shard, lock, memberOf(shard, dirty_victim, i));
+        if (!written) {
+            failed.push_back(dirty_victim);
+            continue;
+        }
+        --dirty_victim->pins;
+        shard.unpinned.notify_all();
+        if (!unitPinned(shard, dirty_victim) && !dirtyMember(shard, dirty_victim) && !dirty_victim->accessed) {
+            ++shard.stats.evictions[scan.dirty_class];
+            removeBlock(shard, dirty_victim, true);
         }
+        progress = true;
     }
+    for (CacheBlock *block: failed) --block->pins;
+    if (!failed.empty()) shard.unpinned.notify_all();
+    if (write_failed) *write_failed = !progress && !failed.empty();
+    return progress;
 }
 
-NRUCache::CacheBlock * NRUCache::loadBlock(int fd, off_t block_number) {
-    while (cache_map.size() >= max_blocks)
-        evictBlock();
+// Занимает span свободных слотов под экстент с block_number и публикует его
+// голову в индексе. Блоки под чтение (Read, Scan, Prefetch) возвращаются
+// закрепленными и помеченными loading; Zero и Overwrite - только для span 1.
+NRUCache::CacheBlock *NRUCache::claimBlock(Shard &shard, FileHandleInternal &file, int fd, off_t block_number,
+                                           LoadMode mode, size_t span) {
+    bool load = mode != LoadMode::Zero && mode != LoadMode::Overwrite;
+    uint32_t head_slot = static_cast<uint32_t>(shard.free_slots.back());
+    CacheBlock *head = &shard.blocks[head_slot];
+    head->members.clear();
+    for (size_t i = 0; i < span; ++i) {
+        size_t slot = shard.free_slots.back();
+        shard.free_slots.pop_back();
+
+        CacheBlock *block = &shard.blocks[slot];
+        block->file = &file;
+        block->fd = fd;
+        block->block_number = block_number + i;
+        block->pins = load;
+        block->in_use = true;
+        block->loading = load;
+        block->writeback = false;
+        block->accessed = false;
+        block->dirty = false;
+        block->prefetched = false;
+        block->valid = valid_full;
+        block->head = head_slot;
+        if (span > 1) head->members.push_back(static_cast<uint32_t>(slot));
+    }
+
+    // Экстенты потоков вставляются с низким приоритетом и без бита обращения,
+    // чтобы сканирование не вытесняло горячие блоки
+    bool low_priority = mode == LoadMode::Prefetch || mode == LoadMode::Scan;
+    head->span = static_cast<uint32_t>(span);
+    head->accessed = !low_priority && shard.policy->marksInserted();
+    head->prefetched = mode == LoadMode::Prefetch;
+    shard.index.insert(fd, block_number, head_slot);
+    shard.policy->inserted(head_slot, BlockIndex::hash(fd, block_number), low_priority);
+    if (low_priority) shard.stats.scan_inserts += span;
+    unsigned shift = countTrailingZeros(head->span);
+    if (shard.extent_count[shift]++ == 0) shard.extent_shifts |= 1u << shift;
+    linkBlock(shard, file.shard_blocks[shard.id].resident, head, &CacheBlock::file_prev, &CacheBlock::file_next);
 
-    FileHandleInternal& file = open_files[fd];
-    LARGE_INTEGER pos;
-    pos.QuadPart = block_number * block_size;
-    SetFilePointerEx(file.hFile, pos, nullptr, FILE_BEGIN);
+    if (!load) {
+        // Копии в ярусах устарели бы после записи
+        shard.compressed.erase(fd, block_number);
+        victimErase(file, block_number, 1);
+        ++shard.stats.reads_avoided;
+        if (mode == LoadMode::Zero) memset(head->data, 0, block_size);
+        else head->valid = 0;
+        return head;
+    }
 
-    CacheBlock* block = new CacheBlock(fd, block_number, block_size);
-    DWORD read = 0;
-    ReadFile(file.hFile, block->data.data(), block_size, &read, NULL);
+    if (mode == LoadMode::Prefetch) shard.stats.prefetch_issued += span;
+    else if (mode == LoadMode::Warm) shard.stats.warm_blocks += span;
+    else shard.stats.misses += span;
+    if (span > 1) ++shard.stats.extent_loads;
+    return head;
+}
 
-    if (read < block_size)
-        memset(block->data.data() + read, 0, block_size - read);
+// Заводит блок и читает его уже без блокировки шарда: из сжатого яруса,
+// разделяемого, файла-яруса или с диска. В режимах Zero и Overwrite чтения
+// нет, и блокировка не отпускается.
+NRUCache::CacheBlock * NRUCache::loadBlock(Shard &shard, ShardLock &lock, FileHandleInternal &file, int fd,
+                                           off_t block_number, LoadMode mode) {
+    CacheBlock *block = claimBlock(shard, file, fd, block_number, mode);
+    if (!block->loading) return block;
 
-    cache_map[{fd, block_number}] = block;
+    ++disk_waits;
+    lock.unlock();
+    ssize_t read = shard.compressed.take(fd, block_number, 1, &block->data)
+                   ? static_cast<ssize_t>(block_size) : sharedGet(file, block_number, block->data);
+    if (read >= 0) victimErase(file, block_number, 1);
+    else if (victimTake(file, block_number, 1, &block->data)) read = block_size;
+    bool from_disk = read < 0;
+    if (from_disk) {
+        ++read_requests;
+        read = backend->readAt(file.handle, block->data, block_size, block_number * block_size);
+        if (read >= 0 && static_cast<size_t>(read) < block_size)
+            memset(block->data + read, 0, block_size - read);
+        sharedPut(file, block_number, block->data, read, false);
+    }
+    lock.lock();
+
+    if (read > 0 && from_disk) shard.stats.bytes_read += read;
+    block->loading = false;
+    --block->pins;
+    shard.unpinned.notify_all();
+
+    if (read < 0) {
+        removeBlock(shard, block);
+        return nullptr;
+    }
     return block;
 }
 
-NRUCache::NRUCache(size_t block_size, size_t max_blocks)
-    : block_size(block_size), max_blocks(max_blocks), next_fd(1) {
+// Резервирует экстент под чтение блока, никого не дожидаясь: nullptr, если
+// блок уже в кэше, файл закрывается или слот освобождается только ожиданием.
+// Длина экстента выбирается chooseSpan в пределах [lo, hi]; если места под
+// него не вытеснить, берется один блок. Вытеснение отпускает блокировку,
+// поэтому условия и выбор проверяются в цикле.
+NRUCache::CacheBlock *NRUCache::reserveBlock(Shard &shard, ShardLock &lock, FileHandleInternal &file, int fd,
+                                             off_t block_number, LoadMode mode, off_t lo, off_t hi) {
+    for (;;) {
+        if (file.closed || findUnit(shard, fd, block_number) != BlockIndex::npos) return nullptr;
+        size_t span = chooseSpan(shard, fd, block_number, lo, hi);
+        if (shard.free_slots.size() >= span)
+            return claimBlock(shard, file, fd, block_number & ~static_cast<off_t>(span - 1), mode, span);
+        if (!evictBlock(shard, lock)) {
+            if (shard.free_slots.empty()) return nullptr;
+            lo = hi = block_number;
+        }
+    }
 }
 
+// Читает зарезервированные экстенты пакета без блокировок: подряд идущие -
+// одним векторным запросом, все запросы - одним вызовом submitBatch. Блоки,
+// соседние и в файле, и в арене, читаются в один буфер. Экстенты, целиком
+// найденные в сжатом, разделяемом ярусе или файле-ярусе, с диска не
+// читаются, прочитанные - кладутся в разделяемый. Пока блоки еще
+// закреплены, их часть диапазона [start, end) копируется в out.
+bool NRUCache::readBatch(FileHandleInternal &file, ReadBatch &batch, IovCursor *out, off_t start, off_t end) {
+    thread_local std::vector<struct iovec> iov;
+    IoRequest requests[read_batch_limit];
+    size_t request_of[read_batch_limit];
+    size_t request_count = 0;
+    size_t blocks = 0;
+    for (size_t i = 0; i < batch.count; ++i) blocks += batch.blocks[i]->span;
+    iov.resize(blocks);
 
-NRUCache::~NRUCache() {
-    for (auto &pair: cache_map) {
-        writeBackBlock(pair.second);
-        delete pair.second;
+    size_t used = 0;
+    const CacheBlock *prev = nullptr;
+    thread_local std::vector<char *> members;
+    for (size_t i = 0; i < batch.count; ++i) {
+        CacheBlock *head = batch.blocks[i];
+        members.resize(head->span);
+        for (size_t j = 0; j < head->span; ++j) members[j] = memberOf(*batch.shards[i], head, j)->data;
+        if (batch.shards[i]->compressed.take(head->fd, head->block_number, head->span, members.data())) {
+            victimErase(file, head->block_number, head->span);
+            request_of[i] = SIZE_MAX;
+            continue;
+        }
+        size_t shared = 0;
+        while (shared < head->span &&
+               sharedGet(file, head->block_number + shared, memberOf(*batch.shards[i], head, shared)->data) >= 0)
+            ++shared;
+        if (shared == head->span) {
+            victimErase(file, head->block_number, head->span);
+            request_of[i] = SIZE_MAX;
+            continue;
+        }
+        shared_hits -= shared; // Экстент все равно читается целиком
+        if (victimTake(file, head->block_number, head->span, members.data())) {
+            request_of[i] = SIZE_MAX;
+            continue;
+        }
+
+        off_t bn = head->block_number;
+        if (!prev || bn != prev->block_number + static_cast<off_t>(prev->span) ||
+            requests[request_count - 1].iovcnt + head->span > read_iov_limit) {
+            requests[request_count++] = {file.handle, &iov[used], 0, bn * static_cast<off_t>(block_size), false, 0};
+        }
+        IoRequest &req = requests[request_count - 1];
+        for (size_t j = 0; j < head->span; ++j) {
+            char *data = memberOf(*batch.shards[i], head, j)->data;
+            if (req.iovcnt > 0 && static_cast<char *>(iov[used - 1].iov_base) + iov[used - 1].iov_len == data) {
+                iov[used - 1].iov_len += block_size;
+            } else {
+                iov[used++] = {data, block_size};
+                ++req.iovcnt;
+            }
+        }
+        request_of[i] = request_count - 1;
+        prev = head;
+    }
+    if (request_count > 0) {
+        if (out) ++disk_waits;
+        read_requests += request_count;
+        backend->submitBatch(requests, request_count);
+    }
+
+    bool ok = true;
+    for (size_t i = 0; i < batch.count; ++i) {
+        CacheBlock *head = batch.blocks[i];
+        Shard &shard = *batch.shards[i];
+        const IoRequest *req = request_of[i] != SIZE_MAX ? &requests[request_of[i]] : nullptr;
+        bool read_ok = !req || req->result >= 0;
+        off_t unit_bytes = 0;
+        for (size_t j = 0; req && read_ok && j < head->span; ++j) {
+            CacheBlock *block = memberOf(shard, head, j);
+            off_t block_start = block->block_number * block_size;
+            off_t got = std::min<off_t>(std::max<off_t>(req->offset + req->result - block_start, 0), block_size);
+            if (static_cast<size_t>(got) < block_size) memset(block->data + got, 0, block_size - got);
+            sharedPut(file, block->block_number, block->data, got, false);
+            unit_bytes += got;
+        }
+
+        ShardLock lock(shard.mutex);
+        shard.stats.bytes_read += unit_bytes;
+        for (size_t j = 0; j < head->span; ++j) {
+            CacheBlock *block = memberOf(shard, head, j);
+            off_t block_start = block->block_number * block_size;
+            block->loading = false;
+            --block->pins;
+            if (read_ok && out) {
+                off_t copy_start = std::max(start, block_start);
+                off_t copy_end = std::min(end, static_cast<off_t>(block_start + block_size));
+                if (copy_start >= copy_end) continue;
+                out->seek(copy_start - start);
+                out->copyOut(block->data + (copy_start - block_start), copy_end - copy_start);
+            }
+        }
+        shard.unpinned.notify_all();
+        if (!read_ok) {
+            removeBlock(shard, head);
+            ok = false;
+        }
     }
-    for (auto &pair: open_files)
-        CloseHandle(pair.second.hFile);
+    batch.count = 0;
+    return ok;
 }
 
+// Возвращает блок при удерживаемой блокировке шарда. Промах записи и
+// промах за концом файла обходятся без чтения с диска: недостоверные
+// части блока дочитываются, только если их прочтут или сбросят на диск.
+// miss_mode - как заводить блок при промахе: Read, Scan или Overwrite.
+NRUCache::CacheBlock *NRUCache::acquireBlock(Shard &shard, ShardLock &lock, FileHandleInternal &file, int fd,
+                                             off_t block_number, LoadMode miss_mode) {
+    bool for_write = miss_mode == LoadMode::Overwrite;
+    for (;;) {
+        CacheBlock *block = findBlock(shard, fd, block_number);
+        if (block) {
+            if (block->loading || (for_write && block->writeback)) {
+                ++disk_waits;
+                shard.unpinned.wait(lock);
+                continue;
+            }
+            countHits(shard, 1);
+            return block;
+        }
+        if (file.closed) return nullptr;
+        if (shard.free_slots.empty()) {
+            // Вытеснение могло отпустить блокировку - ключ проверяется заново.
+            // Если место держат грязные блоки, которые не записать, операция
+            // завершается ошибкой, а не ждет без конца.
+            bool write_failed = false;
+            if (!evictBlock(shard, lock, &write_failed)) {
+                if (write_failed) {
+                    errno = EIO;
+                    return nullptr;
+                }
+                shard.unpinned.wait(lock);
+            }
+            continue;
+        }
 
-int NRUCache::openFile(const char *path) {
-    HANDLE hFile = CreateFileA(
-        path,
-        GENERIC_READ | GENERIC_WRITE,
-        FILE_SHARE_READ | FILE_SHARE_WRITE,
-        nullptr,
-        OPEN_EXISTING,
-        FILE_FLAG_NO_BUFFERING,
-        nullptr
-    );
-    if (hFile == INVALID_HANDLE_VALUE) return -1;
+        LoadMode mode = miss_mode;
+        if (block_number * static_cast<off_t>(block_size) >= file.size) mode = LoadMode::Zero;
+        return loadBlock(shard, lock, file, fd, block_number, mode);
+    }
+}
 
-    int fd = next_fd++;
-    open_files[fd] = {hFile, path, 0};
-    return fd;
+// Биты маски valid, которые задевает диапазон [offset, offset + bytes) блока
+uint64_t NRUCache::validMask(size_t offset, size_t bytes) const {
+    size_t first = offset / valid_unit;
+    size_t count = (offset + bytes - 1) / valid_unit - first + 1;
+    uint64_t bits = count >= 64 ? ~0ull : (1ull << count) - 1;
+    return bits << first;
 }
 
+// Дочитывает с диска недостоверные части блока, не трогая записанные.
+// Пока шард разблокирован, блок помечен loading, и остальные его ждут.
+bool NRUCache::fillBlock(Shard &shard, ShardLock &lock, CacheBlock *block) {
+    ++block->pins;
+    block->loading = true;
+    ++shard.stats.fill_reads;
+    ++disk_waits;
+    const FileHandleInternal &file = *block->file;
+    off_t pos = block->block_number * block_size;
 
-int NRUCache::closeFile(int fd) {
-    auto it = open_files.find(fd);
-    if (it == open_files.end()) return -1;
+    lock.unlock();
+    char *scratch = scratchBuffer(block_size);
+    ssize_t read = sharedGet(file, block->block_number, scratch);
+    bool from_disk = read < 0;
+    if (from_disk) {
+        ++read_requests;
+        read = backend->readAt(file.handle, scratch, block_size, pos);
+        if (read >= 0 && static_cast<size_t>(read) < block_size)
+            memset(scratch + read, 0, block_size - read);
+        sharedPut(file, block->block_number, scratch, read, false);
+    }
+    lock.lock();
 
-    syncFile(fd);
-    CloseHandle(it->second.hFile);
+    if (read > 0 && from_disk) shard.stats.bytes_read += read;
+    if (read >= 0) {
+        for (size_t unit = 0; unit * valid_unit < block_size; ++unit) {
+            if (block->valid & (1ull << unit)) continue;
+            size_t offset = unit * valid_unit;
+            memcpy(block->data + offset, scratch + offset, std::min(valid_unit, block_size - offset));
+        }
+        block->valid = valid_full;
+    }
+    block->loading = false;
+    --block->pins;
+    shard.unpinned.notify_all();
+    return read >= 0;
+}
 
-    for (auto cit = cache_map.begin(); cit != cache_map.end();) {
-        if (cit->first.fd == fd) {
-            delete cit->second;
-            cit = cache_map.erase(cit);
-        } else ++cit;
+void NRUCache::IovCursor::seek(size_t pos) {
+    index = 0;
+    while (index < iovcnt && pos >= iov[index].iov_len) {
+        pos -= iov[index].iov_len;
+        ++index;
     }
+    offset = pos;
+}
 
-    open_files.erase(it);
-    return 0;
+void NRUCache::IovCursor::copyIn(char *dest, size_t bytes) {
+    while (bytes > 0) {
+        size_t part = std::min(bytes, iov[index].iov_len - offset);
+        memcpy(dest, static_cast<const char *>(iov[index].iov_base) + offset, part);
+        dest += part;
+        bytes -= part;
+        offset += part;
+        if (offset == iov[index].iov_len) {
+            ++index;
+            offset = 0;
+        }
+    }
+}
+
+void NRUCache::IovCursor::copyOut(const char *src, size_t bytes) {
+    while (bytes > 0) {
+        size_t part = std::min(bytes, iov[index].iov_len - offset);
+        memcpy(static_cast<char *>(iov[index].iov_base) + offset, src, part);
+        src += part;
+        bytes -= part;
+        offset += part;
+        if (offset == iov[index].iov_len) {
+            ++index;
+            offset = 0;
+        }
+    }
 }
 
+void NRUCache::IovCursor::slice(size_t bytes, std::vector<struct iovec> &out) {
+    while (bytes > 0) {
+        size_t part = std::min(bytes, iov[index].iov_len - offset);
+        out.push_back({static_cast<char *>(iov[index].iov_base) + offset, part});
+        bytes -= part;
+        offset += part;
+        if (offset == iov[index].iov_len) {
+            ++index;
+            offset = 0;
+        }
+    }
+}
 
-ssize_t NRUCache::readFile(int fd, void *buf, size_t count) {
-    auto it = open_files.find(fd);
-    if (it == open_files.end()) return -1;
+// Готовит блок к записи bytes байт с offset: части маски, задетые записью
+// лишь частично, дочитываются заранее, а записываемые помечаются достоверными
+bool NRUCache::prepareWrite(Shard &shard, ShardLock &lock, CacheBlock *block, size_t offset, size_t bytes) {
+    uint64_t partial = 0;
+    if (offset % valid_unit) partial |= validMask(offset, 1);
+    if ((offset + bytes) % valid_unit && offset + bytes < block_size)
+        partial |= validMask(offset + bytes - 1, 1);
+    if ((block->valid & partial) != partial && !fillBlock(shard, lock, block)) return false;
+    block->valid |= validMask(offset, bytes);
+    return true;
+}
+
+// Один проход по блокам диапазона. Промахи резервируются и читаются одним
+// пакетом, готовые блоки копируются сразу. Перед любым ожиданием пакет
+// дочитывается, чтобы два читателя не ждали зарезервированные блоки друг друга.
+ssize_t NRUCache::readvAt(OpenFileInternal &open, const struct iovec *iov, int iovcnt, off_t offset) {
+    const FilePtr &file = open.file;
+    int fd = file->id;
+    size_t count = 0;
+    for (int i = 0; i < iovcnt; ++i) count += iov[i].iov_len;
+    if (count == 0) return 0;
+    if (offset < 0) return -1;
+    if (file->mapped) return mappedRead(*file, iov, iovcnt, offset);
+    size_t bypass = scan_bypass;
+    if (bypass && count >= bypass && canBypass(iov, iovcnt, offset, count))
+        return bypassRead(file, fd, iov, iovcnt, offset, count);
+    int64_t started = nowNs();
+    uint64_t waits = disk_waits;
 
-    FileHandleInternal &file = it->second;
-    off_t start = file.current_pos;
+    off_t start = offset;
     off_t end = start + count;
-    char *dest = (char *) buf;
-    ssize_t total = 0;
+    off_t first = start / block_size;
+    off_t last = (end - 1) / block_size;
+    IovCursor out{iov, iovcnt, 0, 0};
+    ReadBatch batch;
+    batch.count = 0;
 
-    for (off_t bn = start / block_size; bn <= (end - 1) / block_size; ++bn) {
-        CacheBlock *block = findBlock(fd, bn);
-        if (!block) block = loadBlock(fd, bn);
+    off_t stride = trackStream(open, first, last);
+    LoadMode miss_mode = stride ? LoadMode::Scan : LoadMode::Read;
+    // Экстенты промахов лежат в запросе, а у последовательного потока - в файле
+    off_t file_last = (file->size - 1) / static_cast<off_t>(block_size);
+    off_t lo = stride == 1 ? 0 : first;
+    off_t hi = std::min(stride == 1 ? file_last : last, file_last);
+
+    for (off_t bn = first; bn <= last;) {
+        if (batch.count == read_batch_limit && !readBatch(*file, batch, &out, start, end)) return -1;
+
+        Shard &shard = shardFor(*file, bn);
+        ShardLock lock(shard.mutex);
+        if (bn * static_cast<off_t>(block_size) < file->size) {
+            CacheBlock *unit = reserveBlock(shard, lock, *file, fd, bn, miss_mode, lo, hi);
+            if (unit) {
+                batch.shards[batch.count] = &shard;
+                batch.blocks[batch.count++] = unit;
+                bn = unit->block_number + unit->span;
+                continue;
+            }
+        }
+        if (batch.count) {
+            off_t block_start = bn * block_size;
+            off_t read_start = std::max(start, block_start);
+            off_t read_end = std::min(end, static_cast<off_t>(block_start + block_size));
+            uint64_t mask = validMask(read_start - block_start, read_end - read_start);
+            CacheBlock *cached = lookupBlock(shard, fd, bn);
+            if (!cached || cached->loading || (cached->valid & mask) != mask) {
+                lock.unlock();
+                if (!readBatch(*file, batch, &out, start, end)) return -1;
+                lock.lock();
+            }
+        }
+
+        CacheBlock *block = acquireBlock(shard, lock, *file, fd, bn, miss_mode);
         if (!block) return -1;
+        // Следующие блоки того же экстента копируются под той же блокировкой
+        // без новых поисков в индексе
+        CacheBlock *head = &shard.blocks[block->head];
+        off_t unit_last = std::min(last, head->block_number + static_cast<off_t>(head->span) - 1);
+        for (;;) {
+            off_t block_start = bn * block_size;
+            off_t read_start = std::max(start, block_start);
+            off_t read_end = std::min(end, static_cast<off_t>(block_start + block_size));
+            size_t block_offset = read_start - block_start;
+            size_t bytes = read_end - read_start;
+            uint64_t mask = validMask(block_offset, bytes);
+            if ((block->valid & mask) != mask && !fillBlock(shard, lock, block)) return -1;
+
+            out.seek(read_start - start);
+            out.copyOut(block->data + block_offset, bytes);
+            if (++bn > unit_last) break;
+            block = memberOf(shard, head, bn - head->block_number);
+            if (block->loading) break;
+            countHits(shard, 1);
+        }
+    }
+    if (batch.count && !readBatch(*file, batch, &out, start, end)) return -1;
+    recordLatency(shardFor(*file, first), started, waits);
+    return count;
+}
+
+// Небуферизованный ввод-вывод читает только выровненные участки в
+// выровненные буферы
+bool NRUCache::canBypass(const struct iovec *iov, int iovcnt, off_t offset, size_t count) const {
+    if (!direct_io) return true;
+    if (offset % block_size || count % block_size) return false;
+    for (int i = 0; i < iovcnt; ++i) {
+        if (reinterpret_cast<uintptr_t>(iov[i].iov_base) % block_size || iov[i].iov_len % block_size) return false;
+    }
+    return true;
+}
 
+// Большое чтение в обход кэша: серии подряд идущих блоков, которых нет в
+// кэше, читаются с диска прямо в буферы вызывающего, а блоки из кэша (в том
+// числе грязные) копируются из него. Новые блоки в кэш не попадают.
+ssize_t NRUCache::bypassRead(const FilePtr &file, int fd, const struct iovec *iov, int iovcnt, off_t offset,
+                             size_t count) {
+    int64_t started = nowNs();
+    uint64_t waits = disk_waits;
+    off_t start = offset;
+    off_t end = start + count;
+    off_t first = start / block_size;
+    off_t last = (end - 1) / block_size;
+    IovCursor out{iov, iovcnt, 0, 0};
+    std::vector<struct iovec> run;
+    off_t run_start = -1; // Начало еще не прочитанной серии, байт
+
+    auto readRun = [&](off_t run_end) {
+        out.seek(run_start - start);
+        run.clear();
+        out.slice(run_end - run_start, run);
+        ++disk_waits;
+        ++read_requests;
+        ssize_t got = backend->readvAt(file->handle, run.data(), static_cast<int>(run.size()), run_start);
+        if (got < 0) return false;
+        // За концом файла на диске - нули, как и у блоков кэша
+        for (const struct iovec &part: run) {
+            size_t keep = std::min<size_t>(got, part.iov_len);
+            memset(static_cast<char *>(part.iov_base) + keep, 0, part.iov_len - keep);
+            got -= keep;
+        }
+        bypassed_blocks += (run_end - 1) / block_size - run_start / block_size + 1;
+        run_start = -1;
+        return true;
+    };
+
+    for (off_t bn = first; bn <= last; ++bn) {
         off_t block_start = bn * block_size;
         off_t read_start = std::max(start, block_start);
         off_t read_end = std::min(end, static_cast<off_t>(block_start + block_size));
-        size_t offset = read_start - block_start;
-        size_t bytes = read_end - read_start;
 
-        memcpy(dest + total, block->data.data() + offset, bytes);
-        total += bytes;
-    }
+        Shard &shard = shardFor(*file, bn);
+        ShardLock lock(shard.mutex);
+        if (findUnit(shard, fd, bn) == BlockIndex::npos) {
+            if (run_start < 0) run_start = read_start;
+            continue;
+        }
+        lock.unlock();
+        if (run_start >= 0 && !readRun(read_start)) return -1;
+        lock.lock();
 
-    file.current_pos += total;
-    return total;
+        size_t block_offset = read_start - block_start;
+        size_t bytes = read_end - read_start;
+        uint64_t mask = validMask(block_offset, bytes);
+        CacheBlock *block = acquireBlock(shard, lock, *file, fd, bn, LoadMode::Scan);
+        if (!block) return -1;
+        if ((block->valid & mask) != mask && !fillBlock(shard, lock, block)) return -1;
+        out.seek(read_start - start);
+        out.copyOut(block->data + block_offset, bytes);
+    }
+    if (run_start >= 0 && !readRun(end)) return -1;
+    recordLatency(shardFor(*file, first), started, waits);
+    return count;
 }
 
+ssize_t NRUCache::writevAt(const FilePtr &file, const struct iovec *iov, int iovcnt, off_t offset) {
+    int fd = file->id;
+    size_t count = 0;
+    for (int i = 0; i < iovcnt; ++i) count += iov[i].iov_len;
+    if (count == 0) return 0;
+    if (offset < 0) return -1;
+    if (file->mapped) return mappedWrite(*file, iov, iovcnt, offset);
+    int64_t started = nowNs();
+    uint64_t waits = disk_waits;
 
-ssize_t NRUCache::writeFile(int fd, const void *buf, size_t count) {
-    auto it = open_files.find(fd);
-    if (it == open_files.end()) return -1;
-
-    FileHandleInternal &file = it->second;
-    off_t start = file.current_pos;
+    off_t start = offset;
     off_t end = start + count;
-    const char *src = static_cast<const char *>(buf);
-    ssize_t total = 0;
+    IovCursor in{iov, iovcnt, 0, 0};
 
     for (off_t bn = start / block_size; bn <= (end - 1) / block_size; ++bn) {
-        CacheBlock *block = findBlock(fd, bn);
-        if (!block) block = loadBlock(fd, bn);
-        if (!block) return -1;
-
+        Shard &shard = shardFor(*file, bn);
+        ShardLock lock(shard.mutex);
         off_t block_start = bn * block_size;
         off_t write_start = std::max(start, block_start);
         off_t write_end = std::min(end, static_cast<off_t>(block_start + block_size));
-        size_t offset = write_start - block_start;
+        size_t block_offset = write_start - block_start;
         size_t bytes = write_end - write_start;
 
-        memcpy(block->data.data() + offset, src + total, bytes);
-        total += bytes;
-        block->dirty = true;
+        CacheBlock *block = acquireBlock(shard, lock, *file, fd, bn, LoadMode::Overwrite);
+        if (!block || !prepareWrite(shard, lock, block, block_offset, bytes)) return -1;
+
+        in.copyIn(block->data + block_offset, bytes);
+        markDirty(shard, block);
+    }
+
+    off_t size = file->size.load();
+    while (size < end && !file->size.compare_exchange_weak(size, end)) {}
+    recordLatency(shardFor(*file, start / block_size), started, waits);
+    return count;
+}
+
+// Относит операцию к промахам, если по ходу нее поток ждал диска
+void NRUCache::recordLatency(Shard &shard, int64_t started, uint64_t waits) {
+    LatencyCounters &latency = disk_waits != waits ? shard.miss_latency : shard.hit_latency;
+    latency.record(nowNs() - started);
+}
+
+// Распознает последовательный или шаговый поток по двум одинаковым шагам
+// подряд и держит упреждение на окно впереди читателя. Новое задание
+// ставится, когда впереди осталось меньше половины окна, и окно при этом
+// удваивается; вытеснение невостребованных упрежденных блоков его сокращает.
+// Возвращает шаг потока, если чтение его продолжает (тогда промахи
+// вставляются с низким приоритетом), иначе 0.
+off_t NRUCache::trackStream(OpenFileInternal &open, off_t first, off_t last) {
+    const FilePtr &file = open.file;
+    std::lock_guard<std::mutex> lock(open.stream_mutex);
+    StreamState &st = open.stream;
+
+    off_t stride = 0;
+    if (st.last_start >= 0) {
+        // Продолжение с того же или следующего блока - последовательный поток
+        if (first == st.last_end || first == st.last_end + 1) stride = 1;
+        else stride = first - st.last_start;
+    }
+    if (stride > 0 && stride == st.stride) {
+        ++st.confirmed;
+    } else {
+        st.confirmed = 0;
+        st.window = 0;
+        st.next = 0;
+    }
+    st.stride = stride;
+    st.last_start = first;
+    st.last_end = last;
+    if (st.confirmed == 0) return 0;
+    if (readahead_max == 0) return stride;
+
+    size_t limit = std::min(readahead_max, std::max<size_t>(1, budget_blocks / 4));
+    uint32_t wasted = file->wasted.load();
+    if (wasted != st.wasted_seen) {
+        st.wasted_seen = wasted;
+        st.window = std::max(readahead_min, st.window / 2);
+    }
+    if (st.window == 0) st.window = readahead_min;
+    st.window = std::min(st.window, limit);
+
+    off_t cursor = stride == 1 ? last + 1 : first + stride; // Что понадобится следующим
+    if (st.next < cursor) st.next = cursor;
+    size_t ahead = (st.next - cursor) / stride;
+    if (ahead > st.window / 2) return stride;
+
+    size_t count = st.window - ahead;
+    {
+        std::lock_guard<std::mutex> queue_lock(readahead_mutex);
+        if (readahead_queue.size() >= readahead_queue_limit) return stride;
+        readahead_queue.push_back({file, file->id, st.next, stride, stride == 1 ? 1 : last - first + 1, count});
+        if (!readahead_thread.joinable())
+            readahead_thread = std::thread(&NRUCache::readaheadLoop, this);
+    }
+    readahead_cv.notify_one();
+
+    st.next += count * stride;
+    st.window = std::min(st.window * 2, limit);
+    return stride;
+}
+
+// Упреждающее чтение по заданию: отсутствующие блоки всех участков
+// задания уходят бэкенду пакетами, как и промахи в readvAt. Экстенты
+// последовательного потока ограничены файлом, шагового - участком.
+void NRUCache::prefetch(const ReadaheadRequest &req) {
+    FileHandleInternal &file = *req.file;
+    off_t size = file.size;
+    off_t last_block = size > 0 ? (size - 1) / block_size : -1;
+    ReadBatch batch;
+    batch.count = 0;
+    off_t reserved = 0; // Конец последнего зарезервированного экстента
+
+    for (size_t k = 0; k < req.count; ++k) {
+        off_t part = req.start + k * req.stride;
+        off_t lo = req.stride == 1 ? 0 : part;
+        off_t hi = req.stride == 1 ? last_block : std::min(last_block, part + req.span - 1);
+        for (off_t bn = std::max(part, reserved); bn < part + req.span;) {
+            if (bn > last_block || file.closed) break;
+            if (batch.count == read_batch_limit) readBatch(file, batch, nullptr, 0, 0);
+
+            Shard &shard = shardFor(file, bn);
+            ShardLock lock(shard.mutex);
+            CacheBlock *block = reserveBlock(shard, lock, file, req.fd, bn, LoadMode::Prefetch, lo, hi);
+            if (!block) {
+                ++bn;
+                continue;
+            }
+            batch.shards[batch.count] = &shard;
+            batch.blocks[batch.count++] = block;
+            bn = reserved = block->block_number + block->span;
+        }
+    }
+    if (batch.count) readBatch(file, batch, nullptr, 0, 0);
+}
+
+// Ставит в очередь прогрев только что открытого файла, если в манифесте
+// есть его набор и файл с тех пор не менялся. Набор забирается из
+// манифеста: дальше рабочий набор файла - его блоки в кэше.
+void NRUCache::queueWarmUp(const FilePtr &file) {
+    WarmRequest req{file, {}, 0};
+    {
+        std::lock_guard<std::mutex> lock(manifest_mutex);
+        auto it = manifest_files.find({file->dev, file->ino});
+        if (it == manifest_files.end()) return;
+        const ManifestFile &saved = it->second;
+        if (saved.size == file->size && saved.mtime == backend->modifiedTime(file->handle))
+            req.extents = std::move(it->second.extents);
+        manifest_files.erase(it);
+    }
+    if (req.extents.empty()) return;
+
+    // Горячие экстенты первыми, внутри групп - по возрастанию номера, чтобы
+    // соседние читались одним запросом
+    std::stable_partition(req.extents.begin(), req.extents.end(),
+                          [](const ManifestExtent &extent) { return extent.referenced != 0; });
+    {
+        std::lock_guard<std::mutex> lock(readahead_mutex);
+        warm_queue.push_back(std::move(req));
+        if (!readahead_thread.joinable())
+            readahead_thread = std::thread(&NRUCache::readaheadLoop, this);
+    }
+    readahead_cv.notify_one();
+}
+
+// Очередной подход прогрева: до warm_batch_limit экстентов манифеста
+// резервируются и читаются одним пакетом, как промахи в readvAt. Прогрев
+// занимает только свободные слоты и не вытесняет блоки, уже нужные работе.
+void NRUCache::warmUp(WarmRequest &req) {
+    FileHandleInternal &file = *req.file;
+    off_t size = file.size;
+    off_t last_block = size > 0 ? (size - 1) / block_size : -1;
+    ReadBatch batch;
+    batch.count = 0;
+
+    size_t stop = std::min(req.extents.size(), req.next + warm_batch_limit);
+    for (; req.next < stop && !file.closed; ++req.next) {
+        const ManifestExtent &extent = req.extents[req.next];
+        off_t first = static_cast<off_t>(extent.block_number);
+        off_t last = std::min(last_block, static_cast<off_t>(first + extent.span - 1));
+        for (off_t bn = first; bn <= last;) {
+            if (batch.count == read_batch_limit) readBatch(file, batch, nullptr, 0, 0);
+
+            Shard &shard = shardFor(file, bn);
+            ShardLock lock(shard.mutex);
+            if (shard.free_slots.empty()) break;
+            off_t hi = std::min(last, static_cast<off_t>(bn + shard.free_slots.size() - 1));
+            CacheBlock *block = reserveBlock(shard, lock, file, file.id, bn, LoadMode::Warm, first, hi);
+            if (!block) {
+                ++bn;
+                continue;
+            }
+            block->accessed = extent.referenced && shard.policy->marksInserted();
+            batch.shards[batch.count] = &shard;
+            batch.blocks[batch.count++] = block;
+            bn = block->block_number + block->span;
+        }
+    }
+    if (batch.count) readBatch(file, batch, nullptr, 0, 0);
+}
+
+// Задания потоков идут первыми; прогрев читается подходами по
+// warm_batch_limit экстентов между ними
+void NRUCache::readaheadLoop() {
+    for (;;) {
+        ReadaheadRequest req;
+        WarmRequest warm;
+        {
+            std::unique_lock<std::mutex> lock(readahead_mutex);
+            readahead_cv.wait(lock, [this] {
+                return readahead_stop || !readahead_queue.empty() || !warm_queue.empty();
+            });
+            if (readahead_stop) return;
+            if (!readahead_queue.empty()) {
+                req = std::move(readahead_queue.front());
+                readahead_queue.pop_front();
+            } else {
+                warm = std::move(warm_queue.front());
+                warm_queue.pop_front();
+            }
+        }
+
+        if (!warm.file) {
+            prefetch(req);
+            continue;
+        }
+        warmUp(warm);
+        if (warm.next < warm.extents.size() && !warm.file->closed) {
+            std::lock_guard<std::mutex> lock(readahead_mutex);
+            if (!readahead_stop) warm_queue.push_back(std::move(warm));
+        }
+    }
+}
+
+// Закрепляет грязные блоки (все при force, иначе только старше
+// dirty_max_age), упорядочивает их по (fd, номер блока) и пишет каждую
+// серию соседних блоков одним векторным запросом. Блоки берутся из очереди
+// грязных шарда от самых старых, так что обход не трогает чистые слоты и
+// без force кончается на первом молодом. Возвращает число записанных блоков.
+size_t NRUCache::flushDirtyBlocks(bool force) {
+    std::vector<FlushItem> items;
+    int64_t age_limit = dirty_max_age.count() > 0
+                            ? nowNs() - std::chrono::duration_cast<std::chrono::nanoseconds>(dirty_max_age).count()
+                            : INT64_MIN;
+
+    for (auto &shard_ptr: shards) {
+        Shard &shard = *shard_ptr;
+        ShardLock lock(shard.mutex);
+        uint32_t slot = shard.dirty_oldest;
+        // Просмотренные считаются в предел пакета: не записанный блок
+        // возвращается в хвост очереди и иначе обходился бы снова
+        for (size_t seen = 0; slot != BlockIndex::npos && seen < flush_batch_limit && items.size() < flush_batch_limit;
+             ++seen) {
+            CacheBlock &block = shard.blocks[slot];
+            if (!force && block.dirty_since > age_limit) break;
+            slot = block.age_next;
+            if (block.loading) continue;
+            if (block.valid != valid_full) {
+                // Частично записанный блок дочитывается и пишется отдельно;
+                // пока блокировка была отпущена, очередь могла измениться
+                if (writeBackBlock(shard, lock, &block)) ++flushed_blocks;
+                slot = shard.dirty_oldest;
+                continue;
+            }
+
+            beginWriteback(shard, &block);
+            items.push_back({block.file, block.fd, block.block_number, &shard, &block});
+        }
+    }
+    size_t flushed = writeItems(items);
+    flushed_blocks += flushed;
+    return flushed;
+}
+
+// Пишет закрепленные beginWriteback блоки: сортирует по файлу и номеру,
+// подряд идущие объединяет в векторный запрос и отдает все запросы одним
+// пакетом. Возвращает число записанных блоков.
+size_t NRUCache::writeItems(std::vector<FlushItem> &items) {
+    if (items.empty()) return 0;
+
+    std::sort(items.begin(), items.end(), [](const FlushItem &a, const FlushItem &b) {
+        return a.fd != b.fd ? a.fd < b.fd : a.block_number < b.block_number;
+    });
+
+    std::vector<struct iovec> iov(items.size());
+    std::vector<IoRequest> requests;
+    std::vector<size_t> request_of(items.size());
+    for (size_t i = 0; i < items.size(); ++i) {
+        iov[i] = {items[i].block->data, block_size};
+        if (i > 0 && items[i].fd == items[i - 1].fd && items[i].block_number == items[i - 1].block_number + 1) {
+            ++requests.back().iovcnt;
+        } else {
+            requests.push_back({items[i].file->handle, &iov[i], 1,
+                                items[i].block_number * static_cast<off_t>(block_size), true, 0});
+        }
+        request_of[i] = requests.size() - 1;
+    }
+    backend->submitBatch(requests.data(), requests.size());
+    flush_writes += requests.size();
+
+    size_t written = 0;
+    for (size_t i = 0; i < items.size(); ++i) {
+        const IoRequest &req = requests[request_of[i]];
+        bool ok = req.result == static_cast<ssize_t>(req.iovcnt * block_size);
+        if (ok) {
+            const FlushItem &item = items[i];
+            sharedPut(*item.file, item.block_number, item.block->data,
+                      item.file->size - item.block_number * static_cast<off_t>(block_size), true);
+        }
+        Shard &shard = *items[i].shard;
+        ShardLock lock(shard.mutex);
+        endWriteback(shard, items[i].block, ok);
+        if (ok) {
+            shard.stats.bytes_written += block_size;
+            ++written;
+        }
+    }
+    return written;
+}
+
+void NRUCache::flusherLoop() {
+    std::unique_lock<std::mutex> lock(flusher_mutex);
+    bool trim_left = false;
+    while (!flusher_stop) {
+        // Без давления просыпаемся раз в четверть предельного возраста
+        auto period = dirty_max_age.count() > 0 ? dirty_max_age / 4 : std::chrono::milliseconds(250);
+        if (stats_dump_interval.count() > 0) period = std::min(period, stats_dump_interval);
+        if (manifest_interval.count() > 0) period = std::min(period, manifest_interval);
+        if (pressure_interval.count() > 0) period = std::min(period, pressure_interval);
+        flusher_cv.wait_for(lock, period, [this] {
+            return flusher_stop || trim_pending || dirty_blocks > dirty_high_ratio * budget_blocks;
+        });
+        if (flusher_stop) break;
+        // Недоужатые шарды (блоки были закреплены) добираются каждый проход
+        bool trim = trim_pending || trim_left;
+        trim_pending = false;
+        lock.unlock();
+
+        if (dirty_blocks > dirty_high_ratio * budget_blocks) {
+            while (dirty_blocks > dirty_low_ratio * budget_blocks && flushDirtyBlocks(true) > 0) {}
+        }
+        if (dirty_max_age.count() > 0) flushDirtyBlocks(false);
+        if (trim) trim_left = trimShards();
+
+        lock.lock();
+        auto now = std::chrono::steady_clock::now();
+        if (pressure_interval.count() > 0 && now - pressure_checked >= pressure_interval) {
+            pressure_checked = now;
+            std::string path = pressure_path;
+            double limit = pressure_limit;
+            lock.unlock();
+            checkPressure(path, limit);
+            lock.lock();
+        }
+        if (stats_dump_interval.count() > 0 && now - stats_dumped >= stats_dump_interval) {
+            stats_dumped = now;
+            FILE *out = stats_dump_out;
+            lock.unlock();
+            dumpStats(out);
+            lock.lock();
+        }
+        if (manifest_interval.count() > 0 && now - manifest_saved >= manifest_interval) {
+            manifest_saved = now;
+            lock.unlock();
+            writeManifestNow(false);
+            lock.lock();
+        }
+    }
+}
+
+// Пишет грязные блоки файла; с drop - еще и убирает все его блоки из кэша,
+// дожидаясь окончания чужих операций над ними. Обходятся только списки
+// самого файла в каждом шарде, так что время пропорционально числу его
+// блоков, а не размеру кэша. Грязные блоки пишутся одним пакетом по
+// возрастанию номера с объединением подряд идущих. Блок, который не удалось
+// записать, остается в кэше грязным, даже с drop; тогда false.
+bool NRUCache::flushFileBlocks(FileHandleInternal &file, bool drop) {
+    std::vector<FlushItem> items;
+    for (auto &shard_ptr: shards) {
+        Shard &shard = *shard_ptr;
+        ShardLock lock(shard.mutex);
+        uint32_t slot = file.shard_blocks[shard.id].dirty;
+        while (slot != BlockIndex::npos) {
+            CacheBlock &block = shard.blocks[slot];
+            slot = block.dirty_next;
+            // Занятые и частично записанные блоки дописываются ниже по одному
+            if (block.writeback || block.loading || block.valid != valid_full) continue;
+            beginWriteback(shard, &block);
+            items.push_back({block.file, block.fd, block.block_number, &shard, &block});
+        }
+    }
+    bool ok = writeItems(items) == items.size();
+
+    std::vector<uint32_t> failed; // Слоты, запись которых не удалась: обходятся
+    for (auto &shard_ptr: shards) {
+        Shard &shard = *shard_ptr;
+        ShardLock lock(shard.mutex);
+        FileShardBlocks &lists = file.shard_blocks[shard.id];
+        failed.clear();
+        for (;;) {
+            uint32_t slot = drop ? lists.resident : lists.dirty;
+            while (slot != BlockIndex::npos && std::find(failed.begin(), failed.end(), slot) != failed.end())
+                slot = drop ? shard.blocks[slot].file_next : shard.blocks[slot].dirty_next;
+            if (slot == BlockIndex::npos) {
+                // Записи фонового сброса должны завершиться до syncFile
+                if (lists.writeback == 0) break;
+                shard.unpinned.wait(lock);
+                continue;
+            }
+            CacheBlock *block = &shard.blocks[slot];
+            if (drop) {
+                // Экстент убирается целиком, когда ни один его блок не занят
+                if (unitPinned(shard, block)) {
+                    shard.unpinned.wait(lock);
+                    continue;
+                }
+                CacheBlock *dirty = dirtyMember(shard, block);
+                if (!dirty) {
+                    removeBlock(shard, block);
+                } else if (!writeBackBlock(shard, lock, dirty)) {
+                    // Ошибка записи: экстент остается с грязными данными
+                    ok = false;
+                    failed.push_back(slot);
+                }
+                continue;
+            }
+            if (block->loading || block->writeback) {
+                shard.unpinned.wait(lock);
+                continue;
+            }
+            if (block->dirty && !writeBackBlock(shard, lock, block)) {
+                ok = false;
+                failed.push_back(slot);
+            }
+        }
+    }
+    return ok;
+}
+
+NRUCache::NRUCache(size_t block_size, size_t max_blocks, bool direct_io, size_t shard_count,
+                   ReplacementKind replacement, size_t max_extent, ArenaPages pages)
+    : block_size(block_size), max_blocks(max_blocks), budget_blocks(0), budget_limit(0), compressed_share(0),
+      extent_shift(0), extent_ladder(1),
+      valid_unit(std::max<size_t>(1, (block_size + 63) / 64)), replacement(replacement), numa_nodes(1),
+      numa_bound(false),
+      next_fd(1), next_file_id(1), direct_io(direct_io),
+      backend(createStorageBackend()), readahead_min(4), readahead_max(64), readahead_stop(false),
+      dirty_blocks(0), dirty_high_ratio(0.25), dirty_low_ratio(0.1), dirty_max_age(1000),
+      flusher_stop(false), flushed_blocks(0), flush_writes(0), scan_bypass(0), bypassed_blocks(0),
+      read_requests(0), shared_tier(nullptr), shared_hits(0), victim_file(nullptr),
+      async_pending(0), async_stop(false),
+      stats_dump_interval(0), stats_dump_out(stderr), manifest_interval(0), trim_pending(false),
+      pressure_limit(0), pressure_interval(0), pressure_shrinks(0) {
+    size_t units = (block_size + valid_unit - 1) / valid_unit;
+    valid_full = units >= 64 ? ~0ull : (1ull << units) - 1;
+    if (shard_count == 0) shard_count = 1;
+    size_t per_shard = std::max<size_t>(1, (max_blocks + shard_count - 1) / shard_count);
+    // Участок шарда - наибольший экстент; крупнее 1/16 шарда участки делили
+    // бы память шардов слишком неравномерно
+    size_t extent_blocks = std::min({max_extent / block_size, per_shard / 16, size_t(1) << max_extent_shift});
+    while ((size_t(2) << extent_shift) <= extent_blocks) ++extent_shift;
+    uint32_t ladder = 1u << extent_shift;
+    for (size_t shift = 0; shift <= extent_shift; shift += 4) ladder |= 1u << shift;
+    extent_ladder = ladder;
+    for (size_t i = 0; i < shard_count; ++i)
+        shards.push_back(std::make_unique<Shard>(i, block_size, per_shard, replacement, pages));
+    budget_blocks = budget_limit = per_shard * shard_count;
+    flusher_thread = std::thread(&NRUCache::flusherLoop, this);
+}
+
+
+NRUCache::~NRUCache() {
+    // Исполнители дорабатывают очередь: буферы вызывающего еще живы
+    {
+        std::lock_guard<std::mutex> lock(async_mutex);
+        async_stop = true;
+    }
+    async_cv.notify_all();
+    for (std::thread &worker: async_workers) worker.join();
+
+    {
+        std::lock_guard<std::mutex> lock(readahead_mutex);
+        readahead_stop = true;
+        readahead_queue.clear();
+        warm_queue.clear();
+    }
+    readahead_cv.notify_all();
+    if (readahead_thread.joinable()) readahead_thread.join();
+
+    {
+        std::lock_guard<std::mutex> lock(flusher_mutex);
+        flusher_stop = true;
+    }
+    flusher_cv.notify_all();
+    flusher_thread.join();
+
+    writeManifestNow(true);
+    // Файл, открытый несколькими дескрипторами, сбрасывается при первом из них
+    VictimFile *victim = victim_file.load();
+    for (auto &pair: open_files) {
+        FileHandleInternal &file = *pair.second->file;
+        flushFileBlocks(file, true);
+        if (victim && file.shareable) victim->refresh(file.dev, file.ino, backend->modifiedTime(file.handle));
+    }
+    open_files.clear();
+    files_by_id.clear();
+}
+
+
+void NRUCache::asyncLoop() {
+    std::unique_lock<std::mutex> lock(async_mutex);
+    for (;;) {
+        async_cv.wait(lock, [this] { return async_stop || !async_queue.empty(); });
+        if (async_queue.empty()) return;
+        AsyncRead req = std::move(async_queue.front());
+        async_queue.pop_front();
+
+        lock.unlock();
+        struct iovec iov = {req.buf, req.count};
+        ssize_t result = readvAt(*req.open, &iov, 1, req.offset);
+        req.open.reset();
+        lock.lock();
+
+        completions.push_back({req.tag, result});
+        --async_pending;
+        completion_cv.notify_all();
+    }
+}
+
+void NRUCache::setReadahead(size_t min_blocks, size_t max_blocks) {
+    readahead_min = std::max<size_t>(1, min_blocks);
+    readahead_max = max_blocks;
+}
+
+void NRUCache::setWriteback(double high_ratio, double low_ratio, unsigned max_age_ms) {
+    {
+        std::lock_guard<std::mutex> lock(flusher_mutex);
+        dirty_high_ratio = high_ratio;
+        dirty_low_ratio = std::min(low_ratio, high_ratio);
+        dirty_max_age = std::chrono::milliseconds(max_age_ms);
+    }
+    flusher_cv.notify_one();
+}
+
+bool NRUCache::setExtentSizes(const size_t *sizes, size_t count) {
+    uint32_t ladder = 1;
+    for (size_t i = 0; i < count; ++i) {
+        size_t blocks = sizes[i] / block_size;
+        if (sizes[i] % block_size || blocks == 0 || (blocks & (blocks - 1)) || blocks > (size_t(1) << extent_shift))
+            return false;
+        ladder |= 1u << countTrailingZeros64(blocks);
+    }
+    extent_ladder = ladder;
+    return true;
+}
+
+bool NRUCache::attachShared(const char *name, size_t bytes) {
+    std::unique_ptr<SharedTier> tier = SharedTier::attach(name, block_size, bytes / block_size);
+    if (!tier) return false;
+    std::lock_guard<std::mutex> lock(shared_mutex);
+    shared_tier = tier.get();
+    shared_tiers.push_back(std::move(tier));
+    return true;
+}
+
+void NRUCache::detachShared() {
+    shared_tier = nullptr;
+}
+
+bool NRUCache::sharedStats(SharedTierStats *out) const {
+    SharedTier *tier = shared_tier.load();
+    if (!tier) return false;
+    *out = tier->stats();
+    return true;
+}
+
+bool NRUCache::attachVictimFile(const char *path, size_t bytes) {
+    std::lock_guard<std::mutex> lock(victim_mutex);
+    // Прежний ярус дописывается до того, как файл прочтет новый: это может
+    // быть тот же файл
+    if (VictimFile *old = victim_file.exchange(nullptr)) old->close();
+    std::unique_ptr<VictimFile> victim = VictimFile::open(path, block_size, bytes);
+    if (!victim) return false;
+    // Блоки открытых файлов уже могут лежать в кэше или быть изменены в нем
+    std::unique_lock<std::shared_mutex> files_lock(files_mutex);
+    for (auto &pair: files_by_id) victim->dropFile(pair.first.first, pair.first.second);
+    victim_file = victim.get();
+    victim_files.push_back(std::move(victim));
+    return true;
+}
+
+void NRUCache::detachVictimFile() {
+    std::lock_guard<std::mutex> lock(victim_mutex);
+    VictimFile *victim = victim_file.exchange(nullptr);
+    if (victim) victim->close();
+}
+
+bool NRUCache::victimStats(VictimFileStats *out) const {
+    VictimFile *victim = victim_file.load();
+    if (!victim) return false;
+    *out = victim->stats();
+    return true;
+}
+
+bool NRUCache::setBackend(std::unique_ptr<StorageBackend> io) {
+    std::unique_lock<std::shared_mutex> lock(files_mutex);
+    if (!open_files.empty() || !files_by_id.empty()) return false;
+    backend = std::move(io);
+    return true;
+}
+
+bool NRUCache::setNuma(size_t nodes) {
+    size_t machine = numaNodeCount();
+    if (nodes == 0) nodes = machine;
+    if (nodes > shards.size()) return false;
+    std::unique_lock<std::shared_mutex> lock(files_mutex);
+    if (!open_files.empty() || !files_by_id.empty()) return false;
+
+    bool bound = false;
+    node_shards.assign(nodes, {});
+    for (auto &shard_ptr: shards) {
+        Shard &shard = *shard_ptr;
+        int node = static_cast<int>(shard.id % nodes);
+        shard.node = nodes > 1 ? node : -1;
+        node_shards[node].push_back(shard.id);
+        // Привязка имеет смысл, только если узлов на машине больше одного
+        if (nodes > 1 && machine > 1 && bindMemoryToNode(shard.arena.block(0), shard.arena.mappedBytes(), node))
+            bound = true;
+    }
+    numa_nodes = nodes;
+    numa_bound = bound;
+    return true;
+}
+
+void NRUCache::bindThread(int node) {
+    bound_node = node;
+    if (node >= 0 && numaNodeCount() > 1) bindThreadToNode(node);
+}
+
+void NRUCache::setScanBypass(size_t min_bytes) {
+    scan_bypass = min_bytes;
+}
+
+void NRUCache::setReplacement(ReplacementKind kind) {
+    replacement = kind;
+    for (auto &shard_ptr: shards) {
+        Shard &shard = *shard_ptr;
+        std::unique_ptr<ReplacementPolicy> policy = createReplacementPolicy(kind, shard.blocks.size());
+        ShardLock lock(shard.mutex);
+        for (size_t slot = 0; slot < shard.blocks.size(); ++slot) {
+            const CacheBlock &block = shard.blocks[slot];
+            if (block.in_use && block.head == slot)
+                policy->inserted(static_cast<uint32_t>(slot), BlockIndex::hash(block.fd, block.block_number),
+                                 block.prefetched);
+        }
+        shard.policy = std::move(policy);
+    }
+}
+
+// Доводит число слотов шарда в работе до capacity: лишние освобождаются
+// вытеснением и откладываются, их память отдается системе; недостающие
+// возвращаются из отложенных. false - вытеснять больше нечего (закреплено).
+bool NRUCache::resizeShard(Shard &shard, ShardLock &lock, size_t capacity) {
+    while (shard.capacity > capacity) {
+        if (shard.free_slots.empty()) {
+            if (!evictBlock(shard, lock)) return false;
+            continue;
+        }
+        uint32_t slot = static_cast<uint32_t>(shard.free_slots.back());
+        shard.free_slots.pop_back();
+        shard.arena.discard(slot, 1);
+        shard.spare_slots.push_back(slot);
+        --shard.capacity;
+    }
+    while (shard.capacity < capacity && !shard.spare_slots.empty()) {
+        shard.free_slots.push_back(shard.spare_slots.back());
+        shard.spare_slots.pop_back();
+        ++shard.capacity;
+    }
+    return true;
+}
+
+bool NRUCache::setCompressedTier(double share) {
+    if (!(share >= 0 && share <= max_compressed_share)) return false;
+    std::lock_guard<std::mutex> guard(budget_mutex);
+    compressed_share = share;
+    bool ok = true;
+    for (auto &shard_ptr: shards) {
+        Shard &shard = *shard_ptr;
+        size_t tier_slots = static_cast<size_t>(share * shard.budget);
+        // Бюджет - до вытеснения, чтобы вытесняемые блоки сразу ушли в ярус
+        shard.compressed.setBudget(tier_slots * block_size);
+        ShardLock lock(shard.mutex);
+        shard.target = shard.budget - tier_slots;
+        ok = resizeShard(shard, lock, shard.target) && ok;
+    }
+    return ok;
+}
+
+// Делит slots слотов бюджета между шардами, под budget_mutex. Шарды растут
+// сразу, а ужимает их фоновый поток: вытеснение может ждать записи.
+void NRUCache::applyBudget(size_t slots) {
+    budget_blocks = slots;
+    bool shrink = false;
+    for (auto &shard_ptr: shards) {
+        Shard &shard = *shard_ptr;
+        size_t budget = slots / shards.size() + (shard.id < slots % shards.size() ? 1 : 0);
+        size_t tier_slots = static_cast<size_t>(compressed_share * budget);
+        // Ярус при смене бюджета сбрасывается, так что его не трогаем зря
+        if (shard.compressed.budget() != tier_slots * block_size / CompressedTier::chunk_size *
+                                         CompressedTier::chunk_size)
+            shard.compressed.setBudget(tier_slots * block_size);
+        ShardLock lock(shard.mutex);
+        shard.budget = budget;
+        shard.target = budget - tier_slots;
+        if (shard.target > shard.capacity) resizeShard(shard, lock, shard.target);
+        if (shard.target < shard.capacity) shrink = true;
+    }
+    if (!shrink) return;
+    {
+        std::lock_guard<std::mutex> lock(flusher_mutex);
+        trim_pending = true;
+    }
+    flusher_cv.notify_one();
+}
+
+// Ужимает шарды до target по trim_step слотов за блокировку, пока есть
+// что вытеснять; true - какой-то шард остался больше (блоки закреплены)
+bool NRUCache::trimShards() {
+    bool left = true;
+    bool progress = true;
+    while (left && progress) {
+        left = progress = false;
+        for (auto &shard_ptr: shards) {
+            Shard &shard = *shard_ptr;
+            ShardLock lock(shard.mutex);
+            if (shard.capacity <= shard.target) continue;
+            size_t before = shard.capacity;
+            resizeShard(shard, lock, std::max(shard.target, before - std::min(before, trim_step)));
+            if (shard.capacity < before) progress = true;
+            if (shard.capacity > shard.target) left = true;
+        }
+    }
+    return left;
+}
+
+bool NRUCache::setBudget(size_t bytes) {
+    size_t slots = bytes / block_size;
+    if (slots < shards.size() * min_shard_blocks || slots > shards.size() * shards[0]->blocks.size())
+        return false;
+    std::lock_guard<std::mutex> guard(budget_mutex);
+    budget_limit = slots;
+    applyBudget(slots);
+    return true;
+}
+
+// Доля времени some avg10 из файла PSI, в процентах; -1 - не прочесть
+static double readPressure(const char *path) {
+    FILE *in = fopen(path, "r");
+    if (!in) return -1;
+    double avg10 = -1;
+    char line[256];
+    while (fgets(line, sizeof(line), in)) {
+        if (sscanf(line, "some avg10=%lf", &avg10) == 1) break;
+    }
+    fclose(in);
+    return avg10;
+}
+
+// Один опрос давления: ужимает бюджет на 1/8 заданного при давлении не
+// ниже limit и возвращает его так же, когда оно ниже limit / 2
+void NRUCache::checkPressure(const std::string &path, double limit) {
+    double pressure = readPressure(path.c_str());
+    if (pressure < 0) return;
+    std::lock_guard<std::mutex> guard(budget_mutex);
+    size_t step = std::max<size_t>(1, budget_limit / 8);
+    size_t floor = std::max(budget_limit / 4, std::min(budget_limit, shards.size() * min_shard_blocks));
+    size_t slots = budget_blocks;
+    if (pressure >= limit && slots > floor) {
+        applyBudget(std::max(floor, slots - std::min(slots, step)));
+        ++pressure_shrinks;
+    } else if (pressure < limit / 2 && slots < budget_limit) {
+        applyBudget(std::min(budget_limit, slots + step));
+    }
+}
+
+bool NRUCache::setPressureWatch(const char *path, double limit, unsigned interval_ms) {
+    bool enable = path && *path && interval_ms > 0;
+    if (enable && readPressure(path) < 0) return false;
+    {
+        std::lock_guard<std::mutex> lock(flusher_mutex);
+        pressure_path = enable ? path : "";
+        pressure_limit = limit;
+        pressure_interval = std::chrono::milliseconds(enable ? interval_ms : 0);
+        pressure_checked = std::chrono::steady_clock::now();
+    }
+    flusher_cv.notify_one();
+    if (!enable) {
+        std::lock_guard<std::mutex> guard(budget_mutex);
+        if (budget_blocks != budget_limit) applyBudget(budget_limit);
+    }
+    return true;
+}
+
+CacheStats NRUCache::stats() {
+    CacheStats total{};
+    total.arena_pages = ArenaPages::Huge;
+    for (auto &shard_ptr: shards) {
+        // Арена не меняется после создания, блокировка не нужна
+        total.arena_bytes += shard_ptr->arena.mappedBytes();
+        total.arena_pages = std::min(total.arena_pages, shard_ptr->arena.pages());
+        ShardLock lock(shard_ptr->mutex);
+        const ShardStats &s = shard_ptr->stats;
+        total.hits += s.hits;
+        total.misses += s.misses;
+        total.prefetch_issued += s.prefetch_issued;
+        total.prefetch_hits += s.prefetch_hits;
+        total.prefetch_wasted += s.prefetch_wasted;
+        total.evict_writebacks += s.evict_writebacks;
+        total.reads_avoided += s.reads_avoided;
+        total.fill_reads += s.fill_reads;
+        total.scan_inserts += s.scan_inserts;
+        total.extent_loads += s.extent_loads;
+        total.warm_blocks += s.warm_blocks;
+        total.local_hits += s.local_hits;
+        total.remote_hits += s.remote_hits;
+        total.index_entries += shard_ptr->index.size();
+        total.capacity_blocks += shard_ptr->capacity;
+        for (size_t i = 0; i < 4; ++i) total.evictions[i] += s.evictions[i];
+        total.bytes_read += s.bytes_read;
+        total.bytes_written += s.bytes_written;
+        shard_ptr->hit_latency.addTo(total.hit_latency);
+        shard_ptr->miss_latency.addTo(total.miss_latency);
+        lock.unlock();
+        shard_ptr->compressed.addStats(total.compressed);
+    }
+    sync_latency.addTo(total.sync_latency);
+    total.numa_nodes = static_cast<uint32_t>(numa_nodes);
+    total.numa_bound = numa_bound;
+    total.dirty_blocks = dirty_blocks;
+    total.flushed_blocks = flushed_blocks;
+    total.flush_writes = flush_writes;
+    total.bypassed_blocks = bypassed_blocks;
+    total.read_requests = read_requests;
+    total.shared_hits = shared_hits;
+    total.budget_bytes = budget_blocks * block_size;
+    total.pressure_shrinks = pressure_shrinks;
+    total.bytes_read += total.bypassed_blocks * block_size;
+    return total;
+}
+
+void NRUCache::dumpStats(FILE *out) {
+    CacheStats s = stats();
+    uint64_t lookups = s.hits + s.misses;
+    fprintf(out, "cache (%s): hits %llu, misses %llu, hit ratio %.1f%%\n", replacementName(replacement),
+            (unsigned long long) s.hits, (unsigned long long) s.misses,
+            lookups ? 100.0 * s.hits / lookups : 0.0);
+    fprintf(out, "  evictions by class: %llu %llu %llu %llu, evict writebacks %llu\n",
+            (unsigned long long) s.evictions[0], (unsigned long long) s.evictions[1],
+            (unsigned long long) s.evictions[2], (unsigned long long) s.evictions[3],
+            (unsigned long long) s.evict_writebacks);
+    fprintf(out, "  readahead: issued %llu, used %llu, wasted %llu, warm-up %llu; scan inserts %llu, "
+            "bypassed %llu\n", (unsigned long long) s.prefetch_issued, (unsigned long long) s.prefetch_hits,
+            (unsigned long long) s.prefetch_wasted, (unsigned long long) s.warm_blocks,
+            (unsigned long long) s.scan_inserts, (unsigned long long) s.bypassed_blocks);
+    fprintf(out, "  extents: loads %llu, index entries %llu, read requests %llu\n",
+            (unsigned long long) s.extent_loads, (unsigned long long) s.index_entries,
+            (unsigned long long) s.read_requests);
+    SharedTierStats shared;
+    if (sharedStats(&shared)) {
+        fprintf(out, "  shared tier: %llu/%llu blocks, hits %llu (%llu here), misses %llu, evictions %llu, "
+                "%u processes\n", (unsigned long long) shared.resident, (unsigned long long) shared.blocks,
+                (unsigned long long) shared.hits, (unsigned long long) s.shared_hits,
+                (unsigned long long) shared.misses, (unsigned long long) shared.evictions, shared.attached);
+    }
+    fprintf(out, "  arena: %llu bytes, %s pages, %llu slots in use, budget %llu bytes, pressure shrinks %llu\n",
+            (unsigned long long) s.arena_bytes, arenaPagesName(s.arena_pages),
+            (unsigned long long) s.capacity_blocks, (unsigned long long) s.budget_bytes,
+            (unsigned long long) s.pressure_shrinks);
+    const CompressedTierStats &c = s.compressed;
+    if (c.budget_bytes > 0) {
+        uint64_t probes = c.hits + c.misses;
+        fprintf(out, "  compressed tier: %llu blocks in %llu/%llu bytes (%.2fx), hits %llu, misses %llu, "
+                "hit ratio %.1f%%, stored %llu, rejected %llu, dropped %llu, evicted %llu, compress %.0f ns/block, "
+                "decompress %.0f ns/block\n",
+                (unsigned long long) c.blocks, (unsigned long long) c.stored_bytes,
+                (unsigned long long) c.budget_bytes,
+                c.stored_bytes ? (double) c.blocks * block_size / c.stored_bytes : 0.0,
+                (unsigned long long) c.hits, (unsigned long long) c.misses,
+                probes ? 100.0 * c.hits / probes : 0.0, (unsigned long long) c.stored,
+                (unsigned long long) c.rejected, (unsigned long long) c.dropped, (unsigned long long) c.evicted,
+                c.stored + c.rejected ? (double) c.compress_ns / (c.stored + c.rejected) : 0.0,
+                c.hits ? (double) c.decompress_ns / c.hits : 0.0);
+    }
+    VictimFileStats victim;
+    if (victimStats(&victim)) {
+        uint64_t probes = victim.hits + victim.misses;
+        fprintf(out, "  victim file: %llu/%llu blocks (%llu restored), hits %llu, misses %llu, hit ratio %.1f%%, "
+                "spilled %llu, dropped %llu, corrupt %llu, read %.0f ns/block\n",
+                (unsigned long long) victim.resident, (unsigned long long) victim.slots,
+                (unsigned long long) victim.restored, (unsigned long long) victim.hits,
+                (unsigned long long) victim.misses, probes ? 100.0 * victim.hits / probes : 0.0,
+                (unsigned long long) victim.spilled, (unsigned long long) victim.dropped,
+                (unsigned long long) victim.corrupt, victim.hits ? (double) victim.read_ns / victim.hits : 0.0);
+    }
+    if (s.numa_nodes > 1) {
+        fprintf(out, "  numa: %u nodes (%s), local hits %llu, remote hits %llu\n", s.numa_nodes,
+                s.numa_bound ? "bound" : "simulated", (unsigned long long) s.local_hits,
+                (unsigned long long) s.remote_hits);
+    }
+    fprintf(out, "  backend: read %llu bytes, written %llu bytes, dirty %llu, flushed %llu\n",
+            (unsigned long long) s.bytes_read, (unsigned long long) s.bytes_written,
+            (unsigned long long) s.dirty_blocks, (unsigned long long) s.flushed_blocks);
+    const LatencyHistogram *hists[] = {&s.hit_latency, &s.miss_latency, &s.sync_latency};
+    const char *names[] = {"hit", "miss", "sync"};
+    for (size_t i = 0; i < 3; ++i) {
+        fprintf(out, "  %s latency: %llu ops, p50 < %llu ns, p99 < %llu ns\n", names[i],
+                (unsigned long long) hists[i]->total(), (unsigned long long) hists[i]->percentile(0.5),
+                (unsigned long long) hists[i]->percentile(0.99));
+    }
+    fflush(out);
+}
+
+void NRUCache::setStatsDump(unsigned interval_ms, FILE *out) {
+    {
+        std::lock_guard<std::mutex> lock(flusher_mutex);
+        stats_dump_interval = std::chrono::milliseconds(interval_ms);
+        stats_dump_out = out;
+        stats_dumped = std::chrono::steady_clock::now();
+    }
+    flusher_cv.notify_one();
+}
+
+// Рабочий набор файла по его спискам в шардах: экстенты, которые уже
+// прочитаны и хотя бы раз затребованы, и отметки файла на диске
+void NRUCache::captureManifest(FileHandleInternal &file, ManifestFile &out) {
+    out.dev = file.dev;
+    out.ino = file.ino;
+    out.extents.clear();
+    for (auto &shard_ptr: shards) {
+        Shard &shard = *shard_ptr;
+        ShardLock lock(shard.mutex);
+        for (uint32_t slot = file.shard_blocks[shard.id].resident; slot != BlockIndex::npos;) {
+            const CacheBlock &block = shard.blocks[slot];
+            slot = block.file_next;
+            if (block.loading || block.prefetched) continue;
+            out.extents.push_back({static_cast<uint64_t>(block.block_number), block.span, block.accessed});
+        }
+    }
+    std::sort(out.extents.begin(), out.extents.end(), [](const ManifestExtent &a, const ManifestExtent &b) {
+        return a.block_number < b.block_number;
+    });
+    out.size = backend->fileSize(file.handle);
+    out.mtime = backend->modifiedTime(file.handle);
+}
+
+// Манифест - наборы открытых файлов из кэша и запомненные наборы остальных.
+// flush - сперва дописать грязные блоки, чтобы отметки файлов на диске
+// соответствовали сохраненному.
+bool NRUCache::writeManifestNow(bool flush) {
+    std::string path;
+    {
+        std::lock_guard<std::mutex> lock(manifest_mutex);
+        path = manifest_path;
+    }
+    if (path.empty()) return false;
+
+    std::vector<FilePtr> open;
+    {
+        std::shared_lock<std::shared_mutex> lock(files_mutex);
+        for (auto &pair: files_by_id) {
+            if (!pair.second->closed) open.push_back(pair.second);
+        }
+    }
+    std::vector<ManifestFile> files(open.size());
+    for (size_t i = 0; i < open.size(); ++i) {
+        if (flush) flushFileBlocks(*open[i], false);
+        captureManifest(*open[i], files[i]);
+    }
+    std::lock_guard<std::mutex> lock(manifest_mutex);
+    for (auto &pair: manifest_files) {
+        bool is_open = std::any_of(files.begin(), files.end(), [&](const ManifestFile &file) {
+            return file.dev == pair.second.dev && file.ino == pair.second.ino;
+        });
+        if (!is_open) files.push_back(pair.second);
+    }
+    return writeManifest(path.c_str(), block_size, files);
+}
+
+bool NRUCache::setManifest(const char *path, unsigned interval_ms) {
+    bool enabled = path && *path;
+    std::vector<ManifestFile> saved;
+    bool ok = !enabled || readManifest(path, block_size, saved);
+    {
+        std::lock_guard<std::mutex> lock(manifest_mutex);
+        manifest_path = enabled ? path : "";
+        manifest_files.clear();
+        for (ManifestFile &file: saved) {
+            auto key = std::make_pair(file.dev, file.ino);
+            manifest_files[key] = std::move(file);
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(flusher_mutex);
+        manifest_interval = std::chrono::milliseconds(enabled ? interval_ms : 0);
+        manifest_saved = std::chrono::steady_clock::now();
+    }
+    flusher_cv.notify_one();
+    return ok;
+}
+
+bool NRUCache::saveManifest() {
+    return writeManifestNow(true);
+}
+
+
+int NRUCache::openFile(const char *path, int flags) {
+    bool mapped = flags & open_mmap;
+    // Отображение идет через кэш страниц, небуферизованный режим ему не нужен
+    NativeHandle handle = backend->openFile(path, direct_io && !mapped);
+    if (handle == INVALID_NATIVE_HANDLE) return -1;
+
+    std::pair<uint64_t, uint64_t> identity;
+    bool identified = !mapped && backend->fileId(handle, &identity.first, &identity.second);
+    int64_t modified = identified ? backend->modifiedTime(handle) : -1;
+    auto open = std::make_shared<OpenFileInternal>();
+    if (identified) {
+        // Уже открытый файл: новый дескриптор на тех же блоках. Файл, который
+        // как раз закрывается последним дескриптором, сперва дописывается и
+        // уходит из кэша, иначе новое открытие прочло бы с диска старые данные.
+        std::unique_lock<std::shared_mutex> lock(files_mutex);
+        for (;;) {
+            auto it = files_by_id.find(identity);
+            if (it == files_by_id.end()) break;
+            if (it->second->closed) {
+                file_closed.wait(lock);
+                continue;
+            }
+            open->file = it->second;
+            ++open->file->opens;
+            int fd = next_fd++;
+            open_files[fd] = std::move(open);
+            lock.unlock();
+            backend->closeFile(handle);
+            return fd;
+        }
+    }
+
+    // Дескриптор закрывается, когда файл отпустит последняя операция
+    StorageBackend *io = backend.get();
+    FilePtr file(new FileHandleInternal, [io](FileHandleInternal *f) {
+        if (f->map) io->unmapFile(f->map, f->map_length);
+        io->closeFile(f->handle);
+        delete f;
+    });
+    file->handle = handle;
+    file->path = path;
+    file->size = std::max<off_t>(0, backend->fileSize(handle));
+    file->shard_blocks.resize(shards.size());
+    file->mapped = mapped;
+    file->shareable = identified;
+    file->dev = identity.first;
+    file->ino = identity.second;
+    if ((flags & open_local) && numa_nodes > 1) file->node = callerNode();
+    if (mapped && file->size > 0 && !growMapped(*file, file->size)) return -1;
+
+    std::unique_lock<std::shared_mutex> lock(files_mutex);
+    if (identified) {
+        // Тот же файл могли открыть параллельно - берется первый
+        auto inserted = files_by_id.emplace(identity, file);
+        if (!inserted.second) {
+            lock.unlock();
+            return openFile(path, flags);
+        }
+        // Под блокировкой файлов, чтобы не разминуться с подключением яруса
+        if (VictimFile *victim = victim_file.load()) victim->validate(identity.first, identity.second, modified);
+    }
+    file->id = next_file_id++;
+    file->opens = 1;
+    open->file = file;
+    int fd = next_fd++;
+    open_files[fd] = std::move(open);
+    lock.unlock();
+    if (identified) queueWarmUp(file);
+    return fd;
+}
+
+
+// Доводит размер файла и отображения до end. Отображение в POSIX растет
+// степенями двойки с запасом за концом файла, поэтому дописывание в конец
+// переотображает файл лишь изредка; в Windows отображение длиннее файла
+// удлинило бы сам файл, и оно совпадает с размером.
+bool NRUCache::growMapped(FileHandleInternal &file, off_t end) {
+    std::unique_lock<std::shared_mutex> lock(file.map_mutex);
+    if (end > file.size && backend->resizeFile(file.handle, end) < 0) return false;
+    if (static_cast<size_t>(end) > file.map_length) {
+#ifdef _WIN32
+        size_t length = end;
+#else
+        size_t length = 1 << 20;
+        while (length < static_cast<size_t>(end)) length *= 2;
+#endif
+        if (file.map) backend->unmapFile(file.map, file.map_length);
+        file.map = static_cast<char *>(backend->mapFile(file.handle, length));
+        file.map_length = file.map ? length : 0;
+        if (!file.map) return false;
+        // Файлы этого режима должны помещаться в память - подгружаем сразу
+        backend->adviseMapped(file.map, end, MapAdvice::WillNeed);
     }
+    if (end > file.size) file.size = end;
+    return true;
+}
 
-    file.current_pos += total;
+// Семантика как у блочного чтения: за концом файла нули, результат - count
+ssize_t NRUCache::mappedRead(FileHandleInternal &file, const struct iovec *iov, int iovcnt, off_t offset) {
+    if (offset < 0) return -1;
+    std::shared_lock<std::shared_mutex> lock(file.map_mutex);
+    off_t size = file.size;
+    off_t pos = offset;
+    for (int i = 0; i < iovcnt; ++i) {
+        char *dest = static_cast<char *>(iov[i].iov_base);
+        size_t len = iov[i].iov_len;
+        size_t avail = pos < size ? std::min<size_t>(len, size - pos) : 0;
+        if (avail) memcpy(dest, file.map + pos, avail);
+        if (avail < len) memset(dest + avail, 0, len - avail);
+        pos += len;
+    }
+    return pos - offset;
+}
+
+ssize_t NRUCache::mappedWrite(FileHandleInternal &file, const struct iovec *iov, int iovcnt, off_t offset) {
+    if (offset < 0) return -1;
+    size_t count = 0;
+    for (int i = 0; i < iovcnt; ++i) count += iov[i].iov_len;
+    if (count == 0) return 0;
+    off_t end = offset + count;
+    if (end > file.size && !growMapped(file, end)) return -1;
+
+    std::shared_lock<std::shared_mutex> lock(file.map_mutex);
+    off_t pos = offset;
+    for (int i = 0; i < iovcnt; ++i) {
+        memcpy(file.map + pos, iov[i].iov_base, iov[i].iov_len);
+        pos += iov[i].iov_len;
+    }
+    return count;
+}
+
+// msync измененных страниц отображения, затем сброс файла на диск
+int NRUCache::syncMapped(FileHandleInternal &file) {
+    {
+        std::shared_lock<std::shared_mutex> lock(file.map_mutex);
+        if (file.map && file.size > 0 && backend->syncMapped(file.map, file.size) < 0) return -1;
+    }
+    return backend->syncFile(file.handle);
+}
+
+int NRUCache::closeFile(int fd) {
+    OpenPtr open;
+    FilePtr file;
+    {
+        std::unique_lock<std::shared_mutex> lock(files_mutex);
+        auto it = open_files.find(fd);
+        if (it == open_files.end()) return -1;
+        open = it->second;
+        file = open->file;
+        open_files.erase(it);
+        // Блоки остаются, пока файл открыт другими дескрипторами
+        if (--file->opens > 0) return 0;
+        file->closed = true;
+    }
+
+    if (file->mapped) {
+        syncMapped(*file);
+        return 0;
+    }
+    if (file->shareable) {
+        // Набор закрываемого файла остается в манифесте до следующего открытия
+        ManifestFile saved;
+        bool remember;
+        {
+            std::lock_guard<std::mutex> lock(manifest_mutex);
+            remember = !manifest_path.empty();
+        }
+        if (remember) {
+            flushFileBlocks(*file, false);
+            captureManifest(*file, saved);
+            std::lock_guard<std::mutex> lock(manifest_mutex);
+            manifest_files[{file->dev, file->ino}] = std::move(saved);
+        }
+    }
+    if (!flushFileBlocks(*file, true)) {
+        // Грязные блоки не записались и держат файл: дескриптор остается
+        // открытым, чтобы повторить syncFile или closeFile
+        std::unique_lock<std::shared_mutex> lock(files_mutex);
+        ++file->opens;
+        file->closed = false;
+        open_files[fd] = std::move(open);
+        file_closed.notify_all();
+        errno = EIO;
+        return -1;
+    }
+    for (auto &shard: shards) shard->compressed.dropFile(file->id);
+    backend->syncFile(file->handle);
+    if (file->shareable) {
+        // Копии в файле-ярусе верны файлу в том виде, в каком он закрыт
+        if (VictimFile *victim = victim_file.load())
+            victim->refresh(file->dev, file->ino, backend->modifiedTime(file->handle));
+        std::unique_lock<std::shared_mutex> lock(files_mutex);
+        files_by_id.erase({file->dev, file->ino});
+        file_closed.notify_all();
+    }
+    return 0;
+}
+
+
+ssize_t NRUCache::readFile(int fd, void *buf, size_t count) {
+    OpenPtr open = lookupOpen(fd);
+    if (!open) return -1;
+
+    struct iovec iov = {buf, count};
+    std::lock_guard<std::mutex> pos_lock(open->pos_mutex);
+    ssize_t total = readvAt(*open, &iov, 1, open->current_pos);
+    if (total > 0) open->current_pos += total;
+    return total;
+}
+
+
+ssize_t NRUCache::writeFile(int fd, const void *buf, size_t count) {
+    OpenPtr open = lookupOpen(fd);
+    if (!open) return -1;
+
+    struct iovec iov = {const_cast<void *>(buf), count};
+    std::lock_guard<std::mutex> pos_lock(open->pos_mutex);
+    ssize_t total = writevAt(open->file, &iov, 1, open->current_pos);
+    if (total > 0) open->current_pos += total;
     return total;
 }
 
+ssize_t NRUCache::preadFile(int fd, void *buf, size_t count, off_t offset) {
+    struct iovec iov = {buf, count};
+    return preadvFile(fd, &iov, 1, offset);
+}
+
+ssize_t NRUCache::pwriteFile(int fd, const void *buf, size_t count, off_t offset) {
+    struct iovec iov = {const_cast<void *>(buf), count};
+    return pwritevFile(fd, &iov, 1, offset);
+}
+
+ssize_t NRUCache::preadvFile(int fd, const struct iovec *iov, int iovcnt, off_t offset) {
+    OpenPtr open = lookupOpen(fd);
+    if (!open) return -1;
+    return readvAt(*open, iov, iovcnt, offset);
+}
+
+ssize_t NRUCache::pwritevFile(int fd, const struct iovec *iov, int iovcnt, off_t offset) {
+    FilePtr file = lookupFile(fd);
+    if (!file) return -1;
+    return writevAt(file, iov, iovcnt, offset);
+}
+
+int NRUCache::readAsync(int fd, void *buf, size_t count, off_t offset, uint64_t tag) {
+    OpenPtr open = lookupOpen(fd);
+    if (!open) return -1;
+
+    {
+        std::lock_guard<std::mutex> lock(async_mutex);
+        if (async_stop) return -1;
+        async_queue.push_back({std::move(open), buf, count, offset, tag});
+        ++async_pending;
+        if (async_workers.empty()) {
+            for (size_t i = 0; i < async_threads; ++i)
+                async_workers.emplace_back(&NRUCache::asyncLoop, this);
+        }
+    }
+    async_cv.notify_one();
+    return 0;
+}
+
+size_t NRUCache::pollCompletions(CacheCompletion *out, size_t max, bool wait) {
+    std::unique_lock<std::mutex> lock(async_mutex);
+    if (wait)
+        completion_cv.wait(lock, [this] { return !completions.empty() || async_pending == 0; });
+
+    size_t n = 0;
+    while (n < max && !completions.empty()) {
+        out[n++] = completions.front();
+        completions.pop_front();
+    }
+    return n;
+}
+
+// Память видов переиспользуется потоком: блок под вид со счетчиком ссылок
+// shared_ptr и массивы отпущенного вида ждут следующего makeView
+template <typename T>
+struct ViewAllocator {
+    using value_type = T;
+
+    ViewAllocator() = default;
+
+    template <typename U>
+    ViewAllocator(const ViewAllocator<U> &) {}
+
+    T *allocate(size_t n) {
+        Spare &spare = spareBlock();
+        if (n == 1 && spare.block) return static_cast<T *>(std::exchange(spare.block, nullptr));
+        return static_cast<T *>(::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T *p, size_t n) {
+        Spare &spare = spareBlock();
+        if (n == 1 && !spare.block) spare.block = p;
+        else ::operator delete(p);
+    }
+
+    // Один свободный блок на поток, освобождается при выходе потока
+    struct Spare {
+        void *block{nullptr};
+
+        ~Spare() { ::operator delete(block); }
+    };
+
+    static Spare &spareBlock() {
+        thread_local Spare spare;
+        return spare;
+    }
+
+    template <typename U>
+    bool operator==(const ViewAllocator<U> &) const { return true; }
+
+    template <typename U>
+    bool operator!=(const ViewAllocator<U> &) const { return false; }
+};
+
+NRUCache::ViewSpare &NRUCache::viewSpare() {
+    thread_local ViewSpare spare;
+    return spare;
+}
+
+// Закрепляет блоки участка и собирает вид: блоки одного шарда - под одной
+// блокировкой. Удержание блоков ограничено половиной шарда, чтобы вид не
+// мог закрепить шард целиком.
+CacheViewPtr NRUCache::makeView(int fd, off_t offset, size_t len, bool writable) {
+    FilePtr file = lookupFile(fd);
+    if (!file || file->mapped || len == 0 || offset < 0) return nullptr;
+    off_t first = offset / block_size;
+    off_t last = (offset + len - 1) / block_size;
+    if (static_cast<size_t>(last - first + 1) > shards[0]->capacity / 2) return nullptr;
+
+    auto view = std::allocate_shared<CacheView>(ViewAllocator<CacheView>());
+    size_t count = last - first + 1;
+    ViewSpare &spare = viewSpare();
+    view->parts.swap(spare.parts);
+    view->pinned.swap(spare.pinned);
+    view->parts.resize(count);
+    view->pinned.resize(count);
+    view->cache = this;
+    view->file = file;
+    view->offset = offset;
+    view->length = len;
+    view->writable = writable;
+    for (size_t i = 0; i < count; ++i)
+        view->pinned[i] = {shardFor(*file, first + i).id, BlockIndex::npos, static_cast<uint32_t>(i), 0};
+    std::sort(view->pinned.begin(), view->pinned.end(),
+              [](const CacheView::PinnedBlock &a, const CacheView::PinnedBlock &b) {
+                  return a.shard != b.shard ? a.shard < b.shard : a.part < b.part;
+              });
+
+    off_t end = offset + len;
+    for (size_t i = 0; i < count;) {
+        Shard &shard = *shards[view->pinned[i].shard];
+        ShardLock lock(shard.mutex);
+        for (; i < count && view->pinned[i].shard == shard.id; ++i) {
+            CacheView::PinnedBlock &pin = view->pinned[i];
+            off_t bn = first + pin.part;
+            off_t block_start = bn * block_size;
+            off_t part_start = std::max(offset, block_start);
+            off_t part_end = std::min(end, static_cast<off_t>(block_start + block_size));
+            size_t block_offset = part_start - block_start;
+            size_t bytes = part_end - part_start;
+
+            CacheBlock *block = acquireBlock(shard, lock, *file, file->id, bn,
+                                             writable ? LoadMode::Overwrite : LoadMode::Read);
+            uint64_t old_valid = block ? block->valid : 0;
+            bool ready = block != nullptr;
+            if (ready && writable) {
+                ready = prepareWrite(shard, lock, block, block_offset, bytes);
+            } else if (ready) {
+                uint64_t mask = validMask(block_offset, bytes);
+                ready = (block->valid & mask) == mask || fillBlock(shard, lock, block);
+            }
+            if (!ready) {
+                // Отпускаются только уже закрепленные
+                view->pinned.resize(i);
+                lock.unlock();
+                abandonView(*view);
+                return nullptr;
+            }
+            ++block->pins;
+            pin.slot = static_cast<uint32_t>(block - shard.blocks.data());
+            pin.claimed = writable ? block->valid & ~old_valid : 0;
+            view->parts[pin.part] = {block->data + block_offset, bytes};
+        }
+    }
+    return view;
+}
+
+// Отмена недособранного вида для записи: объявленные им части блоков
+// снова недостоверны, потому что данных в них никто не записал
+void NRUCache::abandonView(CacheView &view) {
+    for (size_t i = 0; i < view.pinned.size();) {
+        Shard &shard = *shards[view.pinned[i].shard];
+        ShardLock lock(shard.mutex);
+        for (; i < view.pinned.size() && view.pinned[i].shard == shard.id; ++i)
+            shard.blocks[view.pinned[i].slot].valid &= ~view.pinned[i].claimed;
+    }
+    view.committed = true;
+}
+
+// Помечает блоки вида грязными и расширяет логический размер файла
+void NRUCache::commitView(CacheView &view) {
+    for (size_t i = 0; i < view.pinned.size();) {
+        Shard &shard = *shards[view.pinned[i].shard];
+        ShardLock lock(shard.mutex);
+        for (; i < view.pinned.size() && view.pinned[i].shard == shard.id; ++i)
+            markDirty(shard, &shard.blocks[view.pinned[i].slot]);
+    }
+    off_t end = view.offset + view.length;
+    off_t size = view.file->size.load();
+    while (size < end && !view.file->size.compare_exchange_weak(size, end)) {}
+    view.committed = true;
+}
+
+// Открепляет блоки и оставляет массивы вида потоку для следующего
+void NRUCache::releaseView(CacheView *view) {
+    if (view->writable && !view->committed) commitView(*view);
+    for (size_t i = 0; i < view->pinned.size();) {
+        Shard &shard = *shards[view->pinned[i].shard];
+        ShardLock lock(shard.mutex);
+        for (; i < view->pinned.size() && view->pinned[i].shard == shard.id; ++i)
+            --shard.blocks[view->pinned[i].slot].pins;
+        shard.unpinned.notify_all();
+    }
+    ViewSpare &spare = viewSpare();
+    if (view->parts.capacity() > spare.parts.capacity()) {
+        view->parts.clear();
+        view->parts.swap(spare.parts);
+    }
+    if (view->pinned.capacity() > spare.pinned.capacity()) {
+        view->pinned.clear();
+        view->pinned.swap(spare.pinned);
+    }
+}
+
+CacheView::~CacheView() {
+    if (cache) cache->releaseView(this);
+}
+
+CacheViewPtr NRUCache::readView(int fd, off_t offset, size_t len) {
+    return makeView(fd, offset, len, false);
+}
+
+CacheViewPtr NRUCache::writeBegin(int fd, off_t offset, size_t len) {
+    return makeView(fd, offset, len, true);
+}
+
+int NRUCache::writeCommit(const CacheViewPtr &view) {
+    if (!view || !view->writable || view->committed) return -1;
+    commitView(*view);
+    return 0;
+}
+
 off_t NRUCache::seekFile(int fd, off_t offset, int whence) {
-    auto it = open_files.find(fd);
-    if (it == open_files.end()) return -1;
+    OpenPtr open = lookupOpen(fd);
+    if (!open) return -1;
 
-    LARGE_INTEGER size;
+    std::lock_guard<std::mutex> pos_lock(open->pos_mutex);
+    const FileHandleInternal &file = *open->file;
+    off_t size;
     switch (whence) {
-        case SEEK_SET: it->second.current_pos = offset;
+        case SEEK_SET: open->current_pos = offset;
             break;
-        case SEEK_CUR: it->second.current_pos += offset;
+        case SEEK_CUR: open->current_pos += offset;
             break;
         case SEEK_END:
-            GetFileSizeEx(it->second.hFile, &size);
-            it->second.current_pos = size.QuadPart + offset;
+            size = std::max(file.size.load(), backend->fileSize(file.handle));
+            open->current_pos = size + offset;
             break;
         default: return -1;
     }
-    return it->second.current_pos;
+    return open->current_pos;
 }
 
 int NRUCache::syncFile(int fd) {
-    auto it = open_files.find(fd);
-    if (it == open_files.end()) return -1;
+    FilePtr file = lookupFile(fd);
+    if (!file) return -1;
 
-    for (auto &pair: cache_map) {
-        CacheBlock *block = pair.second;
-        if (block->fd == fd && block->dirty)
-            writeBackBlock(block);
+    if (file->mapped) return syncMapped(*file);
+    int64_t started = nowNs();
+    bool flushed = flushFileBlocks(*file, false);
+    int result = backend->syncFile(file->handle);
+    sync_latency.record(nowNs() - started);
+    if (!flushed) {
+        errno = EIO;
+        return -1;
     }
-
-    FlushFileBuffers(it->second.hFile);
-    return 0;
+    return result;
 }
@@ -0,0 +1,128 @@
+#include "numa_topology.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#elif defined(__linux__)
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+#if !defined(_WIN32) && defined(__linux__)
+// Разбирает список sysfs вида "0-3,8,10-11"; пустой - файла нет
+std::vector<int> readList(const std::string &path) {
+    std::vector<int> out;
+    FILE *in = fopen(path.c_str(), "r");
+    if (!in) return out;
+    int lo, hi;
+    while (fscanf(in, "%d", &lo) == 1) {
+        hi = lo;
+        int sep = fgetc(in);
+        if (sep == '-') {
+            if (fscanf(in, "%d", &hi) != 1) break;
+            sep = fgetc(in);
+        }
+        for (int i = lo; i <= hi; ++i) out.push_back(i);
+        if (sep != ',') break;
+    }
+    fclose(in);
+    return out;
+}
+
+// Узел каждого процессора, -1 - процессор выключен
+const std::vector<int> &cpuNodes() {
+    static const std::vector<int> nodes = [] {
+        std::vector<int> map;
+        for (int node: readList("/sys/devices/system/node/online")) {
+            for (int cpu: readList("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist")) {
+                if (cpu >= static_cast<int>(map.size())) map.resize(cpu + 1, -1);
+                map[cpu] = node;
+            }
+        }
+        return map;
+    }();
+    return nodes;
+}
+#endif
+
+} // namespace
+
+size_t numaNodeCount() {
+#ifdef _WIN32
+    ULONG highest = 0;
+    return GetNumaHighestNodeNumber(&highest) ? highest + 1 : 1;
+#elif defined(__linux__)
+    static const size_t count = [] {
+        std::vector<int> online = readList("/sys/devices/system/node/online");
+        return online.empty() ? size_t(1) : static_cast<size_t>(online.back()) + 1;
+    }();
+    return count;
+#else
+    return 1;
+#endif
+}
+
+int currentNumaNode() {
+#ifdef _WIN32
+    PROCESSOR_NUMBER cpu;
+    GetCurrentProcessorNumberEx(&cpu);
+    USHORT node = 0;
+    return GetNumaProcessorNodeEx(&cpu, &node) ? node : 0;
+#elif defined(__linux__)
+    if (numaNodeCount() == 1) return 0;
+    int cpu = sched_getcpu();
+    const std::vector<int> &nodes = cpuNodes();
+    return cpu >= 0 && cpu < static_cast<int>(nodes.size()) && nodes[cpu] >= 0 ? nodes[cpu] : 0;
+#else
+    return 0;
+#endif
+}
+
+bool bindThreadToNode(int node) {
+    if (node < 0 || static_cast<size_t>(node) >= numaNodeCount()) return false;
+#ifdef _WIN32
+    GROUP_AFFINITY affinity{};
+    return GetNumaNodeProcessorMaskEx(static_cast<USHORT>(node), &affinity) &&
+           SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr);
+#elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    bool any = false;
+    const std::vector<int> &nodes = cpuNodes();
+    for (size_t cpu = 0; cpu < nodes.size() && cpu < CPU_SETSIZE; ++cpu) {
+        if (nodes[cpu] != node) continue;
+        CPU_SET(cpu, &set);
+        any = true;
+    }
+    return any && sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+}
+
+bool bindMemoryToNode(void *addr, size_t length, int node) {
+    if (node < 0 || static_cast<size_t>(node) >= numaNodeCount()) return false;
+#if defined(__linux__) && defined(SYS_mbind)
+    // Маска узлов для mbind; ядро читает maxnode - 1 бит
+    constexpr size_t bits = 8 * sizeof(unsigned long);
+    std::vector<unsigned long> mask(node / bits + 1, 0);
+    mask[node / bits] |= 1ul << (node % bits);
+    unsigned long maxnode = mask.size() * bits + 1;
+    // Строгая привязка; если ядро ее не примет, узел хотя бы предпочтителен
+    long rc = syscall(SYS_mbind, addr, length, MPOL_BIND, mask.data(), maxnode, MPOL_MF_MOVE);
+    if (rc != 0) rc = syscall(SYS_mbind, addr, length, MPOL_PREFERRED, mask.data(), maxnode, MPOL_MF_MOVE);
+    return rc == 0;
+#else
+    // В Windows узел памяти задается только при выделении (VirtualAllocExNuma)
+    (void) addr;
+    (void) length;
+    return false;
+#endif
+}
@@ -0,0 +1,199 @@
+#include "storage_backend.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+class PosixBackend : public StorageBackend {
+public:
+    NativeHandle openFile(const char *path, bool direct_io) override {
+        return openWith(path, O_RDWR, direct_io);
+    }
+
+    NativeHandle createFile(const char *path, bool direct_io) override {
+        return openWith(path, O_RDWR | O_CREAT, direct_io);
+    }
+
+    void closeFile(NativeHandle handle) override {
+        ::close(handle);
+    }
+
+    ssize_t readAt(NativeHandle handle, void *buf, size_t count, off_t offset) override {
+        char *dest = static_cast<char *>(buf);
+        size_t done = 0;
+        while (done < count) {
+            ssize_t n = ::pread(handle, dest + done, count - done, offset + done);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return -1;
+            }
+            if (n == 0) break; // EOF
+            done += n;
+        }
+        return done;
+    }
+
+    ssize_t writeAt(NativeHandle handle, const void *buf, size_t count, off_t offset) override {
+        const char *src = static_cast<const char *>(buf);
+        size_t done = 0;
+        while (done < count) {
+            ssize_t n = ::pwrite(handle, src + done, count - done, offset + done);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return -1;
+            }
+            done += n;
+        }
+        return done;
+    }
+
+    ssize_t readvAt(NativeHandle handle, const struct iovec *iov, int iovcnt, off_t offset) override {
+        // Копия вектора: при частичном чтении он сдвигается на прочитанное
+        std::vector<struct iovec> rest(iov, iov + iovcnt);
+        size_t first = 0;
+        size_t done = 0;
+        while (first < rest.size()) {
+            int batch = static_cast<int>(std::min<size_t>(rest.size() - first, IOV_MAX));
+            ssize_t n = ::preadv(handle, rest.data() + first, batch, offset + done);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return -1;
+            }
+            if (n == 0) break; // EOF
+            done += n;
+            while (n > 0 && first < rest.size()) {
+                size_t part = std::min<size_t>(n, rest[first].iov_len);
+                rest[first].iov_base = static_cast<char *>(rest[first].iov_base) + part;
+                rest[first].iov_len -= part;
+                n -= part;
+                if (rest[first].iov_len == 0) ++first;
+            }
+        }
+        return done;
+    }
+
+    ssize_t writevAt(NativeHandle handle, const struct iovec *iov, int iovcnt, off_t offset) override {
+        // Копия вектора: при частичной записи он сдвигается на записанное
+        std::vector<struct iovec> rest(iov, iov + iovcnt);
+        size_t first = 0;
+        size_t done = 0;
+        while (first < rest.size()) {
+            int batch = static_cast<int>(std::min<size_t>(rest.size() - first, IOV_MAX));
+            ssize_t n = ::pwritev(handle, rest.data() + first, batch, offset + done);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return -1;
+            }
+            done += n;
+            while (n > 0 && first < rest.size()) {
+                size_t part = std::min<size_t>(n, rest[first].iov_len);
+                rest[first].iov_base = static_cast<char *>(rest[first].iov_base) + part;
+                rest[first].iov_len -= part;
+                n -= part;
+                if (rest[first].iov_len == 0) ++first;
+            }
+        }
+        return done;
+    }
+
+    int syncFile(NativeHandle handle) override {
+        return ::fdatasync(handle);
+    }
+
+    off_t fileSize(NativeHandle handle) override {
+        struct stat st{};
+        if (::fstat(handle, &st) < 0) return -1;
+        return st.st_size;
+    }
+
+    int resizeFile(NativeHandle handle, off_t size) override {
+        return ::ftruncate(handle, size);
+    }
+
+    int allocateFile(NativeHandle handle, off_t size) override {
+#ifdef __linux__
+        int error = ::posix_fallocate(handle, 0, size);
+        if (error == 0) return 0;
+        // ФС без выделения места (часть сетевых) - хотя бы нужная длина
+        if (error != EOPNOTSUPP && error != EINVAL) return -1;
+#endif
+        struct stat st{};
+        if (::fstat(handle, &st) < 0) return -1;
+        return st.st_size >= size ? 0 : ::ftruncate(handle, size);
+    }
+
+    bool fileId(NativeHandle handle, uint64_t *dev, uint64_t *ino) override {
+        struct stat st{};
+        if (::fstat(handle, &st) < 0) return false;
+        *dev = st.st_dev;
+        *ino = st.st_ino;
+        return true;
+    }
+
+    int64_t modifiedTime(NativeHandle handle) override {
+        struct stat st{};
+        if (::fstat(handle, &st) < 0) return -1;
+#ifdef __APPLE__
+        return st.st_mtimespec.tv_sec * INT64_C(1000000000) + st.st_mtimespec.tv_nsec;
+#else
+        return st.st_mtim.tv_sec * INT64_C(1000000000) + st.st_mtim.tv_nsec;
+#endif
+    }
+
+    void *mapFile(NativeHandle handle, size_t length) override {
+        void *addr = ::mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, handle, 0);
+        return addr == MAP_FAILED ? nullptr : addr;
+    }
+
+    void unmapFile(void *addr, size_t length) override {
+        ::munmap(addr, length);
+    }
+
+    int syncMapped(void *addr, size_t length) override {
+        return ::msync(addr, length, MS_SYNC);
+    }
+
+    void adviseMapped(void *addr, size_t length, MapAdvice advice) override {
+        int hint = MADV_NORMAL;
+        switch (advice) {
+            case MapAdvice::Normal: hint = MADV_NORMAL;
+                break;
+            case MapAdvice::Random: hint = MADV_RANDOM;
+                break;
+            case MapAdvice::Sequential: hint = MADV_SEQUENTIAL;
+                break;
+            case MapAdvice::WillNeed: hint = MADV_WILLNEED;
+                break;
+        }
+        ::madvise(addr, length, hint);
+    }
+
+private:
+    static int openWith(const char *path, int flags, bool direct_io) {
+        int direct = 0;
+#ifdef O_DIRECT
+        if (direct_io) direct = O_DIRECT;
+#endif
+        int fd = ::open(path, flags | direct, 0644);
+        // tmpfs и часть сетевых ФС не поддерживают O_DIRECT
+        if (fd < 0 && direct && errno == EINVAL)
+            fd = ::open(path, flags, 0644);
+        return fd;
+    }
+};
+
+}
+
+std::unique_ptr<StorageBackend> createStorageBackend() {
+#ifdef NRU_CACHE_IO_URING
+    if (auto uring = createUringBackend(std::make_unique<PosixBackend>())) return uring;
+#endif
+    return std::make_unique<PosixBackend>();
+}
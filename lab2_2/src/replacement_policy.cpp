@@ -0,0 +1,683 @@
+#include "replacement_policy.h"
+
+#include <algorithm>
+#include <cstring>
+#include <list>
+#include <set>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace {
+
+constexpr uint32_t npos = UINT32_MAX;
+
+// Интрузивные двусвязные списки слотов; слот состоит не более чем в одном.
+// Голова - недавние блоки, хвост - первые кандидаты на вытеснение.
+class SlotLists {
+public:
+    static constexpr uint8_t none = 0;
+
+    SlotLists(size_t capacity, size_t lists)
+        : prev(capacity), next(capacity), owner(capacity, none),
+          heads(lists + 1, npos), tails(lists + 1, npos), sizes(lists + 1, 0) {}
+
+    void pushFront(uint8_t list, uint32_t slot) {
+        owner[slot] = list;
+        prev[slot] = npos;
+        next[slot] = heads[list];
+        if (heads[list] != npos) prev[heads[list]] = slot;
+        else tails[list] = slot;
+        heads[list] = slot;
+        ++sizes[list];
+    }
+
+    void remove(uint32_t slot) {
+        uint8_t list = owner[slot];
+        if (list == none) return;
+        if (prev[slot] != npos) next[prev[slot]] = next[slot];
+        else heads[list] = next[slot];
+        if (next[slot] != npos) prev[next[slot]] = prev[slot];
+        else tails[list] = prev[slot];
+        owner[slot] = none;
+        --sizes[list];
+    }
+
+    void moveToFront(uint8_t list, uint32_t slot) {
+        remove(slot);
+        pushFront(list, slot);
+    }
+
+    uint8_t listOf(uint32_t slot) const { return owner[slot]; }
+
+    uint32_t tail(uint8_t list) const { return tails[list]; }
+
+    // Сосед ближе к голове
+    uint32_t newer(uint32_t slot) const { return prev[slot]; }
+
+    size_t size(uint8_t list) const { return sizes[list]; }
+
+    // Предлагает кандидатов списка от хвоста к голове; stop - фильтр
+    // прекратил поиск
+    uint32_t scan(uint8_t list, VictimFilter &filter, bool &stop) const {
+        for (uint32_t slot = tails[list]; slot != npos; slot = prev[slot]) {
+            VictimCheck verdict = filter.check(slot);
+            if (verdict == VictimCheck::Take) return slot;
+            if (verdict == VictimCheck::Stop) {
+                stop = true;
+                return npos;
+            }
+        }
+        return npos;
+    }
+
+private:
+    std::vector<uint32_t> prev;
+    std::vector<uint32_t> next;
+    std::vector<uint8_t> owner; // Список, в котором состоит слот
+    std::vector<uint32_t> heads;
+    std::vector<uint32_t> tails;
+    std::vector<size_t> sizes;
+};
+
+// История вытесненных ключей: порядок вытеснения и поиск по ключу.
+// value - данные политики о ключе, например время обращения.
+class GhostList {
+public:
+    size_t size() const { return order.size(); }
+
+    void pushFront(uint64_t key, uint64_t value = 0) {
+        erase(key);
+        order.emplace_front(key, value);
+        where[key] = order.begin();
+    }
+
+    void popBack() {
+        where.erase(order.back().first);
+        order.pop_back();
+    }
+
+    bool erase(uint64_t key) {
+        uint64_t value;
+        return take(key, value);
+    }
+
+    bool take(uint64_t key, uint64_t &value) {
+        auto it = where.find(key);
+        if (it == where.end()) return false;
+        value = it->second->second;
+        order.erase(it->second);
+        where.erase(it);
+        return true;
+    }
+
+private:
+    std::list<std::pair<uint64_t, uint64_t>> order;
+    std::unordered_map<uint64_t, std::list<std::pair<uint64_t, uint64_t>>::iterator> where;
+};
+
+// Часы по слотам шарда: блок с битом обращения получает второй шанс.
+// Блоки низкого приоритета сначала проходят испытательную очередь: она
+// проверяется раньше часов, и блок из нее вытесняется, если к нему не
+// обратились, не задевая биты горячих блоков. Обращение переводит блок
+// в обычные часы.
+class NruPolicy : public ReplacementPolicy {
+public:
+    explicit NruPolicy(size_t capacity)
+        : ReplacementPolicy(false, true), resident(capacity, 0), probation(capacity, 1), hand(0) {}
+
+    void inserted(uint32_t slot, uint64_t, bool low_priority) override {
+        resident[slot] = 1;
+        if (low_priority) probation.pushFront(1, slot);
+    }
+
+    void accessed(uint32_t) override {}
+
+    void removed(uint32_t slot, bool) override {
+        resident[slot] = 0;
+        probation.remove(slot);
+    }
+
+    uint32_t victim(VictimFilter &filter) override {
+        bool in_flight = false;
+        for (uint32_t slot = probation.tail(1); slot != npos;) {
+            uint32_t next = probation.newer(slot);
+            if (filter.referenced(slot)) {
+                // Закрепленный блок еще загружается или копируется - это не
+                // повторное обращение, он остается в очереди
+                if (!filter.pinned(slot)) {
+                    probation.remove(slot);
+                    resident[slot] = 2; // Бит обращения переходит в часы
+                } else if (filter.loading(slot)) {
+                    in_flight = true;
+                }
+            } else {
+                VictimCheck verdict = filter.check(slot);
+                if (verdict == VictimCheck::Take) return slot;
+                if (verdict == VictimCheck::Stop) return npos;
+            }
+            slot = next;
+        }
+        // Очередь занята чтениями потока, которые вот-вот закончатся:
+        // лучше дождаться их, чем вытеснять горячий блок часами
+        if (in_flight) return npos;
+
+        // За два оборота все биты обращения гарантированно сброшены
+        for (size_t step = 0; step < 2 * resident.size(); ++step) {
+            uint32_t slot = static_cast<uint32_t>(hand);
+            hand = (hand + 1) % resident.size();
+            if (!resident[slot] || filter.referenced(slot)) continue;
+            if (resident[slot] == 2) {
+                resident[slot] = 1;
+                continue;
+            }
+            VictimCheck verdict = filter.check(slot);
+            if (verdict == VictimCheck::Take) return slot;
+            if (verdict == VictimCheck::Stop) break;
+        }
+        return npos;
+    }
+
+private:
+    std::vector<uint8_t> resident; // Слот занят блоком; 2 - еще и выпущен из очереди по обращению
+    SlotLists probation;           // Испытательная очередь блоков низкого приоритета
+    size_t hand;                   // Стрелка часов
+};
+
+// LRU; блоки низкого приоритета ждут в испытательной очереди, которая
+// вытесняется раньше основного списка
+class LruPolicy : public ReplacementPolicy {
+public:
+    explicit LruPolicy(size_t capacity) : ReplacementPolicy(true, false), lists(capacity, 2) {}
+
+    void inserted(uint32_t slot, uint64_t, bool low_priority) override {
+        lists.pushFront(low_priority ? probation : recent, slot);
+    }
+
+    void accessed(uint32_t slot) override { lists.moveToFront(recent, slot); }
+
+    void removed(uint32_t slot, bool) override { lists.remove(slot); }
+
+    uint32_t victim(VictimFilter &filter) override {
+        bool stop = false;
+        uint32_t slot = lists.scan(probation, filter, stop);
+        if (slot == npos && !stop) slot = lists.scan(recent, filter, stop);
+        return slot;
+    }
+
+private:
+    static constexpr uint8_t recent = 1;
+    static constexpr uint8_t probation = 2;
+
+    SlotLists lists;
+};
+
+// LRU-K при K = 2: вытесняется блок с самым давним предпоследним
+// обращением, блоки с единственным обращением - раньше всех, по давности
+// его. Время последнего обращения вытесненных блоков помнится, чтобы
+// вернувшийся блок сразу имел два обращения.
+class Lru2Policy : public ReplacementPolicy {
+public:
+    explicit Lru2Policy(size_t capacity)
+        : ReplacementPolicy(true, false), capacity(capacity), where(capacity), keys(capacity), clock(0) {}
+
+    void inserted(uint32_t slot, uint64_t key, bool low_priority) override {
+        uint64_t previous = 0;
+        history.take(key, previous);
+        keys[slot] = key;
+        // Блоки потоков вытесняются раньше всех, между собой - по очереди
+        where[slot] = order.insert({!low_priority, low_priority ? 0 : previous, ++clock, slot}).first;
+    }
+
+    void accessed(uint32_t slot) override {
+        auto node = order.extract(where[slot]);
+        node.value().regular = true;
+        node.value().penultimate = node.value().last;
+        node.value().last = ++clock;
+        where[slot] = order.insert(std::move(node)).position;
+    }
+
+    void removed(uint32_t slot, bool evicted) override {
+        if (evicted) {
+            history.pushFront(keys[slot], where[slot]->last);
+            if (history.size() > capacity) history.popBack();
+        }
+        order.erase(where[slot]);
+    }
+
+    uint32_t victim(VictimFilter &filter) override {
+        for (const Entry &entry: order) {
+            VictimCheck verdict = filter.check(entry.slot);
+            if (verdict == VictimCheck::Take) return entry.slot;
+            if (verdict == VictimCheck::Stop) break;
+        }
+        return npos;
+    }
+
+private:
+    struct Entry {
+        bool regular;         // false - блок потока, к которому еще не обращались
+        uint64_t penultimate; // Предпоследнее обращение, 0 - его не было
+        uint64_t last;        // Последнее обращение или вставка
+        uint32_t slot;
+
+        bool operator<(const Entry &other) const {
+            if (regular != other.regular) return other.regular;
+            if (penultimate != other.penultimate) return penultimate < other.penultimate;
+            return last < other.last;
+        }
+    };
+
+    size_t capacity;
+    std::set<Entry> order;                       // Порядок вытеснения
+    std::vector<std::set<Entry>::iterator> where; // Запись слота в order
+    std::vector<uint64_t> keys;
+    GhostList history;                           // Ключ -> последнее обращение
+    uint64_t clock;                              // Логическое время обращений
+};
+
+// 2Q: впервые прочитанные блоки проходят очередь A1in, вытесненные из нее
+// помнятся в A1out; блок, затребованный снова, попадает в LRU-список Am
+class TwoQPolicy : public ReplacementPolicy {
+public:
+    explicit TwoQPolicy(size_t capacity)
+        : ReplacementPolicy(true, false), lists(capacity, 3), keys(capacity),
+          in_limit(std::max<size_t>(1, capacity / 4)), out_limit(std::max<size_t>(1, capacity / 2)) {}
+
+    void inserted(uint32_t slot, uint64_t key, bool low_priority) override {
+        keys[slot] = key;
+        if (low_priority) lists.pushFront(probation, slot);
+        else admit(slot);
+    }
+
+    void accessed(uint32_t slot) override {
+        // Повторное чтение из A1in считается коррелированным и не продвигает блок;
+        // первое обращение к блоку потока - как вставка обычного блока
+        uint8_t list = lists.listOf(slot);
+        if (list == am) lists.moveToFront(am, slot);
+        else if (list == probation) admit(slot);
+    }
+
+    void removed(uint32_t slot, bool evicted) override {
+        if (evicted && lists.listOf(slot) == a1in) {
+            a1out.pushFront(keys[slot]);
+            if (a1out.size() > out_limit) a1out.popBack();
+        }
+        lists.remove(slot);
+    }
+
+    uint32_t victim(VictimFilter &filter) override {
+        bool stop = false;
+        uint32_t slot = lists.scan(probation, filter, stop);
+        if (slot != npos || stop) return slot;
+        uint8_t first = lists.size(a1in) > in_limit || lists.size(am) == 0 ? a1in : am;
+        slot = lists.scan(first, filter, stop);
+        if (slot == npos && !stop) slot = lists.scan(first == a1in ? am : a1in, filter, stop);
+        return slot;
+    }
+
+private:
+    static constexpr uint8_t a1in = 1;
+    static constexpr uint8_t am = 2;
+    static constexpr uint8_t probation = 3; // Блоки потоков до первого обращения
+
+    SlotLists lists;
+    std::vector<uint64_t> keys;
+    GhostList a1out;  // Вытесненные из A1in
+    size_t in_limit;  // Целевой размер A1in
+    size_t out_limit; // Длина истории A1out
+
+    void admit(uint32_t slot) {
+        lists.remove(slot);
+        lists.pushFront(a1out.erase(keys[slot]) ? am : a1in, slot);
+    }
+};
+
+// ARC: T1 - блоки с одним обращением, T2 - с несколькими, B1 и B2 -
+// история вытесненных из них. Промах, найденный в B1, сдвигает цель p
+// в пользу T1, найденный в B2 - в пользу T2.
+class ArcPolicy : public ReplacementPolicy {
+public:
+    explicit ArcPolicy(size_t capacity)
+        : ReplacementPolicy(true, false), capacity(capacity), lists(capacity, 3), keys(capacity), target(0) {}
+
+    void inserted(uint32_t slot, uint64_t key, bool low_priority) override {
+        keys[slot] = key;
+        if (low_priority) {
+            // Блок потока ждет вне T1 и T2 и не сдвигает цель
+            lists.pushFront(probation, slot);
+            return;
+        }
+        size_t b1_size = b1.size();
+        size_t b2_size = b2.size();
+        if (b1.erase(key)) {
+            target = std::min(capacity, target + std::max<size_t>(1, b2_size / b1_size));
+            lists.pushFront(t2, slot);
+        } else if (b2.erase(key)) {
+            size_t delta = std::max<size_t>(1, b1_size / b2_size);
+            target = target > delta ? target - delta : 0;
+            lists.pushFront(t2, slot);
+        } else {
+            lists.pushFront(t1, slot);
+            trim();
+        }
+    }
+
+    void accessed(uint32_t slot) override {
+        // Первое обращение к блоку потока - как вставка обычного блока
+        bool first = lists.listOf(slot) == probation;
+        lists.moveToFront(first ? t1 : t2, slot);
+        if (first) trim();
+    }
+
+    void removed(uint32_t slot, bool evicted) override {
+        uint8_t list = lists.listOf(slot);
+        lists.remove(slot);
+        if (!evicted || list == probation) return;
+        (list == t1 ? b1 : b2).pushFront(keys[slot]);
+        trim();
+    }
+
+    uint32_t victim(VictimFilter &filter) override {
+        bool stop = false;
+        uint32_t slot = lists.scan(probation, filter, stop);
+        if (slot != npos || stop) return slot;
+        bool from_t1 = lists.size(t1) > 0 && (lists.size(t1) > target || lists.size(t2) == 0);
+        slot = lists.scan(from_t1 ? t1 : t2, filter, stop);
+        if (slot == npos && !stop) slot = lists.scan(from_t1 ? t2 : t1, filter, stop);
+        return slot;
+    }
+
+private:
+    static constexpr uint8_t t1 = 1;
+    static constexpr uint8_t t2 = 2;
+    static constexpr uint8_t probation = 3; // Блоки потоков до первого обращения
+
+    size_t capacity;
+    SlotLists lists;
+    std::vector<uint64_t> keys;
+    GhostList b1;
+    GhostList b2;
+    size_t target; // Целевой размер T1
+
+    // |T1| + |B1| <= c, вся история вместе с блоками <= 2c
+    void trim() {
+        while (lists.size(t1) + b1.size() > capacity && b1.size()) b1.popBack();
+        while (lists.size(t1) + lists.size(t2) + b1.size() + b2.size() > 2 * capacity) {
+            if (b2.size()) b2.popBack();
+            else if (b1.size()) b1.popBack();
+            else break;
+        }
+    }
+};
+
+// CLOCK-Pro: блоки делятся на горячие и холодные, в часах вместе с ними
+// хранятся недавно вытесненные холодные блоки без данных. Новый блок
+// холодный и проходит тестовый период; обращение к нему в этот период
+// (в том числе после вытеснения) делает его горячим и увеличивает долю
+// холодных. Стрелка cold вытесняет холодные, hot охлаждает горячие,
+// test завершает тестовые периоды и ограничивает историю.
+class ClockProPolicy : public ReplacementPolicy {
+public:
+    explicit ClockProPolicy(size_t capacity)
+        : ReplacementPolicy(false, false), capacity(capacity), nodes(2 * capacity), slot_node(capacity, npos),
+          probation(capacity, 1), keys(capacity), hand_hot(npos), hand_cold(npos), hand_test(npos), count_hot(0), count_cold(0), count_test(0),
+          cold_target(std::max<size_t>(1, capacity / 2)) {
+        free_nodes.reserve(nodes.size());
+        for (size_t i = nodes.size(); i > 0; --i) free_nodes.push_back(static_cast<uint32_t>(i - 1));
+    }
+
+    void inserted(uint32_t slot, uint64_t key, bool low_priority) override {
+        if (!low_priority) {
+            admit(slot, key);
+            return;
+        }
+        // Блок потока ждет вне часов до первого обращения и не попадает в историю
+        keys[slot] = key;
+        probation.pushFront(1, slot);
+    }
+
+    void accessed(uint32_t) override {}
+
+    void removed(uint32_t slot, bool evicted) override {
+        if (probation.listOf(slot)) {
+            probation.remove(slot);
+            return;
+        }
+        uint32_t n = slot_node[slot];
+        slot_node[slot] = npos;
+        Node &node = nodes[n];
+        if (node.hot) --count_hot;
+        else --count_cold;
+
+        if (evicted && !node.hot && node.test) {
+            // Тестовый период продолжается без данных
+            auto old = ghosts.find(node.key);
+            if (old != ghosts.end()) freeNode(old->second);
+            node.slot = npos;
+            ghosts[node.key] = n;
+            ++count_test;
+            while (count_test > capacity) runHandTest();
+            return;
+        }
+        node.slot = npos;
+        detachNode(n);
+        free_nodes.push_back(n);
+    }
+
+    uint32_t victim(VictimFilter &filter) override {
+        for (uint32_t slot = probation.tail(1); slot != npos;) {
+            uint32_t next = probation.newer(slot);
+            if (filter.referenced(slot)) {
+                if (!filter.pinned(slot)) {
+                    probation.remove(slot);
+                    admit(slot, keys[slot]);
+                }
+            } else {
+                VictimCheck verdict = filter.check(slot);
+                if (verdict == VictimCheck::Take) return slot;
+                if (verdict == VictimCheck::Stop) return npos;
+            }
+            slot = next;
+        }
+
+        while (count_hot > hotLimit() && runHandHot(filter)) {}
+
+        for (size_t step = 0; step < 2 * nodes.size(); ++step) {
+            if (count_cold == 0 && !runHandHot(filter)) return npos;
+            uint32_t n = hand_cold;
+            Node &node = nodes[n];
+            hand_cold = node.next;
+            if (node.hot || node.slot == npos) continue;
+
+            if (filter.referenced(node.slot)) {
+                if (node.test) {
+                    node.hot = true;
+                    node.test = false;
+                    --count_cold;
+                    ++count_hot;
+                    cold_target = std::min(capacity, cold_target + 1);
+                    while (count_hot > hotLimit() && runHandHot(filter)) {}
+                } else {
+                    // Новый тестовый период с головы списка
+                    node.test = true;
+                    detachNode(n);
+                    linkNode(n);
+                }
+                continue;
+            }
+
+            VictimCheck verdict = filter.check(node.slot);
+            if (verdict == VictimCheck::Take) return node.slot;
+            if (verdict == VictimCheck::Stop) break;
+        }
+        return npos;
+    }
+
+private:
+    struct Node {
+        uint64_t key;
+        uint32_t slot; // npos - блок вытеснен, узел хранит только тестовый период
+        bool hot;
+        bool test;     // Холодный блок в тестовом периоде
+        uint32_t prev; // Соседи по кольцу часов
+        uint32_t next;
+    };
+
+    size_t capacity;
+    std::vector<Node> nodes;                    // Узлы блоков и истории
+    std::vector<uint32_t> free_nodes;
+    std::vector<uint32_t> slot_node;            // Слот -> узел
+    SlotLists probation;                        // Блоки потоков до первого обращения
+    std::vector<uint64_t> keys;                 // Ключи блоков в probation
+    std::unordered_map<uint64_t, uint32_t> ghosts; // Ключ вытесненного -> узел
+    uint32_t hand_hot;  // Самый давний горячий; новые узлы встают перед ним
+    uint32_t hand_cold;
+    uint32_t hand_test;
+    size_t count_hot;   // Горячих блоков
+    size_t count_cold;  // Холодных блоков с данными
+    size_t count_test;  // Узлов истории
+    size_t cold_target; // Целевое число холодных блоков
+
+    size_t hotLimit() const { return capacity > cold_target ? capacity - cold_target : 0; }
+
+    // Ставит блок в часы: промах по истории делает его горячим, иначе он
+    // холодный в тестовом периоде
+    void admit(uint32_t slot, uint64_t key) {
+        auto ghost = ghosts.find(key);
+        bool refault = ghost != ghosts.end();
+        if (refault) {
+            cold_target = std::min(capacity, cold_target + 1);
+            freeNode(ghost->second);
+        }
+
+        uint32_t n = free_nodes.back();
+        free_nodes.pop_back();
+        nodes[n] = {key, slot, refault, !refault, npos, npos};
+        slot_node[slot] = n;
+        linkNode(n);
+        if (refault) ++count_hot;
+        else ++count_cold;
+    }
+
+    // Вставляет узел в голову списка, перед стрелкой hot
+    void linkNode(uint32_t n) {
+        Node &node = nodes[n];
+        if (hand_hot == npos) {
+            node.prev = node.next = n;
+            hand_hot = hand_cold = hand_test = n;
+            return;
+        }
+        Node &head = nodes[hand_hot];
+        node.next = hand_hot;
+        node.prev = head.prev;
+        nodes[head.prev].next = n;
+        head.prev = n;
+    }
+
+    // Вынимает узел из кольца, сдвигая указывающие на него стрелки дальше
+    void detachNode(uint32_t n) {
+        Node &node = nodes[n];
+        uint32_t next = node.next == n ? npos : node.next;
+        for (uint32_t *hand: {&hand_hot, &hand_cold, &hand_test}) {
+            if (*hand == n) *hand = next;
+        }
+        if (next == npos) return;
+        nodes[node.prev].next = node.next;
+        nodes[node.next].prev = node.prev;
+    }
+
+    // Удаляет узел истории
+    void freeNode(uint32_t n) {
+        ghosts.erase(nodes[n].key);
+        --count_test;
+        detachNode(n);
+        free_nodes.push_back(n);
+    }
+
+    // Охлаждает один горячий блок без обращений; попутно завершает
+    // тестовые периоды. false - охладить нечего.
+    bool runHandHot(VictimFilter &filter) {
+        for (size_t step = 0; step < 2 * nodes.size() && hand_hot != npos; ++step) {
+            uint32_t n = hand_hot;
+            Node &node = nodes[n];
+            hand_hot = node.next;
+            if (node.slot == npos) {
+                // Тестовый период истек без повторного обращения
+                cold_target = std::max<size_t>(1, cold_target - 1);
+                freeNode(n);
+                continue;
+            }
+            if (!node.hot) {
+                node.test = false;
+                continue;
+            }
+            if (filter.referenced(node.slot)) continue;
+            node.hot = false;
+            --count_hot;
+            ++count_cold;
+            return true;
+        }
+        return false;
+    }
+
+    // Удаляет один узел истории, завершая пройденные тестовые периоды
+    void runHandTest() {
+        for (size_t step = 0; step < 2 * nodes.size() && hand_test != npos; ++step) {
+            uint32_t n = hand_test;
+            Node &node = nodes[n];
+            hand_test = node.next;
+            if (node.slot == npos) {
+                cold_target = std::max<size_t>(1, cold_target - 1);
+                freeNode(n);
+                return;
+            }
+            if (!node.hot) node.test = false;
+        }
+    }
+};
+
+struct ReplacementName {
+    ReplacementKind kind;
+    const char *name;
+};
+
+const ReplacementName replacement_names[] = {
+    {ReplacementKind::NRU, "nru"},
+    {ReplacementKind::LRU, "lru"},
+    {ReplacementKind::LRU2, "lru2"},
+    {ReplacementKind::TwoQ, "2q"},
+    {ReplacementKind::ARC, "arc"},
+    {ReplacementKind::ClockPro, "clockpro"},
+};
+
+}
+
+const char *replacementName(ReplacementKind kind) {
+    for (const ReplacementName &entry: replacement_names) {
+        if (entry.kind == kind) return entry.name;
+    }
+    return "unknown";
+}
+
+bool parseReplacement(const char *name, ReplacementKind &kind) {
+    for (const ReplacementName &entry: replacement_names) {
+        if (strcmp(entry.name, name) == 0) {
+            kind = entry.kind;
+            return true;
+        }
+    }
+    return false;
+}
+
+std::unique_ptr<ReplacementPolicy> createReplacementPolicy(ReplacementKind kind, size_t capacity) {
+    switch (kind) {
+        case ReplacementKind::LRU: return std::make_unique<LruPolicy>(capacity);
+        case ReplacementKind::LRU2: return std::make_unique<Lru2Policy>(capacity);
+        case ReplacementKind::TwoQ: return std::make_unique<TwoQPolicy>(capacity);
+        case ReplacementKind::ARC: return std::make_unique<ArcPolicy>(capacity);
+        case ReplacementKind::ClockPro: return std::make_unique<ClockProPolicy>(capacity);
+        case ReplacementKind::NRU: break;
+    }
+    return std::make_unique<NruPolicy>(capacity);
+}
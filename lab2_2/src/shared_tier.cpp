@@ -0,0 +1,358 @@
+#include "shared_tier.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <new>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <chrono>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#endif
+
+namespace {
+
+constexpr uint64_t shared_magic = 0x3149544E45524853ull; // "SHRENTI1"
+constexpr uint32_t shared_version = 1;
+constexpr uint32_t npos = UINT32_MAX;
+constexpr size_t max_stripes = 64;
+constexpr size_t page_size = 4096;
+
+size_t alignUp(size_t value, size_t align) {
+    return (value + align - 1) / align * align;
+}
+
+uint64_t hashKey(const SharedBlockKey &key) {
+    uint64_t h = key.block_number * 0x9E3779B97F4A7C15ull ^ key.ino * 0xC2B2AE3D27D4EB4Full ^
+                 key.dev * 0x165667B19E3779F9ull;
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDull;
+    h ^= h >> 33;
+    return h;
+}
+
+} // namespace
+
+// Заголовок сегмента. Раскладка задается создателем; остальные процессы
+// читают ее отсюда, а не вычисляют сами.
+struct SharedTier::Header {
+    uint64_t magic;
+    uint32_t version;
+    std::atomic<uint32_t> ready;    // Создатель закончил разметку
+    std::atomic<uint32_t> attached; // Подключено процессов
+    uint64_t bytes;
+    uint64_t block_size;
+    uint64_t stripe_count;
+    uint64_t slots_per_stripe;
+    uint64_t bucket_mask;           // Корзин в полосе минус один
+    uint64_t stripes_offset;
+    uint64_t buckets_offset;
+    uint64_t slots_offset;
+    uint64_t data_offset;
+};
+
+// Полоса: слоты [id * slots_per_stripe, (id + 1) * slots_per_stripe) и свои
+// корзины. Все поля, кроме счетчиков, меняются под mutex.
+struct alignas(64) SharedTier::Stripe {
+#ifndef _WIN32
+    pthread_mutex_t mutex;
+#endif
+    uint32_t hand;      // Стрелка часов, смещение внутри полосы
+    uint32_t free_head; // Список свободных слотов через Slot::next
+    std::atomic<uint32_t> resident;
+    std::atomic<uint64_t> hits;
+    std::atomic<uint64_t> misses;
+    std::atomic<uint64_t> inserts;
+    std::atomic<uint64_t> evictions;
+};
+
+struct SharedTier::Slot {
+    SharedBlockKey key;
+    uint32_t next;      // Следующий в цепочке корзины или в списке свободных
+    uint32_t length;    // Достоверных байт данных
+    uint8_t used;
+    uint8_t referenced; // Бит часов
+};
+
+SharedTier::SharedTier(void *base, size_t bytes, size_t block_size)
+    : base(base), bytes(bytes), block_size(block_size) {
+    char *p = static_cast<char *>(base);
+    header = reinterpret_cast<Header *>(p);
+    stripes = reinterpret_cast<Stripe *>(p + header->stripes_offset);
+    buckets = reinterpret_cast<uint32_t *>(p + header->buckets_offset);
+    slots = reinterpret_cast<Slot *>(p + header->slots_offset);
+    data_base = p + header->data_offset;
+}
+
+SharedTier::Stripe &SharedTier::stripeFor(uint64_t h) const {
+    return stripes[h % header->stripe_count];
+}
+
+uint32_t *SharedTier::bucketFor(Stripe &stripe, uint64_t h) const {
+    size_t id = &stripe - stripes;
+    return &buckets[id * (header->bucket_mask + 1) + ((h >> 32) & header->bucket_mask)];
+}
+
+uint32_t SharedTier::find(Stripe &stripe, const SharedBlockKey &key, uint64_t h) const {
+    for (uint32_t slot = *bucketFor(stripe, h); slot != npos; slot = slots[slot].next) {
+        const SharedBlockKey &k = slots[slot].key;
+        if (k.block_number == key.block_number && k.ino == key.ino && k.dev == key.dev) return slot;
+    }
+    return npos;
+}
+
+// Часы полосы: слот со снятым битом обращения убирается из цепочки и
+// отдается под новый блок
+uint32_t SharedTier::evict(Stripe &stripe) {
+    size_t first = (&stripe - stripes) * header->slots_per_stripe;
+    for (size_t step = 0; step < 2 * header->slots_per_stripe; ++step) {
+        uint32_t slot = static_cast<uint32_t>(first + stripe.hand);
+        stripe.hand = static_cast<uint32_t>((stripe.hand + 1) % header->slots_per_stripe);
+        Slot &s = slots[slot];
+        if (!s.used) continue;
+        if (s.referenced) {
+            s.referenced = 0;
+            continue;
+        }
+
+        uint32_t *link = bucketFor(stripe, hashKey(s.key));
+        while (*link != slot) link = &slots[*link].next;
+        *link = s.next;
+        s.used = 0;
+        stripe.resident.fetch_sub(1, std::memory_order_relaxed);
+        stripe.evictions.fetch_add(1, std::memory_order_relaxed);
+        return slot;
+    }
+    return npos;
+}
+
+// Пустая полоса: после гибели процесса посреди изменения ее цепочкам
+// нельзя доверять
+void SharedTier::reset(Stripe &stripe) const {
+    size_t id = &stripe - stripes;
+    size_t first = id * header->slots_per_stripe;
+    std::fill_n(buckets + id * (header->bucket_mask + 1), header->bucket_mask + 1, npos);
+    for (size_t i = 0; i < header->slots_per_stripe; ++i) {
+        Slot &s = slots[first + i];
+        s.used = 0;
+        s.referenced = 0;
+        s.next = i + 1 < header->slots_per_stripe ? static_cast<uint32_t>(first + i + 1) : npos;
+    }
+    stripe.free_head = static_cast<uint32_t>(first);
+    stripe.hand = 0;
+    stripe.resident.store(0, std::memory_order_relaxed);
+}
+
+ssize_t SharedTier::get(const SharedBlockKey &key, char *out) {
+    uint64_t h = hashKey(key);
+    Stripe &stripe = stripeFor(h);
+    lock(stripe);
+    uint32_t slot = find(stripe, key, h);
+    if (slot == npos) {
+        unlock(stripe);
+        stripe.misses.fetch_add(1, std::memory_order_relaxed);
+        return -1;
+    }
+    slots[slot].referenced = 1;
+    size_t length = slots[slot].length;
+    memcpy(out, data(slot), length);
+    unlock(stripe);
+
+    if (length < block_size) memset(out + length, 0, block_size - length);
+    stripe.hits.fetch_add(1, std::memory_order_relaxed);
+    return static_cast<ssize_t>(length);
+}
+
+void SharedTier::put(const SharedBlockKey &key, const char *src, size_t length, bool replace) {
+    length = std::min(length, block_size);
+    uint64_t h = hashKey(key);
+    Stripe &stripe = stripeFor(h);
+    lock(stripe);
+    uint32_t slot = find(stripe, key, h);
+    if (slot != npos) {
+        if (replace) {
+            memcpy(data(slot), src, length);
+            slots[slot].length = static_cast<uint32_t>(length);
+        }
+        unlock(stripe);
+        return;
+    }
+
+    slot = stripe.free_head;
+    if (slot != npos) stripe.free_head = slots[slot].next;
+    else slot = evict(stripe);
+    if (slot == npos) {
+        unlock(stripe);
+        return;
+    }
+    Slot &s = slots[slot];
+    s.key = key;
+    s.length = static_cast<uint32_t>(length);
+    s.used = 1;
+    s.referenced = 0;
+    memcpy(data(slot), src, length);
+    uint32_t *bucket = bucketFor(stripe, h);
+    s.next = *bucket;
+    *bucket = slot;
+    stripe.resident.fetch_add(1, std::memory_order_relaxed);
+    unlock(stripe);
+    stripe.inserts.fetch_add(1, std::memory_order_relaxed);
+}
+
+SharedTierStats SharedTier::stats() const {
+    SharedTierStats total{};
+    total.blocks = header->stripe_count * header->slots_per_stripe;
+    for (size_t i = 0; i < header->stripe_count; ++i) {
+        const Stripe &s = stripes[i];
+        total.resident += s.resident.load(std::memory_order_relaxed);
+        total.hits += s.hits.load(std::memory_order_relaxed);
+        total.misses += s.misses.load(std::memory_order_relaxed);
+        total.inserts += s.inserts.load(std::memory_order_relaxed);
+        total.evictions += s.evictions.load(std::memory_order_relaxed);
+    }
+    total.attached = header->attached.load(std::memory_order_relaxed);
+    return total;
+}
+
+#ifdef _WIN32
+
+// Межпроцессный ярус построен на POSIX shared memory и устойчивых мьютексах
+std::unique_ptr<SharedTier> SharedTier::attach(const char *, size_t, size_t) {
+    return nullptr;
+}
+
+bool SharedTier::unlink(const char *) {
+    return false;
+}
+
+SharedTier::~SharedTier() = default;
+
+void SharedTier::lock(Stripe &) const {}
+
+void SharedTier::unlock(Stripe &) const {}
+
+#else
+
+namespace {
+
+// Ждет, пока cond не станет истинным, не дольше секунды
+template<typename Cond>
+bool waitFor(Cond cond) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+    while (!cond()) {
+        if (std::chrono::steady_clock::now() > deadline) return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+}
+
+} // namespace
+
+std::unique_ptr<SharedTier> SharedTier::attach(const char *name, size_t block_size, size_t blocks) {
+    if (block_size == 0 || blocks >= npos) return nullptr;
+
+    int fd = blocks > 0 ? ::shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600) : -1;
+    if (fd >= 0) {
+        size_t stripe_count = std::min(max_stripes, std::max<size_t>(1, blocks / 64));
+        size_t per_stripe = blocks / stripe_count;
+        size_t bucket_count = 1;
+        while (bucket_count < per_stripe) bucket_count <<= 1;
+
+        Header layout{};
+        layout.stripes_offset = alignUp(sizeof(Header), alignof(Stripe));
+        layout.buckets_offset = layout.stripes_offset + stripe_count * sizeof(Stripe);
+        layout.slots_offset = alignUp(layout.buckets_offset + stripe_count * bucket_count * sizeof(uint32_t),
+                                      alignof(Slot));
+        layout.data_offset = alignUp(layout.slots_offset + stripe_count * per_stripe * sizeof(Slot), page_size);
+        layout.bytes = layout.data_offset + stripe_count * per_stripe * block_size;
+
+        void *base = MAP_FAILED;
+        if (::ftruncate(fd, static_cast<off_t>(layout.bytes)) == 0)
+            base = ::mmap(nullptr, layout.bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (base == MAP_FAILED) {
+            ::shm_unlink(name);
+            return nullptr;
+        }
+
+        Header *header = new(base) Header();
+        header->magic = shared_magic;
+        header->version = shared_version;
+        header->bytes = layout.bytes;
+        header->block_size = block_size;
+        header->stripe_count = stripe_count;
+        header->slots_per_stripe = per_stripe;
+        header->bucket_mask = bucket_count - 1;
+        header->stripes_offset = layout.stripes_offset;
+        header->buckets_offset = layout.buckets_offset;
+        header->slots_offset = layout.slots_offset;
+        header->data_offset = layout.data_offset;
+
+        std::unique_ptr<SharedTier> tier(new SharedTier(base, layout.bytes, block_size));
+        pthread_mutexattr_t attr;
+        pthread_mutexattr_init(&attr);
+        pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+        pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+        for (size_t i = 0; i < stripe_count; ++i) {
+            Stripe *stripe = new(&tier->stripes[i]) Stripe();
+            pthread_mutex_init(&stripe->mutex, &attr);
+            tier->reset(*stripe);
+        }
+        pthread_mutexattr_destroy(&attr);
+
+        header->attached.store(1);
+        header->ready.store(1, std::memory_order_release);
+        return tier;
+    }
+    if (blocks > 0 && errno != EEXIST) return nullptr;
+
+    // Сегмент уже есть: создатель мог еще не задать размер и не разметить его
+    fd = ::shm_open(name, O_RDWR, 0);
+    if (fd < 0) return nullptr;
+    struct stat st{};
+    bool sized = waitFor([&] {
+        return ::fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= sizeof(Header);
+    });
+    void *base = sized ? ::mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    ::close(fd);
+    if (base == MAP_FAILED) return nullptr;
+
+    Header *header = static_cast<Header *>(base);
+    bool valid = waitFor([&] { return header->ready.load(std::memory_order_acquire) != 0; }) &&
+                 header->magic == shared_magic && header->version == shared_version &&
+                 header->block_size == block_size && header->bytes == static_cast<uint64_t>(st.st_size);
+    if (!valid) {
+        ::munmap(base, st.st_size);
+        return nullptr;
+    }
+    header->attached.fetch_add(1);
+    return std::unique_ptr<SharedTier>(new SharedTier(base, st.st_size, block_size));
+}
+
+bool SharedTier::unlink(const char *name) {
+    return ::shm_unlink(name) == 0;
+}
+
+SharedTier::~SharedTier() {
+    header->attached.fetch_sub(1);
+    ::munmap(base, bytes);
+}
+
+void SharedTier::lock(Stripe &stripe) const {
+    if (pthread_mutex_lock(&stripe.mutex) == EOWNERDEAD) {
+        reset(stripe);
+        pthread_mutex_consistent(&stripe.mutex);
+    }
+}
+
+void SharedTier::unlock(Stripe &stripe) const {
+    pthread_mutex_unlock(&stripe.mutex);
+}
+
+#endif
@@ -0,0 +1,278 @@
+#include "storage_backend.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+#include <vector>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+
+// Кольца io_uring через системные вызовы без liburing
+int uringSetup(unsigned entries, io_uring_params *params) {
+    return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+}
+
+int uringEnter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return static_cast<int>(::syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+// Одно кольцо: очередь отправки, очередь завершений и массив SQE
+class Ring {
+public:
+    static constexpr unsigned depth = 64; // Глубина очереди одного кольца
+
+    ~Ring() {
+        if (sqes) ::munmap(sqes, sqes_len);
+        if (cq_ptr && cq_ptr != sq_ptr) ::munmap(cq_ptr, cq_len);
+        if (sq_ptr) ::munmap(sq_ptr, sq_len);
+        if (fd >= 0) ::close(fd);
+    }
+
+    bool init() {
+        io_uring_params params{};
+        fd = uringSetup(depth, &params);
+        if (fd < 0) return false;
+
+        sq_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_len = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single) sq_len = cq_len = std::max(sq_len, cq_len);
+
+        sq_ptr = map(sq_len, IORING_OFF_SQ_RING);
+        if (!sq_ptr) return false;
+        cq_ptr = single ? sq_ptr : map(cq_len, IORING_OFF_CQ_RING);
+        if (!cq_ptr) return false;
+        sqes_len = params.sq_entries * sizeof(io_uring_sqe);
+        sqes = static_cast<io_uring_sqe *>(map(sqes_len, IORING_OFF_SQES));
+        if (!sqes) return false;
+
+        char *sq = static_cast<char *>(sq_ptr);
+        sq_tail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+        sq_mask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+        sq_array = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+        char *cq = static_cast<char *>(cq_ptr);
+        cq_head = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+        cq_tail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+        cq_mask = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+        return true;
+    }
+
+    // Отправляет до depth запросов и собирает все их завершения.
+    // Ошибки записываются в result как -1.
+    bool run(IoRequest *requests, size_t count) {
+        unsigned tail = *sq_tail;
+        for (size_t i = 0; i < count; ++i) {
+            unsigned index = tail & sq_mask;
+            io_uring_sqe *sqe = &sqes[index];
+            std::memset(sqe, 0, sizeof(*sqe));
+            sqe->opcode = requests[i].write ? IORING_OP_WRITEV : IORING_OP_READV;
+            sqe->fd = requests[i].handle;
+            sqe->addr = reinterpret_cast<uint64_t>(requests[i].iov);
+            sqe->len = static_cast<unsigned>(requests[i].iovcnt);
+            sqe->off = static_cast<uint64_t>(requests[i].offset);
+            sqe->user_data = i;
+            sq_array[index] = index;
+            ++tail;
+        }
+        __atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+
+        unsigned to_submit = static_cast<unsigned>(count);
+        size_t done = 0;
+        while (done < count) {
+            int ret = uringEnter(fd, to_submit, static_cast<unsigned>(count - done), IORING_ENTER_GETEVENTS);
+            if (ret < 0) {
+                if (errno == EINTR || errno == EAGAIN || errno == EBUSY) continue;
+                return false;
+            }
+            to_submit -= std::min<unsigned>(to_submit, ret);
+
+            // Цикл завершений: результаты раскладываются по запросам пакета
+            unsigned head = *cq_head;
+            unsigned ready = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+            for (; head != ready; ++head, ++done) {
+                const io_uring_cqe &cqe = cqes[head & cq_mask];
+                requests[cqe.user_data].result = cqe.res < 0 ? -1 : cqe.res;
+            }
+            __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+        }
+        return true;
+    }
+
+private:
+    int fd{-1};
+    void *sq_ptr{nullptr};
+    void *cq_ptr{nullptr};
+    size_t sq_len{0};
+    size_t cq_len{0};
+    size_t sqes_len{0};
+    io_uring_sqe *sqes{nullptr};
+    unsigned *sq_tail{nullptr};
+    unsigned sq_mask{0};
+    unsigned *sq_array{nullptr};
+    unsigned *cq_head{nullptr};
+    unsigned *cq_tail{nullptr};
+    unsigned cq_mask{0};
+    io_uring_cqe *cqes{nullptr};
+
+    void *map(size_t length, off_t offset) {
+        void *ptr = ::mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+        return ptr == MAP_FAILED ? nullptr : ptr;
+    }
+};
+
+// Пакеты уходят в io_uring, одиночные вызовы - в синхронный бэкенд: для
+// одной операции pread дешевле отправки через кольцо. Кольца берутся из
+// пула, так что пакеты разных потоков идут параллельно без общей блокировки.
+class UringBackend : public StorageBackend {
+public:
+    explicit UringBackend(std::unique_ptr<StorageBackend> fallback) : fallback(std::move(fallback)) {}
+
+    NativeHandle openFile(const char *path, bool direct_io) override {
+        return fallback->openFile(path, direct_io);
+    }
+
+    NativeHandle createFile(const char *path, bool direct_io) override {
+        return fallback->createFile(path, direct_io);
+    }
+
+    void closeFile(NativeHandle handle) override {
+        fallback->closeFile(handle);
+    }
+
+    ssize_t readAt(NativeHandle handle, void *buf, size_t count, off_t offset) override {
+        return fallback->readAt(handle, buf, count, offset);
+    }
+
+    ssize_t writeAt(NativeHandle handle, const void *buf, size_t count, off_t offset) override {
+        return fallback->writeAt(handle, buf, count, offset);
+    }
+
+    ssize_t readvAt(NativeHandle handle, const struct iovec *iov, int iovcnt, off_t offset) override {
+        return fallback->readvAt(handle, iov, iovcnt, offset);
+    }
+
+    ssize_t writevAt(NativeHandle handle, const struct iovec *iov, int iovcnt, off_t offset) override {
+        return fallback->writevAt(handle, iov, iovcnt, offset);
+    }
+
+    void submitBatch(IoRequest *requests, size_t count) override {
+        if (count == 1) {
+            fallback->submitBatch(requests, count);
+            return;
+        }
+        std::unique_ptr<Ring> ring = takeRing();
+        for (size_t first = 0; first < count; first += Ring::depth) {
+            size_t chunk = std::min<size_t>(Ring::depth, count - first);
+            if (ring && !ring->run(requests + first, chunk)) ring.reset(); // Состояние кольца неизвестно
+            if (!ring) {
+                fallback->submitBatch(requests + first, chunk);
+                continue;
+            }
+            for (size_t i = first; i < first + chunk; ++i) finishShort(requests[i]);
+        }
+        if (ring) returnRing(std::move(ring));
+    }
+
+    int syncFile(NativeHandle handle) override {
+        return fallback->syncFile(handle);
+    }
+
+    off_t fileSize(NativeHandle handle) override {
+        return fallback->fileSize(handle);
+    }
+
+    int resizeFile(NativeHandle handle, off_t size) override {
+        return fallback->resizeFile(handle, size);
+    }
+
+    int allocateFile(NativeHandle handle, off_t size) override {
+        return fallback->allocateFile(handle, size);
+    }
+
+    bool fileId(NativeHandle handle, uint64_t *dev, uint64_t *ino) override {
+        return fallback->fileId(handle, dev, ino);
+    }
+
+    int64_t modifiedTime(NativeHandle handle) override {
+        return fallback->modifiedTime(handle);
+    }
+
+    void *mapFile(NativeHandle handle, size_t length) override {
+        return fallback->mapFile(handle, length);
+    }
+
+    void unmapFile(void *addr, size_t length) override {
+        fallback->unmapFile(addr, length);
+    }
+
+    int syncMapped(void *addr, size_t length) override {
+        return fallback->syncMapped(addr, length);
+    }
+
+    void adviseMapped(void *addr, size_t length, MapAdvice advice) override {
+        fallback->adviseMapped(addr, length, advice);
+    }
+
+    std::unique_ptr<Ring> takeRing() {
+        {
+            std::lock_guard<std::mutex> lock(rings_mutex);
+            if (!rings.empty()) {
+                std::unique_ptr<Ring> ring = std::move(rings.back());
+                rings.pop_back();
+                return ring;
+            }
+        }
+        auto ring = std::make_unique<Ring>();
+        return ring->init() ? std::move(ring) : nullptr;
+    }
+
+    void returnRing(std::unique_ptr<Ring> ring) {
+        std::lock_guard<std::mutex> lock(rings_mutex);
+        rings.push_back(std::move(ring));
+    }
+
+private:
+    std::unique_ptr<StorageBackend> fallback;
+    std::mutex rings_mutex;                   // Защищает rings
+    std::vector<std::unique_ptr<Ring>> rings; // Свободные кольца
+
+    // Кольцо может вернуть короткий результат посреди файла; остаток
+    // дочитывается или дописывается синхронно
+    void finishShort(IoRequest &req) {
+        if (req.result < 0) return;
+        size_t skip = req.result;
+        std::vector<struct iovec> rest;
+        for (int i = 0; i < req.iovcnt; ++i) {
+            if (skip >= req.iov[i].iov_len) {
+                skip -= req.iov[i].iov_len;
+                continue;
+            }
+            rest.push_back({static_cast<char *>(req.iov[i].iov_base) + skip, req.iov[i].iov_len - skip});
+            skip = 0;
+        }
+        if (rest.empty()) return;
+
+        off_t pos = req.offset + req.result;
+        int n = static_cast<int>(rest.size());
+        ssize_t more = req.write ? fallback->writevAt(req.handle, rest.data(), n, pos)
+                                 : fallback->readvAt(req.handle, rest.data(), n, pos);
+        req.result = more < 0 ? -1 : req.result + more;
+    }
+};
+
+}
+
+std::unique_ptr<StorageBackend> createUringBackend(std::unique_ptr<StorageBackend> fallback) {
+    auto backend = std::make_unique<UringBackend>(std::move(fallback));
+    // Пробное кольцо: без него бэкенд бесполезен
+    std::unique_ptr<Ring> ring = backend->takeRing();
+    if (!ring) return nullptr;
+    backend->returnRing(std::move(ring));
+    return backend;
+}
@@ -0,0 +1,400 @@
+#include "victim_file.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+namespace {
+
+constexpr char victim_magic[8] = {'N', 'R', 'U', 'V', 'I', 'C', 'T', '1'};
+constexpr uint64_t victim_version = 1;
+// Описатели, измененные взятием блоков, дописываются не реже этого
+constexpr std::chrono::milliseconds record_interval(100);
+
+int64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Контрольная сумма блока: четыре независимые цепочки умножений, чтобы
+// не ждать задержки каждого умножения
+uint64_t checksumOf(const char *data, size_t n) {
+    uint64_t lanes[4] = {0x9E3779B97F4A7C15ull, 0xC2B2AE3D27D4EB4Full, 0x165667B19E3779F9ull, n};
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        for (size_t lane = 0; lane < 4; ++lane) {
+            uint64_t word;
+            memcpy(&word, data + i + lane * 8, sizeof(word));
+            lanes[lane] = (lanes[lane] ^ word) * 0xFF51AFD7ED558CCDull;
+            lanes[lane] ^= lanes[lane] >> 29;
+        }
+    }
+    for (; i < n; ++i) lanes[0] = (lanes[0] ^ static_cast<uint8_t>(data[i])) * 0x100000001B3ull;
+    uint64_t h = lanes[0] ^ (lanes[1] << 1 | lanes[1] >> 63) ^ (lanes[2] << 2 | lanes[2] >> 62) ^
+                 (lanes[3] << 3 | lanes[3] >> 61);
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+} // namespace
+
+std::unique_ptr<VictimFile> VictimFile::open(const char *path, size_t block_size, size_t bytes) {
+    size_t per_block = block_size / sizeof(Record);
+    size_t blocks = bytes / block_size;
+    // Слотам нужен еще блок описателей на каждые per_block
+    size_t slots = blocks > 1 && per_block > 0 ? (blocks - 1) * per_block / (per_block + 1) : 0;
+    if (slots == 0 || slots >= BlockIndex::npos) return nullptr;
+
+    std::unique_ptr<StorageBackend> io = createStorageBackend();
+    NativeHandle handle = io->createFile(path, true);
+    if (handle == INVALID_NATIVE_HANDLE) return nullptr;
+    std::unique_ptr<VictimFile> file(new VictimFile(std::move(io), handle, block_size, slots));
+    if (!file->load()) return nullptr;
+    file->writer = std::thread(&VictimFile::writerLoop, file.get());
+    return file;
+}
+
+VictimFile::VictimFile(std::unique_ptr<StorageBackend> io, NativeHandle handle, size_t block_size, size_t slots)
+    : io(std::move(io)), handle(handle), block_size(block_size), slots(slots),
+      record_blocks((slots * sizeof(Record) + block_size - 1) / block_size),
+      meta(block_size, 1 + record_blocks, ArenaPages::Normal),
+      records(reinterpret_cast<Record *>(meta.block(1))),
+      staging(block_size, queue_limit + 1, ArenaPages::Normal),
+      index(std::make_unique<BlockIndex>(slots)), slot_tag(slots, -1), slot_prev(slots, BlockIndex::npos),
+      slot_next(slots, BlockIndex::npos), pins(slots, 0),
+      record_dirty(record_blocks, 0) {
+    for (size_t i = queue_limit; i > 0; --i) free_buffers.push_back(static_cast<uint32_t>(i - 1));
+    counters.slots = slots;
+}
+
+VictimFile::~VictimFile() {
+    close();
+}
+
+// Читает заголовок и описатели и восстанавливает индекс; файл другой
+// разметки (или новый) размечается заново и выделяется целиком
+bool VictimFile::load() {
+    size_t meta_bytes = (1 + record_blocks) * block_size;
+    Header expected{};
+    memcpy(expected.magic, victim_magic, sizeof(victim_magic));
+    expected.version = victim_version;
+    expected.block_size = block_size;
+    expected.slots = slots;
+
+    if (io->readAt(handle, meta.block(0), meta_bytes, 0) == static_cast<ssize_t>(meta_bytes) &&
+        memcmp(meta.block(0), &expected, sizeof(expected)) == 0) {
+        uint64_t newest = 0;
+        for (uint32_t slot = 0; slot < slots; ++slot) {
+            const Record &record = records[slot];
+            if (record.sequence == 0) {
+                free_slots.push_back(slot);
+                continue;
+            }
+            int tag = tagOf(record.dev, record.ino);
+            // Один блок в двух слотах - после сбоя; верна более поздняя копия
+            uint32_t other = index->find(tag, record.block_number);
+            if (other != BlockIndex::npos) {
+                if (records[other].sequence > record.sequence) continue;
+                dropSlot(other);
+            }
+            index->insert(tag, record.block_number, slot);
+            linkSlot(slot, tag);
+            if (record.sequence > newest) {
+                newest = record.sequence;
+                cursor = (slot + 1) % slots;
+            }
+        }
+        next_sequence = newest + 1;
+        counters.restored = index->size();
+        // Убранные дубликаты дописываются потоком записи
+        return true;
+    }
+
+    memset(meta.block(0), 0, meta_bytes);
+    memcpy(meta.block(0), &expected, sizeof(expected));
+    std::fill(record_dirty.begin(), record_dirty.end(), 0);
+    return io->allocateFile(handle, slotOffset(static_cast<uint32_t>(slots))) == 0 &&
+           io->writeAt(handle, meta.block(0), meta_bytes, 0) == static_cast<ssize_t>(meta_bytes) &&
+           io->syncFile(handle) == 0;
+}
+
+int VictimFile::tagOf(uint64_t dev, uint64_t ino) {
+    auto inserted = files.emplace(std::make_pair(dev, ino), FileState{next_tag, -1});
+    if (inserted.second) {
+        ++next_tag;
+        tag_head.push_back(BlockIndex::npos);
+    }
+    return inserted.first->second.tag;
+}
+
+// Заносит слот в список файла tag, чтобы обходы файла не трогали чужие слоты
+void VictimFile::linkSlot(uint32_t slot, int tag) {
+    slot_tag[slot] = tag;
+    slot_prev[slot] = BlockIndex::npos;
+    slot_next[slot] = tag_head[tag];
+    if (tag_head[tag] != BlockIndex::npos) slot_prev[tag_head[tag]] = slot;
+    tag_head[tag] = slot;
+}
+
+// Убирает копию слота из индекса; описатель на диске гасится при
+// следующей записи описателей
+void VictimFile::dropSlot(uint32_t slot) {
+    int tag = slot_tag[slot];
+    if (tag < 0) return;
+    index->erase(tag, records[slot].block_number);
+    if (slot_prev[slot] != BlockIndex::npos) slot_next[slot_prev[slot]] = slot_next[slot];
+    else tag_head[tag] = slot_next[slot];
+    if (slot_next[slot] != BlockIndex::npos) slot_prev[slot_next[slot]] = slot_prev[slot];
+    slot_tag[slot] = -1;
+    free_slots.push_back(slot);
+    records[slot].sequence = 0;
+    record_dirty[slot * sizeof(Record) / block_size] = 1;
+}
+
+// Снимает с очереди копии блоков [first, first + count) файла и отменяет
+// пишущуюся: в кэш они пришли раньше, чем легли бы в файл
+void VictimFile::cancelPending(uint64_t dev, uint64_t ino, off_t first, size_t count) {
+    auto covers = [&](const Pending &item) {
+        return item.dev == dev && item.ino == ino && item.block_number >= first &&
+               item.block_number < first + static_cast<off_t>(count);
+    };
+    for (auto it = queue.begin(); it != queue.end();) {
+        if (covers(*it)) {
+            free_buffers.push_back(it->buffer);
+            it = queue.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    if (writing && covers(current)) current.cancelled = true;
+}
+
+void VictimFile::validate(uint64_t dev, uint64_t ino, int64_t mtime) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (closed) return;
+    int tag = tagOf(dev, ino);
+    FileState &file = files[{dev, ino}];
+    if (file.mtime != mtime) cancelPending(dev, ino, 0, SIZE_MAX / 2);
+    file.mtime = mtime;
+    for (uint32_t slot = tag_head[tag]; slot != BlockIndex::npos;) {
+        uint32_t next = slot_next[slot];
+        if (records[slot].mtime != mtime) dropSlot(slot);
+        slot = next;
+    }
+}
+
+void VictimFile::refresh(uint64_t dev, uint64_t ino, int64_t mtime) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = files.find({dev, ino});
+    if (closed || it == files.end()) return;
+    it->second.mtime = mtime;
+    for (uint32_t slot = tag_head[it->second.tag]; slot != BlockIndex::npos; slot = slot_next[slot]) {
+        if (records[slot].mtime == mtime) continue;
+        records[slot].mtime = mtime;
+        record_dirty[slot * sizeof(Record) / block_size] = 1;
+    }
+}
+
+void VictimFile::dropFile(uint64_t dev, uint64_t ino) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = files.find({dev, ino});
+    if (closed || it == files.end()) return;
+    cancelPending(dev, ino, 0, SIZE_MAX / 2);
+    while (tag_head[it->second.tag] != BlockIndex::npos) dropSlot(tag_head[it->second.tag]);
+}
+
+void VictimFile::put(uint64_t dev, uint64_t ino, off_t block_number, const char *data) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (stopping) return;
+    removeRange(dev, ino, block_number, 1);
+    if (free_buffers.empty()) {
+        ++counters.dropped;
+        return;
+    }
+    uint32_t buffer = free_buffers.back();
+    free_buffers.pop_back();
+    memcpy(staging.block(buffer), data, block_size);
+    queue.push_back({dev, ino, block_number, buffer, false});
+    writer_cv.notify_one();
+}
+
+bool VictimFile::take(uint64_t dev, uint64_t ino, off_t first, size_t count, char *const *out) {
+    thread_local std::vector<uint32_t> taken;
+    thread_local std::vector<uint64_t> sums;
+    thread_local std::vector<struct iovec> iov;
+    thread_local std::vector<IoRequest> requests;
+    taken.clear();
+    sums.clear();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    if (closed) return false;
+    cancelPending(dev, ino, first, count);
+    auto it = files.find({dev, ino});
+    int tag = it != files.end() ? it->second.tag : -1;
+    bool all = tag >= 0;
+    for (size_t i = 0; i < count && all; ++i) all = index->find(tag, first + i) != BlockIndex::npos;
+    for (size_t i = 0; tag >= 0 && i < count; ++i) {
+        uint32_t slot = index->find(tag, first + i);
+        if (slot == BlockIndex::npos) continue;
+        if (all) {
+            // Слот закреплен, пока читается: кольцо его не займет
+            ++pins[slot];
+            taken.push_back(slot);
+            sums.push_back(records[slot].checksum);
+        }
+        dropSlot(slot);
+    }
+    if (!all) {
+        counters.misses += count;
+        return false;
+    }
+    lock.unlock();
+
+    int64_t started = nowNs();
+    iov.resize(count);
+    requests.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+        iov[i] = {out[i], block_size};
+        requests[i] = {handle, &iov[i], 1, slotOffset(taken[i]), false, 0};
+    }
+    io->submitBatch(requests.data(), count);
+    bool ok = true;
+    size_t corrupt = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (requests[i].result != static_cast<ssize_t>(block_size)) ok = false;
+        else if (checksumOf(out[i], block_size) != sums[i]) ++corrupt;
+    }
+    ok = ok && corrupt == 0;
+    int64_t elapsed = nowNs() - started;
+
+    lock.lock();
+    for (uint32_t slot: taken) --pins[slot];
+    unpinned.notify_all();
+    counters.corrupt += corrupt;
+    if (ok) {
+        counters.hits += count;
+        counters.read_ns += elapsed;
+    } else {
+        counters.misses += count;
+    }
+    return ok;
+}
+
+void VictimFile::erase(uint64_t dev, uint64_t ino, off_t first, size_t count) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!closed) removeRange(dev, ino, first, count);
+}
+
+void VictimFile::removeRange(uint64_t dev, uint64_t ino, off_t first, size_t count) {
+    cancelPending(dev, ino, first, count);
+    auto it = files.find({dev, ino});
+    if (it == files.end()) return;
+    for (size_t i = 0; i < count; ++i) {
+        uint32_t slot = index->find(it->second.tag, first + i);
+        if (slot != BlockIndex::npos) dropSlot(slot);
+    }
+}
+
+// Слот под новую копию: освобожденный взятием или стиранием, а если таких
+// нет - следующий в кольце, с вытеснением его копии. Иначе копии, которые
+// еще прочтут, затирались бы ради уже взятых. Закрепленные читателем
+// слоты пропускаются; список свободных может хранить уже занятые слоты.
+uint32_t VictimFile::nextSlot(std::unique_lock<std::mutex> &lock) {
+    while (!free_slots.empty()) {
+        uint32_t slot = free_slots.back();
+        free_slots.pop_back();
+        if (slot_tag[slot] < 0 && pins[slot] == 0) return slot;
+    }
+    for (;;) {
+        for (size_t tried = 0; tried < slots; ++tried) {
+            uint32_t slot = static_cast<uint32_t>(cursor);
+            cursor = (cursor + 1) % slots;
+            if (pins[slot] != 0) continue;
+            if (slot_tag[slot] >= 0) {
+                dropSlot(slot);
+                free_slots.pop_back();
+            }
+            return slot;
+        }
+        unpinned.wait(lock);
+    }
+}
+
+// Дописывает измененные блоки описателей. Блок копируется под блокировкой
+// и пишется без нее; описатель на диске может отстать от данных слота, но
+// тогда не сойдется контрольная сумма.
+void VictimFile::writeRecords(std::unique_lock<std::mutex> &lock) {
+    char *bounce = staging.block(queue_limit);
+    for (size_t i = 0; i < record_blocks; ++i) {
+        if (!record_dirty[i]) continue;
+        record_dirty[i] = 0;
+        memcpy(bounce, meta.block(1 + i), block_size);
+        lock.unlock();
+        io->writeAt(handle, bounce, block_size, static_cast<off_t>(1 + i) * static_cast<off_t>(block_size));
+        lock.lock();
+    }
+}
+
+void VictimFile::writerLoop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+        writer_cv.wait_for(lock, record_interval, [this] { return stopping || !queue.empty(); });
+        if (queue.empty()) {
+            writeRecords(lock);
+            if (stopping && queue.empty()) return;
+            continue;
+        }
+        current = queue.front();
+        queue.pop_front();
+        writing = true;
+        uint32_t slot = nextSlot(lock);
+
+        // Слот вне индекса, читатели до него не дойдут
+        lock.unlock();
+        const char *data = staging.block(current.buffer);
+        bool ok = io->writeAt(handle, data, block_size, slotOffset(slot)) == static_cast<ssize_t>(block_size);
+        uint64_t checksum = ok ? checksumOf(data, block_size) : 0;
+        lock.lock();
+
+        writing = false;
+        free_buffers.push_back(current.buffer);
+        if (!ok || current.cancelled) continue;
+        int tag = tagOf(current.dev, current.ino);
+        Record &record = records[slot];
+        record = {current.dev, current.ino, current.block_number, files[{current.dev, current.ino}].mtime,
+                  checksum, next_sequence++, {0, 0}};
+        index->insert(tag, current.block_number, slot);
+        linkSlot(slot, tag);
+        record_dirty[slot * sizeof(Record) / block_size] = 1;
+        ++counters.spilled;
+    }
+}
+
+void VictimFile::close() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (closed) return;
+        stopping = true;
+    }
+    writer_cv.notify_one();
+    if (writer.joinable()) writer.join();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    unpinned.wait(lock, [this] { return std::all_of(pins.begin(), pins.end(), [](uint16_t p) { return p == 0; }); });
+    index->clear();
+    std::fill(slot_tag.begin(), slot_tag.end(), -1);
+    std::fill(tag_head.begin(), tag_head.end(), BlockIndex::npos);
+    free_slots.clear();
+    closed = true;
+    io->syncFile(handle);
+    io->closeFile(handle);
+}
+
+VictimFileStats VictimFile::stats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    VictimFileStats out = counters;
+    out.resident = index->size();
+    return out;
+}
@@ -0,0 +1,107 @@
+#include "warm_manifest.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <memory>
+#include <string>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+namespace {
+
+constexpr uint64_t manifest_magic = 0x31464E4D4D524157ull; // "WARMMNF1"
+constexpr uint32_t manifest_version = 1;
+
+struct Header {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t block_size;
+    uint64_t file_count;
+};
+
+struct FileRecord {
+    uint64_t dev;
+    uint64_t ino;
+    int64_t size;
+    int64_t mtime;
+    uint64_t extent_count;
+};
+
+using FileCloser = std::unique_ptr<FILE, int (*)(FILE *)>;
+
+bool replaceFile(const char *from, const char *to) {
+#ifdef _WIN32
+    return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    return std::rename(from, to) == 0;
+#endif
+}
+
+} // namespace
+
+bool readManifest(const char *path, size_t block_size, std::vector<ManifestFile> &files) {
+    files.clear();
+    FileCloser in(std::fopen(path, "rb"), std::fclose);
+    if (!in) return errno == ENOENT;
+
+    Header header;
+    if (std::fread(&header, sizeof(header), 1, in.get()) != 1 || header.magic != manifest_magic ||
+        header.version != manifest_version || header.block_size != block_size)
+        return false;
+    // Оставшийся размер ограничивает счетчики: поврежденный файл не заставит
+    // выделить лишнюю память
+    std::fseek(in.get(), 0, SEEK_END);
+    long end = std::ftell(in.get());
+    std::fseek(in.get(), sizeof(header), SEEK_SET);
+    uint64_t left = end > static_cast<long>(sizeof(header)) ? end - sizeof(header) : 0;
+    if (header.file_count > left / sizeof(FileRecord)) return false;
+
+    files.resize(header.file_count);
+    for (ManifestFile &file: files) {
+        FileRecord record;
+        if (std::fread(&record, sizeof(record), 1, in.get()) != 1) break;
+        left -= sizeof(record);
+        if (record.extent_count > left / sizeof(ManifestExtent)) break;
+        file.dev = record.dev;
+        file.ino = record.ino;
+        file.size = record.size;
+        file.mtime = record.mtime;
+        file.extents.resize(record.extent_count);
+        if (record.extent_count &&
+            std::fread(file.extents.data(), sizeof(ManifestExtent), record.extent_count, in.get()) != record.extent_count)
+            break;
+        left -= record.extent_count * sizeof(ManifestExtent);
+        if (&file == &files.back()) return true;
+    }
+    files.clear();
+    return header.file_count == 0;
+}
+
+bool writeManifest(const char *path, size_t block_size, const std::vector<ManifestFile> &files) {
+    std::string temp = std::string(path) + ".tmp";
+    {
+        FileCloser out(std::fopen(temp.c_str(), "wb"), std::fclose);
+        if (!out) return false;
+        Header header{manifest_magic, manifest_version, static_cast<uint32_t>(block_size), files.size()};
+        bool ok = std::fwrite(&header, sizeof(header), 1, out.get()) == 1;
+        for (const ManifestFile &file: files) {
+            if (!ok) break;
+            FileRecord record{file.dev, file.ino, file.size, file.mtime, file.extents.size()};
+            ok = std::fwrite(&record, sizeof(record), 1, out.get()) == 1 &&
+                 (file.extents.empty() ||
+                  std::fwrite(file.extents.data(), sizeof(ManifestExtent), file.extents.size(), out.get()) ==
+                  file.extents.size());
+        }
+        if (std::fflush(out.get()) != 0) ok = false;
+        if (!ok) {
+            out.reset();
+            std::remove(temp.c_str());
+            return false;
+        }
+    }
+    if (replaceFile(temp.c_str(), path)) return true;
+    std::remove(temp.c_str());
+    return false;
+}
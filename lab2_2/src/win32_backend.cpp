@@ -0,0 +1,153 @@
+#include "storage_backend.h"
+
+namespace {
+
+class Win32Backend : public StorageBackend {
+public:
+    NativeHandle openFile(const char *path, bool direct_io) override {
+        return openWith(path, OPEN_EXISTING, direct_io);
+    }
+
+    NativeHandle createFile(const char *path, bool direct_io) override {
+        return openWith(path, OPEN_ALWAYS, direct_io);
+    }
+
+    void closeFile(NativeHandle handle) override {
+        CloseHandle(handle);
+    }
+
+    // Позиционный ввод-вывод через OVERLAPPED без отдельного SetFilePointerEx
+    ssize_t readAt(NativeHandle handle, void *buf, size_t count, off_t offset) override {
+        OVERLAPPED ov{};
+        ULARGE_INTEGER pos;
+        pos.QuadPart = offset;
+        ov.Offset = pos.LowPart;
+        ov.OffsetHigh = pos.HighPart;
+
+        DWORD read = 0;
+        if (!ReadFile(handle, buf, static_cast<DWORD>(count), &read, &ov)) {
+            if (GetLastError() == ERROR_HANDLE_EOF) return 0;
+            return -1;
+        }
+        return read;
+    }
+
+    ssize_t writeAt(NativeHandle handle, const void *buf, size_t count, off_t offset) override {
+        OVERLAPPED ov{};
+        ULARGE_INTEGER pos;
+        pos.QuadPart = offset;
+        ov.Offset = pos.LowPart;
+        ov.OffsetHigh = pos.HighPart;
+
+        DWORD written = 0;
+        if (!WriteFile(handle, buf, static_cast<DWORD>(count), &written, &ov)) return -1;
+        return written;
+    }
+
+    // ReadFileScatter и WriteFileGather требуют буферов по странице на
+    // сегмент, поэтому вектор обходится последовательными позиционными вызовами
+    ssize_t readvAt(NativeHandle handle, const struct iovec *iov, int iovcnt, off_t offset) override {
+        ssize_t done = 0;
+        for (int i = 0; i < iovcnt; ++i) {
+            ssize_t n = readAt(handle, iov[i].iov_base, iov[i].iov_len, offset + done);
+            if (n < 0) return -1;
+            done += n;
+            if (static_cast<size_t>(n) < iov[i].iov_len) break; // EOF
+        }
+        return done;
+    }
+
+    ssize_t writevAt(NativeHandle handle, const struct iovec *iov, int iovcnt, off_t offset) override {
+        ssize_t done = 0;
+        for (int i = 0; i < iovcnt; ++i) {
+            ssize_t n = writeAt(handle, iov[i].iov_base, iov[i].iov_len, offset + done);
+            if (n < 0) return -1;
+            done += n;
+        }
+        return done;
+    }
+
+    int syncFile(NativeHandle handle) override {
+        return FlushFileBuffers(handle) ? 0 : -1;
+    }
+
+    off_t fileSize(NativeHandle handle) override {
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(handle, &size)) return -1;
+        return static_cast<off_t>(size.QuadPart);
+    }
+
+    int resizeFile(NativeHandle handle, off_t size) override {
+        FILE_END_OF_FILE_INFO info{};
+        info.EndOfFile.QuadPart = size;
+        return SetFileInformationByHandle(handle, FileEndOfFileInfo, &info, sizeof(info)) ? 0 : -1;
+    }
+
+    int allocateFile(NativeHandle handle, off_t size) override {
+        FILE_ALLOCATION_INFO info{};
+        info.AllocationSize.QuadPart = size;
+        if (!SetFileInformationByHandle(handle, FileAllocationInfo, &info, sizeof(info))) return -1;
+        return fileSize(handle) >= size ? 0 : resizeFile(handle, size);
+    }
+
+    bool fileId(NativeHandle handle, uint64_t *dev, uint64_t *ino) override {
+        BY_HANDLE_FILE_INFORMATION info;
+        if (!GetFileInformationByHandle(handle, &info)) return false;
+        *dev = info.dwVolumeSerialNumber;
+        *ino = (static_cast<uint64_t>(info.nFileIndexHigh) << 32) | info.nFileIndexLow;
+        return true;
+    }
+
+    // FILETIME идет интервалами по 100 нс
+    int64_t modifiedTime(NativeHandle handle) override {
+        FILETIME written;
+        if (!GetFileTime(handle, nullptr, nullptr, &written)) return -1;
+        return static_cast<int64_t>((static_cast<uint64_t>(written.dwHighDateTime) << 32) |
+                                    written.dwLowDateTime) * 100;
+    }
+
+    // Объект отображения не нужен после MapViewOfFile: вид удерживает его сам.
+    // В отличие от mmap, отображение длиннее файла увеличивает сам файл.
+    void *mapFile(NativeHandle handle, size_t length) override {
+        ULARGE_INTEGER size;
+        size.QuadPart = length;
+        HANDLE mapping = CreateFileMappingA(handle, nullptr, PAGE_READWRITE, size.HighPart, size.LowPart, nullptr);
+        if (!mapping) return nullptr;
+        void *addr = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, length);
+        CloseHandle(mapping);
+        return addr;
+    }
+
+    void unmapFile(void *addr, size_t) override {
+        UnmapViewOfFile(addr);
+    }
+
+    int syncMapped(void *addr, size_t length) override {
+        return FlushViewOfFile(addr, length) ? 0 : -1;
+    }
+
+    void adviseMapped(void *addr, size_t length, MapAdvice advice) override {
+        if (advice != MapAdvice::WillNeed) return;
+        WIN32_MEMORY_RANGE_ENTRY range{addr, length};
+        PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+    }
+
+private:
+    static NativeHandle openWith(const char *path, DWORD disposition, bool direct_io) {
+        return CreateFileA(
+            path,
+            GENERIC_READ | GENERIC_WRITE,
+            FILE_SHARE_READ | FILE_SHARE_WRITE,
+            nullptr,
+            disposition,
+            direct_io ? FILE_FLAG_NO_BUFFERING : FILE_ATTRIBUTE_NORMAL,
+            nullptr
+        );
+    }
+};
+
+}
+
+std::unique_ptr<StorageBackend> createStorageBackend() {
+    return std::make_unique<Win32Backend>();
+}